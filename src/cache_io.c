@@ -1,12 +1,15 @@
 // cache_io.c - Binary cache I/O implementation
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
 #include "cache_io.h"
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 
 #define HASH_TABLE_SIZE 256
 
@@ -26,130 +29,277 @@ static unsigned int hash_string(const char* str) {
 }
 
 /**
- * cache_open - Open or create a cache file
- * 
- * @param path: Path to cache file
- * @return: Cache handle or NULL on error
+ * remember_disk_state - Record which file version the in-memory cache matches
+ *
+ * @param f: The cache file just read or written (fstat, so a save by the
+ *           other process in between cannot be mistaken for this one)
  */
-CacheHandle* cache_open(const char* path) {
-    CacheHandle* cache = calloc(1, sizeof(CacheHandle));
-    if (!cache) return NULL;
-    
-    // Initialize hash table
-    cache->table = calloc(HASH_TABLE_SIZE, sizeof(DocumentEntry*));
-    if (!cache->table) {
-        free(cache);
+static void remember_disk_state(CacheHandle* cache, FILE* f) {
+    struct stat st;
+    if (f && fstat(fileno(f), &st) == 0) {
+        cache->disk_ino = st.st_ino;
+        cache->disk_mtime = st.st_mtim;
+    } else {
+        cache->disk_ino = 0;
+        memset(&cache->disk_mtime, 0, sizeof(cache->disk_mtime));
+    }
+}
+
+/**
+ * free_path_nodes - Drop every interned path node
+ */
+static void free_path_nodes(CacheHandle* cache) {
+    for (uint32_t i = 0; i < cache->path_cap; i++) {
+        if (cache->path_nodes[i]) {
+            free(cache->path_nodes[i]->name);
+            free(cache->path_nodes[i]);
+        }
+    }
+    free(cache->path_nodes);
+    cache->path_nodes = NULL;
+    cache->path_cap = 0;
+    cache->path_next_id = 1;
+    if (cache->path_table) {
+        memset(cache->path_table, 0, HASH_TABLE_SIZE * sizeof(PathNode*));
+    }
+}
+
+/**
+ * insert_path_node - Add a node under its ID, growing the index as needed
+ *
+ * @return: 0 on success, -1 on allocation failure or a duplicate ID
+ */
+static int insert_path_node(CacheHandle* cache, PathNode* node) {
+    if (node->id >= cache->path_cap) {
+        uint32_t cap = cache->path_cap ? cache->path_cap : 64;
+        while (cap <= node->id) cap *= 2;
+        PathNode** grown = realloc(cache->path_nodes, cap * sizeof(*grown));
+        if (!grown) return -1;
+        memset(grown + cache->path_cap, 0, (cap - cache->path_cap) * sizeof(*grown));
+        cache->path_nodes = grown;
+        cache->path_cap = cap;
+    }
+    if (cache->path_nodes[node->id]) return -1;
+
+    cache->path_nodes[node->id] = node;
+    unsigned int hash = hash_string(node->uuid);
+    node->next = cache->path_table[hash];
+    cache->path_table[hash] = node;
+    if (node->id >= cache->path_next_id) cache->path_next_id = node->id + 1;
+    return 0;
+}
+
+/**
+ * read_path_nodes - Load the path table that follows the documents (version 3)
+ */
+static void read_path_nodes(CacheHandle* cache, FILE* f) {
+    uint32_t num_nodes;
+    if (fread(&num_nodes, sizeof(num_nodes), 1, f) != 1) return;
+
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        PathNode* node = calloc(1, sizeof(PathNode));
+        if (!node) return;
+
+        uint16_t name_len;
+        if (fread(&node->id, sizeof(node->id), 1, f) != 1 ||
+            fread(&node->parent, sizeof(node->parent), 1, f) != 1 ||
+            fread(node->uuid, UUID_LEN, 1, f) != 1 ||
+            fread(&name_len, sizeof(name_len), 1, f) != 1 ||
+            node->id == 0 || !(node->name = malloc(name_len + 1))) {
+            free(node);
+            return;
+        }
+        if (name_len > 0 && fread(node->name, name_len, 1, f) != 1) {
+            free(node->name);
+            free(node);
+            return;
+        }
+        node->name[name_len] = '\0';
+        node->uuid[UUID_LEN] = '\0';
+
+        if (insert_path_node(cache, node) != 0) {
+            free(node->name);
+            free(node);
+            return;
+        }
+    }
+}
+
+/**
+ * write_path_nodes - Save the path nodes still referenced by a document
+ *
+ * Nodes are kept if a document points at them or at a descendant; the
+ * rest (deleted documents, emptied folders) are dropped from the file.
+ */
+static void write_path_nodes(CacheHandle* cache, FILE* f) {
+    uint8_t* live = cache->path_cap ? calloc(cache->path_cap, 1) : NULL;
+    uint32_t num_nodes = 0;
+
+    if (live) {
+        for (size_t i = 0; i < cache->table_size; i++) {
+            for (DocumentEntry* doc = cache->table[i]; doc; doc = doc->next) {
+                uint32_t id = doc->path_id;
+                for (int depth = 0; id != 0 && id < cache->path_cap && !live[id] &&
+                                    cache->path_nodes[id] && depth < CACHE_PATH_MAX_DEPTH; depth++) {
+                    live[id] = 1;
+                    num_nodes++;
+                    id = cache->path_nodes[id]->parent;
+                }
+            }
+        }
+    }
+
+    fwrite(&num_nodes, sizeof(num_nodes), 1, f);
+    for (uint32_t id = 1; live && id < cache->path_cap; id++) {
+        if (!live[id]) continue;
+        PathNode* node = cache->path_nodes[id];
+        size_t len = strlen(node->name);
+        uint16_t name_len = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len;
+        fwrite(&node->id, sizeof(node->id), 1, f);
+        fwrite(&node->parent, sizeof(node->parent), 1, f);
+        fwrite(node->uuid, UUID_LEN, 1, f);
+        fwrite(&name_len, sizeof(name_len), 1, f);
+        fwrite(node->name, name_len, 1, f);
+    }
+    free(live);
+}
+
+/**
+ * read_page - Read one page record in the given format version
+ *
+ * @param f: Cache file positioned at a page record
+ * @param version: Format version of the file
+ * @return: Newly allocated page or NULL on error/EOF
+ */
+static PageEntry* read_page(FILE* f, uint8_t version) {
+    PageEntry* page = calloc(1, sizeof(PageEntry));
+    if (!page) return NULL;
+
+    if (fread(page->uuid, UUID_LEN, 1, f) != 1) {
+        free(page);
         return NULL;
     }
-    
-    cache->table_size = HASH_TABLE_SIZE;
-    strncpy(cache->path, path, PATH_MAX - 1);
-    cache->path[PATH_MAX - 1] = '\0';
-    cache->dirty = false;
-    
-    // Try to load existing cache
-    FILE* f = fopen(path, "rb");
-    if (!f) {
-        // No existing cache, that's OK
-        return cache;
+    page->uuid[UUID_LEN] = '\0';
+
+    uint8_t page_num_len;
+    if (fread(&page_num_len, sizeof(page_num_len), 1, f) != 1 ||
+        page_num_len >= MAX_PAGE_NUM_LEN) {
+        free(page);
+        return NULL;
     }
-    
+
+    if (page_num_len > 0) {
+        if (fread(page->page_num, page_num_len, 1, f) != 1) {
+            free(page);
+            return NULL;
+        }
+        page->page_num[page_num_len] = '\0';
+    }
+
+    if (fread(&page->mtime, sizeof(page->mtime), 1, f) != 1) {
+        free(page);
+        return NULL;
+    }
+
+    // Sync status fields were added in version 2
+    if (version >= 2) {
+        if (fread(&page->sync_status, sizeof(page->sync_status), 1, f) != 1 ||
+            fread(&page->retry_count, sizeof(page->retry_count), 1, f) != 1) {
+            free(page);
+            return NULL;
+        }
+    } else {
+        // Version 1: default to pending
+        page->sync_status = SYNC_PENDING;
+        page->retry_count = 0;
+    }
+
+    // Content hash was added in version 3 (0 = unknown)
+    if (version >= 3) {
+        if (fread(&page->content_hash, sizeof(page->content_hash), 1, f) != 1) {
+            free(page);
+            return NULL;
+        }
+    }
+
+    return page;
+}
+
+/**
+ * read_cache_file - Load all documents from an open cache file
+ *
+ * @param cache: Cache handle with an empty table
+ * @param f: Cache file positioned at the start
+ * @return: 0 on success, -1 if the header is invalid
+ *
+ * A truncated body keeps whatever was read before the damage.
+ */
+static int read_cache_file(CacheHandle* cache, FILE* f) {
     // Read and verify header
     uint32_t magic, num_docs;
     uint8_t version;
-    
+
     if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != CACHE_MAGIC) {
-        fclose(f);
-        return cache; // Invalid cache, start fresh
+        return -1;
     }
-    
+
     if (fread(&version, sizeof(version), 1, f) != 1) {
-        fclose(f);
-        return cache;
+        return -1;
     }
-    
+
     // Handle version differences
-    if (version != CACHE_VERSION && version != 1) {
-        fclose(f);
-        return cache; // Incompatible version, start fresh
+    if (version < 1 || version > CACHE_VERSION) {
+        return -1;
     }
-    
+
     if (fread(&num_docs, sizeof(num_docs), 1, f) != 1) {
-        fclose(f);
-        return cache;
+        return -1;
     }
-    
+
     // Read documents
+    uint32_t loaded = 0;
+    bool truncated = false;
     for (uint32_t i = 0; i < num_docs; i++) {
         uint8_t doc_id_len;
         if (fread(&doc_id_len, sizeof(doc_id_len), 1, f) != 1) break;
-        
+
         if (doc_id_len != UUID_LEN) break;
-        
+
         DocumentEntry* doc = calloc(1, sizeof(DocumentEntry));
         if (!doc) break;
-        
+
         if (fread(doc->doc_id, doc_id_len, 1, f) != 1) {
             free(doc);
             break;
         }
         doc->doc_id[doc_id_len] = '\0';
-        
+
+        // Directory fingerprint and interned path node, added in version 3.
+        // Older entries have neither, so each directory is rescanned once.
+        if (version >= 3 &&
+            (fread(&doc->dir_mtime_ns, sizeof(doc->dir_mtime_ns), 1, f) != 1 ||
+             fread(&doc->dir_ino, sizeof(doc->dir_ino), 1, f) != 1 ||
+             fread(&doc->dir_entries, sizeof(doc->dir_entries), 1, f) != 1 ||
+             fread(&doc->path_id, sizeof(doc->path_id), 1, f) != 1)) {
+            free(doc);
+            break;
+        }
+
         uint16_t num_pages;
         if (fread(&num_pages, sizeof(num_pages), 1, f) != 1) {
             free(doc);
             break;
         }
-        
+
         // Read pages
         PageEntry* last_page = NULL;
         for (uint16_t j = 0; j < num_pages; j++) {
-            PageEntry* page = calloc(1, sizeof(PageEntry));
-            if (!page) break;
-            
-            if (fread(page->uuid, UUID_LEN, 1, f) != 1) {
-                free(page);
-                break;
-            }
-            page->uuid[UUID_LEN] = '\0';
-            
-            uint8_t page_num_len;
-            if (fread(&page_num_len, sizeof(page_num_len), 1, f) != 1) {
-                free(page);
-                break;
-            }
-            
-            if (page_num_len >= MAX_PAGE_NUM_LEN) {
-                free(page);
+            PageEntry* page = read_page(f, version);
+            if (!page) {
+                truncated = true;
                 break;
             }
-            
-            if (page_num_len > 0) {
-                if (fread(page->page_num, page_num_len, 1, f) != 1) {
-                    free(page);
-                    break;
-                }
-                page->page_num[page_num_len] = '\0';
-            }
-            
-            if (fread(&page->mtime, sizeof(page->mtime), 1, f) != 1) {
-                free(page);
-                break;
-            }
-            
-            // Read sync status fields if version 2
-            if (version == CACHE_VERSION) {
-                if (fread(&page->sync_status, sizeof(page->sync_status), 1, f) != 1 ||
-                    fread(&page->retry_count, sizeof(page->retry_count), 1, f) != 1) {
-                    free(page);
-                    break;
-                }
-            } else {
-                // Version 1: default to pending
-                page->sync_status = SYNC_PENDING;
-                page->retry_count = 0;
-            }
-            
+
             // Add to linked list
             if (last_page) {
                 last_page->next = page;
@@ -158,17 +308,97 @@ CacheHandle* cache_open(const char* path) {
             }
             last_page = page;
         }
-        
+
         // Add document to hash table
         unsigned int hash = hash_string(doc->doc_id);
         doc->next = cache->table[hash];
         cache->table[hash] = doc;
+
+        if (!truncated) loaded++;
+    }
+
+    // The path table follows the documents (version 3); after damage the
+    // file position is meaningless, and paths are rebuilt from metadata
+    if (version >= 3 && loaded == num_docs) {
+        read_path_nodes(cache, f);
+    }
+
+    return 0;
+}
+
+/**
+ * alloc_handle - Create an empty cache handle for a path
+ */
+static CacheHandle* alloc_handle(const char* path) {
+    CacheHandle* cache = calloc(1, sizeof(CacheHandle));
+    if (!cache) return NULL;
+    
+    // Initialize hash table
+    cache->table = calloc(HASH_TABLE_SIZE, sizeof(DocumentEntry*));
+    if (!cache->table) {
+        free(cache);
+        return NULL;
     }
     
+    cache->table_size = HASH_TABLE_SIZE;
+    cache->path_next_id = 1;
+    cache->path_table = calloc(HASH_TABLE_SIZE, sizeof(PathNode*));
+    if (!cache->path_table) {
+        free(cache->table);
+        free(cache);
+        return NULL;
+    }
+    strncpy(cache->path, path, PATH_MAX - 1);
+    cache->path[PATH_MAX - 1] = '\0';
+    cache->dirty = false;
+    return cache;
+}
+
+/**
+ * cache_open - Open or create a cache file
+ * 
+ * @param path: Path to cache file
+ * @return: Cache handle or NULL on error
+ */
+CacheHandle* cache_open(const char* path) {
+    CacheHandle* cache = alloc_handle(path);
+    if (!cache) return NULL;
+    
+    // Try to load existing cache
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        // No existing cache, that's OK
+        return cache;
+    }
+    
+    // An invalid or incompatible cache just starts fresh
+    read_cache_file(cache, f);
+    
+    remember_disk_state(cache, f);
     fclose(f);
     return cache;
 }
 
+/**
+ * load_disk_copy - Read the cache file into a separate handle
+ *
+ * @param path: Path to cache file
+ * @return: New handle, or NULL if the file is missing, invalid or on error
+ */
+static CacheHandle* load_disk_copy(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    CacheHandle* disk = alloc_handle(path);
+    if (disk && read_cache_file(disk, f) != 0) {
+        cache_close(disk, false);
+        disk = NULL;
+    }
+    if (disk) remember_disk_state(disk, f);
+    fclose(f);
+    return disk;
+}
+
 /**
  * cache_close - Close cache and free resources
  * 
@@ -202,28 +432,64 @@ void cache_close(CacheHandle* cache, bool save) {
     }
     
     free(cache->table);
+    free_path_nodes(cache);
+    free(cache->path_table);
     free(cache);
 }
 
 
 /**
- * cache_save_locked - Save cache with file locking
- * Fixed version of cache_save that uses file locking
+ * lock_cache - Take the lock that serialises cache writers
+ *
+ * @return: Lock descriptor (close it to release), or -1 on error
+ *
+ * The lock is held on "<cache>.lock", not on the cache file, which every
+ * save replaces. Readers need no lock: rename() only ever shows them a
+ * complete file.
  */
-int cache_save(CacheHandle* cache) {
-    if (!cache || !cache->dirty) return 0;
+static int lock_cache(const CacheHandle* cache) {
+    char lock_path[PATH_MAX + 8];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", cache->path);
+
+    int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
 
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/**
+ * disk_changed - Check whether another process saved since we loaded or saved
+ */
+static bool disk_changed(const CacheHandle* cache) {
+    struct stat st;
+    if (stat(cache->path, &st) != 0) return false;
+
+    return st.st_ino != cache->disk_ino ||
+           st.st_mtim.tv_sec != cache->disk_mtime.tv_sec ||
+           st.st_mtim.tv_nsec != cache->disk_mtime.tv_nsec;
+}
+
+/**
+ * write_cache_file - Write the whole cache to a temporary file and rename it in place
+ *
+ * @return: 0 on success, -1 on error
+ *
+ * Call with the writer lock held.
+ */
+static int write_cache_file(CacheHandle* cache) {
     // Write to temporary file first
-    char temp_path[PATH_MAX];
+    char temp_path[PATH_MAX + 8];
     snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache->path);
 
     FILE* f = fopen(temp_path, "wb");
     if (!f) return -1;
 
-    // Use exclusive lock for writing
-    int fd = fileno(f);
-    flock(fd, LOCK_EX);
-
     // Count documents
     uint32_t num_docs = 0;
     for (size_t i = 0; i < cache->table_size; i++) {
@@ -245,6 +511,10 @@ int cache_save(CacheHandle* cache) {
             uint8_t doc_id_len = UUID_LEN;
             fwrite(&doc_id_len, sizeof(doc_id_len), 1, f);
             fwrite(doc->doc_id, doc_id_len, 1, f);
+            fwrite(&doc->dir_mtime_ns, sizeof(doc->dir_mtime_ns), 1, f);
+            fwrite(&doc->dir_ino, sizeof(doc->dir_ino), 1, f);
+            fwrite(&doc->dir_entries, sizeof(doc->dir_entries), 1, f);
+            fwrite(&doc->path_id, sizeof(doc->path_id), 1, f);
 
             // Count pages
             uint16_t num_pages = 0;
@@ -266,11 +536,20 @@ int cache_save(CacheHandle* cache) {
                 fwrite(&page->mtime, sizeof(page->mtime), 1, f);
                 fwrite(&page->sync_status, sizeof(page->sync_status), 1, f);
                 fwrite(&page->retry_count, sizeof(page->retry_count), 1, f);
+                fwrite(&page->content_hash, sizeof(page->content_hash), 1, f);
+                page->changed = false;
             }
         }
     }
 
-    flock(fd, LOCK_UN);  // Release lock
+    write_path_nodes(cache, f);
+
+    if (fflush(f) != 0) {
+        fclose(f);
+        unlink(temp_path);
+        return -1;
+    }
+    remember_disk_state(cache, f);
     fclose(f);
 
     // Atomic rename
@@ -283,6 +562,123 @@ int cache_save(CacheHandle* cache) {
     return 0;
 }
 
+/**
+ * find_entry - Look up a page by document and page UUID
+ */
+static PageEntry* find_entry(CacheHandle* cache, const char* doc_id, const char* page_uuid) {
+    DocumentEntry* doc = cache_find_document(cache, doc_id);
+    return doc ? cache_find_page(doc, page_uuid) : NULL;
+}
+
+/**
+ * same_content - Check that two entries describe the same version of a page
+ *
+ * Compared by content hash when both have one, so an unchanged re-save
+ * that only moved the mtime still counts; by mtime otherwise.
+ */
+static bool same_content(const PageEntry* a, const PageEntry* b) {
+    if (a->content_hash != 0 && b->content_hash != 0) {
+        return a->content_hash == b->content_hash;
+    }
+    return a->mtime == b->mtime;
+}
+
+int cache_save(CacheHandle* cache) {
+    if (!cache || !cache->dirty) return 0;
+
+    int lock = lock_cache(cache);
+    if (lock < 0) return -1;
+
+    // httpclient saved since we loaded: keep the statuses it recorded for
+    // every page we have not touched since, as long as it is still the
+    // version it uploaded
+    if (disk_changed(cache)) {
+        CacheHandle* disk = load_disk_copy(cache->path);
+        if (disk) {
+            for (size_t i = 0; i < cache->table_size; i++) {
+                for (DocumentEntry* doc = cache->table[i]; doc; doc = doc->next) {
+                    for (PageEntry* page = doc->pages; page; page = page->next) {
+                        if (page->changed) continue;
+                        PageEntry* theirs = find_entry(disk, doc->doc_id, page->uuid);
+                        if (theirs && same_content(theirs, page)) {
+                            page->sync_status = theirs->sync_status;
+                            page->retry_count = theirs->retry_count;
+                        }
+                    }
+                }
+            }
+            cache_close(disk, false);
+        }
+    }
+
+    int rc = write_cache_file(cache);
+    close(lock);
+    return rc;
+}
+
+/**
+ * swap_contents - Exchange the loaded entries of two handles for the same file
+ */
+static void swap_contents(CacheHandle* a, CacheHandle* b) {
+    CacheHandle tmp = *a;
+
+    a->table = b->table;
+    a->path_nodes = b->path_nodes;
+    a->path_cap = b->path_cap;
+    a->path_next_id = b->path_next_id;
+    a->path_table = b->path_table;
+    a->disk_ino = b->disk_ino;
+    a->disk_mtime = b->disk_mtime;
+    a->dirty = b->dirty;
+
+    b->table = tmp.table;
+    b->path_nodes = tmp.path_nodes;
+    b->path_cap = tmp.path_cap;
+    b->path_next_id = tmp.path_next_id;
+    b->path_table = tmp.path_table;
+    b->disk_ino = tmp.disk_ino;
+    b->disk_mtime = tmp.disk_mtime;
+    b->dirty = tmp.dirty;
+}
+
+int cache_save_status(CacheHandle* cache) {
+    if (!cache || !cache->dirty) return 0;
+
+    int lock = lock_cache(cache);
+    if (lock < 0) return -1;
+
+    CacheHandle* disk = disk_changed(cache) ? load_disk_copy(cache->path) : NULL;
+    if (!disk) {
+        // Nobody saved since we loaded: our copy is the file plus our changes
+        int rc = write_cache_file(cache);
+        close(lock);
+        return rc;
+    }
+
+    // Apply our status changes to the current file, skipping pages the
+    // watcher has since changed, removed or moved
+    for (size_t i = 0; i < cache->table_size; i++) {
+        for (DocumentEntry* doc = cache->table[i]; doc; doc = doc->next) {
+            for (PageEntry* page = doc->pages; page; page = page->next) {
+                if (!page->changed) continue;
+                PageEntry* theirs = find_entry(disk, doc->doc_id, page->uuid);
+                if (theirs && same_content(theirs, page)) {
+                    theirs->sync_status = page->sync_status;
+                    theirs->retry_count = page->retry_count;
+                }
+            }
+        }
+    }
+
+    int rc = write_cache_file(disk);
+    close(lock);
+
+    // Continue from the merged state
+    if (rc == 0) swap_contents(cache, disk);
+    cache_close(disk, false);
+    return rc;
+}
+
 /**
  * cache_find_document - Find a document by ID
  * 
@@ -306,6 +702,34 @@ DocumentEntry* cache_find_document(CacheHandle* cache, const char* doc_id) {
     return NULL;
 }
 
+/**
+ * cache_add_document - Find a document, creating an empty entry if needed
+ * 
+ * @param cache: Cache handle
+ * @param doc_id: Document UUID
+ * @return: Document entry or NULL on allocation failure
+ */
+DocumentEntry* cache_add_document(CacheHandle* cache, const char* doc_id) {
+    if (!cache || !doc_id) return NULL;
+    
+    DocumentEntry* doc = cache_find_document(cache, doc_id);
+    if (doc) return doc;
+    
+    doc = calloc(1, sizeof(DocumentEntry));
+    if (!doc) return NULL;
+    
+    strncpy(doc->doc_id, doc_id, UUID_LEN);
+    doc->doc_id[UUID_LEN] = '\0';
+    
+    // Add to hash table
+    unsigned int hash = hash_string(doc_id);
+    doc->next = cache->table[hash];
+    cache->table[hash] = doc;
+    
+    cache->dirty = true;
+    return doc;
+}
+
 /**
  * cache_find_page - Find a page within a document
  * 
@@ -335,6 +759,7 @@ PageEntry* cache_find_page(DocumentEntry* doc, const char* page_uuid) {
  * @param page_uuid: Page UUID
  * @param page_num: Page number (can be empty string)
  * @param mtime: Modification time
+ * @param content_hash: Digest of the page file (0 if unknown)
  * @param status: Sync status
  * @return: 0 on success, -1 on error
  */
@@ -343,23 +768,13 @@ int cache_add_or_update_page(CacheHandle* cache,
                              const char* page_uuid,
                              const char* page_num,
                              time_t mtime,
+                             uint64_t content_hash,
                              sync_status_t status) {
     if (!cache || !doc_id || !page_uuid) return -1;
     
     // Find or create document
-    DocumentEntry* doc = cache_find_document(cache, doc_id);
-    if (!doc) {
-        doc = calloc(1, sizeof(DocumentEntry));
-        if (!doc) return -1;
-        
-        strncpy(doc->doc_id, doc_id, UUID_LEN);
-        doc->doc_id[UUID_LEN] = '\0';
-        
-        // Add to hash table
-        unsigned int hash = hash_string(doc_id);
-        doc->next = cache->table[hash];
-        cache->table[hash] = doc;
-    }
+    DocumentEntry* doc = cache_add_document(cache, doc_id);
+    if (!doc) return -1;
     
     // Find or create page
     PageEntry* page = cache_find_page(doc, page_uuid);
@@ -381,7 +796,125 @@ int cache_add_or_update_page(CacheHandle* cache,
         page->page_num[MAX_PAGE_NUM_LEN - 1] = '\0';
     }
     page->mtime = mtime;
+    page->content_hash = content_hash;
     page->sync_status = status;
+    page->changed = true;
+    
+    cache->dirty = true;
+    return 0;
+}
+
+/**
+ * unlink_page - Detach a page from its document's list
+ * 
+ * @return: The detached page or NULL if not found
+ */
+static PageEntry* unlink_page(DocumentEntry* doc, const char* page_uuid) {
+    PageEntry** link = &doc->pages;
+    while (*link) {
+        PageEntry* page = *link;
+        if (strcmp(page->uuid, page_uuid) == 0) {
+            *link = page->next;
+            page->next = NULL;
+            return page;
+        }
+        link = &page->next;
+    }
+    return NULL;
+}
+
+/**
+ * unlink_document - Detach a document from the hash table
+ * 
+ * @return: The detached document or NULL if not found
+ */
+static DocumentEntry* unlink_document(CacheHandle* cache, const char* doc_id) {
+    DocumentEntry** link = &cache->table[hash_string(doc_id)];
+    while (*link) {
+        DocumentEntry* doc = *link;
+        if (strcmp(doc->doc_id, doc_id) == 0) {
+            *link = doc->next;
+            doc->next = NULL;
+            return doc;
+        }
+        link = &doc->next;
+    }
+    return NULL;
+}
+
+/**
+ * free_document - Free a detached document and its pages
+ */
+static void free_document(DocumentEntry* doc) {
+    PageEntry* page = doc->pages;
+    while (page) {
+        PageEntry* next_page = page->next;
+        free(page);
+        page = next_page;
+    }
+    free(doc);
+}
+
+/**
+ * cache_move_page - Re-key a page after its file was renamed
+ * 
+ * @param cache: Cache handle
+ * @param old_doc_id: Document the page was in
+ * @param old_uuid: Previous page UUID
+ * @param new_doc_id: Document the page is in now (may equal old_doc_id)
+ * @param new_uuid: New page UUID
+ * @return: 0 on success, -1 if the page was not cached or on error
+ */
+int cache_move_page(CacheHandle* cache,
+                    const char* old_doc_id,
+                    const char* old_uuid,
+                    const char* new_doc_id,
+                    const char* new_uuid) {
+    if (!cache || !old_doc_id || !old_uuid || !new_doc_id || !new_uuid) return -1;
+    
+    DocumentEntry* src = cache_find_document(cache, old_doc_id);
+    if (!src || !cache_find_page(src, old_uuid)) return -1;
+    
+    DocumentEntry* dst = cache_add_document(cache, new_doc_id);
+    if (!dst) return -1;
+    
+    PageEntry* page = unlink_page(src, old_uuid);
+    free(unlink_page(dst, new_uuid));
+    
+    strncpy(page->uuid, new_uuid, UUID_LEN);
+    page->uuid[UUID_LEN] = '\0';
+    page->changed = true;
+    page->next = dst->pages;
+    dst->pages = page;
+    
+    cache->dirty = true;
+    return 0;
+}
+
+/**
+ * cache_rename_document - Re-key a document after its directory was renamed
+ * 
+ * @param cache: Cache handle
+ * @param old_id: Previous document UUID
+ * @param new_id: New document UUID
+ * @return: 0 on success, -1 if the document was not cached or on error
+ */
+int cache_rename_document(CacheHandle* cache, const char* old_id, const char* new_id) {
+    if (!cache || !old_id || !new_id) return -1;
+    if (strcmp(old_id, new_id) == 0) return 0;
+    
+    DocumentEntry* doc = unlink_document(cache, old_id);
+    if (!doc) return -1;
+    
+    DocumentEntry* replaced = unlink_document(cache, new_id);
+    if (replaced) free_document(replaced);
+    
+    strncpy(doc->doc_id, new_id, UUID_LEN);
+    doc->doc_id[UUID_LEN] = '\0';
+    
+    unsigned int hash = hash_string(new_id);
+    doc->next = cache->table[hash];
+    cache->table[hash] = doc;
     
     cache->dirty = true;
     return 0;
@@ -412,39 +945,50 @@ int cache_update_page_status(CacheHandle* cache,
     
     page->sync_status = status;
     page->retry_count = retry_count;
+    page->changed = true;
     cache->dirty = true;
     
     return 0;
 }
 
 /**
- * cache_get_pending_pages - Get list of pages pending upload
+ * cache_get_pending_groups - Get pages pending upload, grouped by document
  * 
  * @param cache: Cache handle
- * @param max_pages: Maximum number of pages to return
- * @return: Array of page entries (caller must free)
+ * @param max_pages: Maximum number of pages to return in total
+ * @param num_groups: Output number of groups
+ * @return: Array of groups (caller must free)
  */
-PageEntry** cache_get_pending_pages(CacheHandle* cache, int max_pages) {
-    if (!cache || max_pages <= 0) return NULL;
+PendingGroup* cache_get_pending_groups(CacheHandle* cache, int max_pages, int* num_groups) {
+    if (!cache || max_pages <= 0 || !num_groups) return NULL;
+    *num_groups = 0;
     
-    // Allocate array for results
-    PageEntry** results = calloc(max_pages + 1, sizeof(PageEntry*));
-    if (!results) return NULL;
+    // At most one group per page; the page pointers follow the groups
+    PendingGroup* groups = calloc(1, max_pages * (sizeof(PendingGroup) + sizeof(PageEntry*)));
+    if (!groups) return NULL;
+    PageEntry** slots = (PageEntry**)(groups + max_pages);
     
     int count = 0;
+    int ngroups = 0;
     
-    // Search all documents
     for (size_t i = 0; i < cache->table_size && count < max_pages; i++) {
         for (DocumentEntry* doc = cache->table[i]; doc && count < max_pages; doc = doc->next) {
+            PendingGroup* group = NULL;
             for (PageEntry* page = doc->pages; page && count < max_pages; page = page->next) {
-                if (page->sync_status == SYNC_PENDING) {
-                    results[count++] = page;
+                if (page->sync_status != SYNC_PENDING) continue;
+                if (!group) {
+                    group = &groups[ngroups++];
+                    group->doc = doc;
+                    group->pages = &slots[count];
                 }
+                slots[count++] = page;
+                group->count++;
             }
         }
     }
     
-    return results;
+    *num_groups = ngroups;
+    return groups;
 }
 
 /**
@@ -473,28 +1017,103 @@ int cache_count_by_status(CacheHandle* cache, sync_status_t status) {
 }
 
 /**
- * cache_get_document_for_page - Find which document contains a page
+ * cache_find_path - Look up the interned node of a folder or document
  * 
  * @param cache: Cache handle
- * @param page_uuid: Page UUID to search for
- * @return: Document ID or NULL if not found
+ * @param uuid: Folder or document UUID
+ * @return: Node or NULL if not interned
  */
-const char* cache_get_document_for_page(CacheHandle* cache, const char* page_uuid) {
-    if (!cache || !page_uuid) return NULL;
+PathNode* cache_find_path(CacheHandle* cache, const char* uuid) {
+    if (!cache || !uuid) return NULL;
     
-    for (size_t i = 0; i < cache->table_size; i++) {
-        for (DocumentEntry* doc = cache->table[i]; doc; doc = doc->next) {
-            for (PageEntry* page = doc->pages; page; page = page->next) {
-                if (strcmp(page->uuid, page_uuid) == 0) {
-                    return doc->doc_id;
-                }
-            }
+    for (PathNode* node = cache->path_table[hash_string(uuid)]; node; node = node->next) {
+        if (strcmp(node->uuid, uuid) == 0) {
+            return node;
         }
     }
     
     return NULL;
 }
 
+/**
+ * cache_intern_path - Record a folder or document name in the path table
+ * 
+ * @param cache: Cache handle
+ * @param uuid: Folder or document UUID
+ * @param parent: Node ID of the enclosing folder (0 = library root)
+ * @param name: Visible name
+ * @return: Node ID, or 0 on allocation failure
+ */
+uint32_t cache_intern_path(CacheHandle* cache, const char* uuid,
+                           uint32_t parent, const char* name) {
+    if (!cache || !uuid || !name) return 0;
+    
+    PathNode* node = cache_find_path(cache, uuid);
+    if (node) {
+        if (node->parent != parent || strcmp(node->name, name) != 0) {
+            char* copy = strdup(name);
+            if (!copy) return 0;
+            free(node->name);
+            node->name = copy;
+            node->parent = parent;
+            cache->dirty = true;
+        }
+        return node->id;
+    }
+    
+    node = calloc(1, sizeof(PathNode));
+    if (!node) return 0;
+    
+    strncpy(node->uuid, uuid, UUID_LEN);
+    node->uuid[UUID_LEN] = '\0';
+    node->name = strdup(name);
+    node->id = cache->path_next_id;
+    node->parent = parent;
+    
+    if (!node->name || insert_path_node(cache, node) != 0) {
+        free(node->name);
+        free(node);
+        return 0;
+    }
+    
+    cache->dirty = true;
+    return node->id;
+}
+
+/**
+ * cache_build_path - Assemble the virtual path of an interned node
+ * 
+ * @param cache: Cache handle
+ * @param id: Node ID
+ * @param out: Output buffer
+ * @param size: Size of out
+ * @return: Length of the path, or -1 if the chain is broken, too deep or too long
+ */
+int cache_build_path(CacheHandle* cache, uint32_t id, char* out, size_t size) {
+    if (!cache || !out || size == 0 || id == 0) return -1;
+    
+    const PathNode* chain[CACHE_PATH_MAX_DEPTH];
+    int depth = 0;
+    while (id != 0) {
+        if (id >= cache->path_cap || !cache->path_nodes[id] ||
+            depth == CACHE_PATH_MAX_DEPTH) {
+            return -1;
+        }
+        chain[depth++] = cache->path_nodes[id];
+        id = cache->path_nodes[id]->parent;
+    }
+    
+    size_t len = 0;
+    for (int i = depth - 1; i >= 0; i--) {
+        int n = snprintf(out + len, size - len, "%s%s",
+                         i == depth - 1 ? "" : "/", chain[i]->name);
+        if (n < 0 || (size_t)n >= size - len) return -1;
+        len += n;
+    }
+    
+    return (int)len;
+}
+
 /**
  * cache_reload - Reload cache from disk to get latest changes
  *
@@ -526,6 +1145,7 @@ int cache_reload(CacheHandle* cache) {
         }
         cache->table[i] = NULL;
     }
+    free_path_nodes(cache);
 
     // Reload from file
     FILE* f = fopen(cache->path, "rb");
@@ -535,128 +1155,28 @@ int cache_reload(CacheHandle* cache) {
         return 0;
     }
 
-    // Use file locking to ensure we don't read while another process is writing
-    int fd = fileno(f);
-    flock(fd, LOCK_SH);  // Shared lock for reading
-
-    // Read and verify header
-    uint32_t magic, num_docs;
-    uint8_t version;
-
-    if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != CACHE_MAGIC) {
-        flock(fd, LOCK_UN);
-        fclose(f);
-        return -1;
-    }
-
-    if (fread(&version, sizeof(version), 1, f) != 1) {
-        flock(fd, LOCK_UN);
-        fclose(f);
-        return -1;
-    }
-
-    if (version != CACHE_VERSION && version != 1) {
-        flock(fd, LOCK_UN);
-        fclose(f);
-        return -1;
-    }
-
-    if (fread(&num_docs, sizeof(num_docs), 1, f) != 1) {
-        flock(fd, LOCK_UN);
+    // Writers replace the file by rename, so no lock is needed to read it whole
+    if (read_cache_file(cache, f) != 0) {
         fclose(f);
         return -1;
     }
 
-    // Read documents
-    for (uint32_t i = 0; i < num_docs; i++) {
-        uint8_t doc_id_len;
-        if (fread(&doc_id_len, sizeof(doc_id_len), 1, f) != 1) break;
-
-        if (doc_id_len != UUID_LEN) break;
-
-        DocumentEntry* doc = calloc(1, sizeof(DocumentEntry));
-        if (!doc) break;
-
-        if (fread(doc->doc_id, doc_id_len, 1, f) != 1) {
-            free(doc);
-            break;
-        }
-        doc->doc_id[doc_id_len] = '\0';
-
-        uint16_t num_pages;
-        if (fread(&num_pages, sizeof(num_pages), 1, f) != 1) {
-            free(doc);
-            break;
-        }
-
-        // Read pages
-        PageEntry* last_page = NULL;
-        for (uint16_t j = 0; j < num_pages; j++) {
-            PageEntry* page = calloc(1, sizeof(PageEntry));
-            if (!page) break;
-
-            if (fread(page->uuid, UUID_LEN, 1, f) != 1) {
-                free(page);
-                break;
-            }
-            page->uuid[UUID_LEN] = '\0';
-
-            uint8_t page_num_len;
-            if (fread(&page_num_len, sizeof(page_num_len), 1, f) != 1) {
-                free(page);
-                break;
-            }
-
-            if (page_num_len >= MAX_PAGE_NUM_LEN) {
-                free(page);
-                break;
-            }
-
-            if (page_num_len > 0) {
-                if (fread(page->page_num, page_num_len, 1, f) != 1) {
-                    free(page);
-                    break;
-                }
-                page->page_num[page_num_len] = '\0';
-            }
-
-            if (fread(&page->mtime, sizeof(page->mtime), 1, f) != 1) {
-                free(page);
-                break;
-            }
-
-            // Read sync status fields if version 2
-            if (version == CACHE_VERSION) {
-                if (fread(&page->sync_status, sizeof(page->sync_status), 1, f) != 1 ||
-                    fread(&page->retry_count, sizeof(page->retry_count), 1, f) != 1) {
-                    free(page);
-                    break;
-                }
-            }
-            else {
-                page->sync_status = SYNC_PENDING;
-                page->retry_count = 0;
-            }
-
-            // Add to linked list
-            if (last_page) {
-                last_page->next = page;
-            }
-            else {
-                doc->pages = page;
-            }
-            last_page = page;
-        }
-
-        // Add document to hash table
-        unsigned int hash = hash_string(doc->doc_id);
-        doc->next = cache->table[hash];
-        cache->table[hash] = doc;
-    }
-
-    flock(fd, LOCK_UN);  // Release lock
+    remember_disk_state(cache, f);
     fclose(f);
-
     cache->dirty = false;
     return 0;
+}
+
+/**
+ * cache_refresh - Reload the cache if another process saved it
+ *
+ * @param cache: Cache handle
+ * @return: 1 if reloaded, 0 if unchanged or there are unsaved changes, -1 on error
+ */
+int cache_refresh(CacheHandle* cache) {
+    if (!cache) return -1;
+    if (cache->dirty) return 0;  // Never discard our own unsaved changes
+    if (!disk_changed(cache)) return 0;
+
+    return cache_reload(cache) == 0 ? 1 : -1;
 }
\ No newline at end of file
@@ -5,12 +5,14 @@
 #include <stdint.h>
 #include <time.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #define CACHE_MAGIC 0x524D4348  // "RMCH" in hex
-#define CACHE_VERSION 2         // Version 2 adds sync status fields
+#define CACHE_VERSION 3         // 2 sync status, 3 content hash, directory index and paths
 #define UUID_LEN 36
 #define MAX_PAGE_NUM_LEN 8
 #define PATH_MAX 4096
+#define CACHE_PATH_MAX_DEPTH 32 // Deepest folder chain cache_build_path follows
 
 // Sync status values
 typedef enum {
@@ -29,6 +31,8 @@ typedef struct PageEntry {
     time_t mtime;                      // Last modification time
     uint8_t sync_status;               // Upload status
     uint8_t retry_count;               // Number of retry attempts
+    uint64_t content_hash;             // XXH64 of the .rm file (0 = unknown)
+    bool changed;                      // Modified since last load or save (not stored)
     struct PageEntry* next;            // Next page in linked list
 } PageEntry;
 
@@ -37,10 +41,37 @@ typedef struct PageEntry {
  */
 typedef struct DocumentEntry {
     char doc_id[UUID_LEN + 1];        // Document UUID
+    int64_t dir_mtime_ns;              // Directory fingerprint at last scan:
+    uint64_t dir_ino;                  //   mtime (ns), inode (0 = not scanned)
+    uint32_t dir_entries;              //   and entry count
+    uint32_t path_id;                  // Interned path node of the document (0 = none)
     PageEntry* pages;                  // Linked list of pages
     struct DocumentEntry* next;        // Next document in hash table bucket
 } DocumentEntry;
 
+/**
+ * PathNode - One interned folder or document name of the virtual path tree
+ *
+ * Nodes refer to their parent by ID, so renaming or moving a folder
+ * updates a single node and every path below it follows.
+ */
+typedef struct PathNode {
+    uint32_t id;                       // Node ID (1-based, 0 = library root)
+    uint32_t parent;                   // Parent node ID (0 = library root)
+    char uuid[UUID_LEN + 1];           // Folder or document UUID
+    char* name;                        // Visible name
+    struct PathNode* next;             // Next node in UUID hash bucket
+} PathNode;
+
+/**
+ * PendingGroup - Pending pages of one document
+ */
+typedef struct {
+    DocumentEntry* doc;                // Document the pages belong to
+    PageEntry** pages;                 // Pending pages, in document order
+    int count;                         // Number of pages
+} PendingGroup;
+
 /**
  * CacheHandle - Opaque handle for cache operations
  */
@@ -49,6 +80,12 @@ typedef struct CacheHandle {
     size_t table_size;                // Size of hash table
     bool dirty;                        // Whether cache needs saving
     char path[PATH_MAX];              // Path to cache file
+    ino_t disk_ino;                    // Identity of the file last loaded/saved
+    struct timespec disk_mtime;        // ... and its modification time
+    PathNode** path_nodes;             // Interned path nodes indexed by ID
+    uint32_t path_cap;                 // Size of path_nodes
+    uint32_t path_next_id;             // Next unused node ID
+    PathNode** path_table;             // Path nodes hashed by UUID
 } CacheHandle;
 
 /**
@@ -72,9 +109,29 @@ void cache_close(CacheHandle* cache, bool save);
  * 
  * @param cache: Cache handle
  * @return: 0 on success, -1 on error
+ * 
+ * For the process that owns the cache layout (the watcher): documents,
+ * pages and paths are written from memory. If the file was saved by
+ * another process since it was loaded, the status and retry count stored
+ * there win for every page not changed here that still has the same
+ * content (same hash, or same mtime where a hash is missing). Writers are serialised by a lock on "<path>.lock".
  */
 int cache_save(CacheHandle* cache);
 
+/**
+ * cache_save_status - Save only the page status changes made through this handle
+ * 
+ * @param cache: Cache handle
+ * @return: 0 on success, -1 on error
+ * 
+ * For httpclient: under the writer lock the current file is read again and
+ * each page changed here gets its new status and retry count, but only if
+ * the file still has the version that was uploaded: the same content hash,
+ * or the same mtime where a hash is missing. Everything else in the file is kept, and the handle
+ * continues from the merged result.
+ */
+int cache_save_status(CacheHandle* cache);
+
 /**
  * cache_find_document - Find a document by ID
  * 
@@ -84,6 +141,15 @@ int cache_save(CacheHandle* cache);
  */
 DocumentEntry* cache_find_document(CacheHandle* cache, const char* doc_id);
 
+/**
+ * cache_add_document - Find a document, creating an empty entry if needed
+ * 
+ * @param cache: Cache handle
+ * @param doc_id: Document UUID
+ * @return: Document entry or NULL on allocation failure
+ */
+DocumentEntry* cache_add_document(CacheHandle* cache, const char* doc_id);
+
 /**
  * cache_find_page - Find a page within a document
  * 
@@ -101,6 +167,7 @@ PageEntry* cache_find_page(DocumentEntry* doc, const char* page_uuid);
  * @param page_uuid: Page UUID
  * @param page_num: Page number (can be empty string)
  * @param mtime: Modification time
+ * @param content_hash: Digest of the page file (0 if unknown)
  * @param status: Sync status
  * @return: 0 on success, -1 on error
  */
@@ -109,8 +176,41 @@ int cache_add_or_update_page(CacheHandle* cache,
                              const char* page_uuid,
                              const char* page_num,
                              time_t mtime,
+                             uint64_t content_hash,
                              sync_status_t status);
 
+/**
+ * cache_move_page - Re-key a page after its file was renamed
+ * 
+ * @param cache: Cache handle
+ * @param old_doc_id: Document the page was in
+ * @param old_uuid: Previous page UUID
+ * @param new_doc_id: Document the page is in now (may equal old_doc_id)
+ * @param new_uuid: New page UUID
+ * @return: 0 on success, -1 if the page was not cached or on error
+ * 
+ * Sync status, content hash and mtime move with the entry, so a rename
+ * does not cause a re-upload. An entry already cached under the new key
+ * was overwritten by the rename and is dropped.
+ */
+int cache_move_page(CacheHandle* cache,
+                    const char* old_doc_id,
+                    const char* old_uuid,
+                    const char* new_doc_id,
+                    const char* new_uuid);
+
+/**
+ * cache_rename_document - Re-key a document after its directory was renamed
+ * 
+ * @param cache: Cache handle
+ * @param old_id: Previous document UUID
+ * @param new_id: New document UUID
+ * @return: 0 on success, -1 if the document was not cached or on error
+ * 
+ * An entry already cached under new_id is replaced.
+ */
+int cache_rename_document(CacheHandle* cache, const char* old_id, const char* new_id);
+
 /**
  * cache_update_page_status - Update sync status of a page
  * 
@@ -128,17 +228,19 @@ int cache_update_page_status(CacheHandle* cache,
                              uint8_t retry_count);
 
 /**
- * cache_get_pending_pages - Get list of pages pending upload
+ * cache_get_pending_groups - Get pages pending upload, grouped by document
  * 
  * @param cache: Cache handle
- * @param max_pages: Maximum number of pages to return
- * @return: Array of page entries (caller must free)
+ * @param max_pages: Maximum number of pages to return in total
+ * @param num_groups: Output number of groups
+ * @return: Array of groups (caller must free), or NULL on error
  * 
- * Returns a newly allocated array of PageEntry pointers.
- * The array is terminated by a NULL pointer.
- * Caller must free the array but not the PageEntry structures.
+ * Each document with pending pages appears once, so per-document work
+ * (metadata, virtual path, SHARED_PATH filter) is done once per group.
+ * The groups and their page arrays share one allocation; a single free()
+ * of the returned pointer releases both.
  */
-PageEntry** cache_get_pending_pages(CacheHandle* cache, int max_pages);
+PendingGroup* cache_get_pending_groups(CacheHandle* cache, int max_pages, int* num_groups);
 
 /**
  * cache_count_by_status - Count pages by sync status
@@ -150,14 +252,51 @@ PageEntry** cache_get_pending_pages(CacheHandle* cache, int max_pages);
 int cache_count_by_status(CacheHandle* cache, sync_status_t status);
 
 /**
- * cache_get_document_for_page - Find which document contains a page
+ * cache_intern_path - Record a folder or document name in the path table
  * 
  * @param cache: Cache handle
- * @param page_uuid: Page UUID to search for
- * @return: Document ID or NULL if not found
+ * @param uuid: Folder or document UUID
+ * @param parent: Node ID of the enclosing folder (0 = library root)
+ * @param name: Visible name
+ * @return: Node ID, or 0 on allocation failure
+ * 
+ * A UUID always keeps its node ID; a changed name or parent is updated in
+ * place. Intern parents before children.
  */
-const char* cache_get_document_for_page(CacheHandle* cache, const char* page_uuid);
+uint32_t cache_intern_path(CacheHandle* cache, const char* uuid,
+                           uint32_t parent, const char* name);
+
+/**
+ * cache_find_path - Look up the interned node of a folder or document
+ * 
+ * @param cache: Cache handle
+ * @param uuid: Folder or document UUID
+ * @return: Node or NULL if not interned
+ */
+PathNode* cache_find_path(CacheHandle* cache, const char* uuid);
+
+/**
+ * cache_build_path - Assemble the virtual path of an interned node
+ * 
+ * @param cache: Cache handle
+ * @param id: Node ID
+ * @param out: Output buffer ("Folder/Sub/Document")
+ * @param size: Size of out
+ * @return: Length of the path, or -1 if the chain is broken, too deep or too long
+ */
+int cache_build_path(CacheHandle* cache, uint32_t id, char* out, size_t size);
 
 int cache_reload(CacheHandle* cache);
 
+/**
+ * cache_refresh - Reload the cache if another process saved it
+ *
+ * @param cache: Cache handle
+ * @return: 1 if reloaded, 0 if unchanged or there are unsaved changes, -1 on error
+ *
+ * Cheap enough to call before every batch of work: only a stat() unless
+ * the file on disk differs from the one last loaded or saved.
+ */
+int cache_refresh(CacheHandle* cache);
+
 #endif // CACHE_IO_H
\ No newline at end of file
@@ -0,0 +1,199 @@
+// content_hash.c - XXH64 implementation used to detect no-op page rewrites
+//
+// XXH64 keeps four independent accumulator lanes, which the Cortex-A53
+// pipelines well in plain scalar code. NEON has no 64x64-bit multiply, so
+// a vectorised XXH64 would not be faster; page files are small enough that
+// reading them dominates anyway.
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "content_hash.h"
+
+#define HASH_READ_LEN (16 * 1024)   // File bytes hashed per read()
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));   // Unaligned-safe, little-endian target
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * xxh64_state_t - Digest in progress, fed in pieces of any size
+ */
+typedef struct {
+    uint64_t v1, v2, v3, v4;        // Accumulator lanes
+    uint64_t total;                 // Bytes fed so far
+    uint8_t mem[32];                // Input not yet making up a whole stripe
+    size_t mem_len;
+    uint64_t seed;
+} xxh64_state_t;
+
+static void xxh64_init(xxh64_state_t* st, uint64_t seed) {
+    memset(st, 0, sizeof(*st));
+    st->seed = seed;
+    st->v1 = seed + PRIME64_1 + PRIME64_2;
+    st->v2 = seed + PRIME64_2;
+    st->v3 = seed;
+    st->v4 = seed - PRIME64_1;
+}
+
+/**
+ * xxh64_stripes - Run the lanes over whole 32-byte stripes
+ *
+ * @return: Pointer past the last stripe consumed
+ */
+static const uint8_t* xxh64_stripes(xxh64_state_t* st, const uint8_t* p, const uint8_t* end) {
+    uint64_t v1 = st->v1, v2 = st->v2, v3 = st->v3, v4 = st->v4;
+
+    while (end - p >= 32) {
+        v1 = xxh64_round(v1, read64(p));
+        v2 = xxh64_round(v2, read64(p + 8));
+        v3 = xxh64_round(v3, read64(p + 16));
+        v4 = xxh64_round(v4, read64(p + 24));
+        p += 32;
+    }
+
+    st->v1 = v1;
+    st->v2 = v2;
+    st->v3 = v3;
+    st->v4 = v4;
+    return p;
+}
+
+static void xxh64_update(xxh64_state_t* st, const void* data, size_t len) {
+    const uint8_t* p = data;
+    const uint8_t* end = p + len;
+    st->total += len;
+
+    // Complete a stripe left over from the previous piece
+    if (st->mem_len > 0) {
+        size_t fill = sizeof(st->mem) - st->mem_len;
+        if (len < fill) {
+            memcpy(st->mem + st->mem_len, p, len);
+            st->mem_len += len;
+            return;
+        }
+        memcpy(st->mem + st->mem_len, p, fill);
+        xxh64_stripes(st, st->mem, st->mem + sizeof(st->mem));
+        p += fill;
+        st->mem_len = 0;
+    }
+
+    p = xxh64_stripes(st, p, end);
+
+    st->mem_len = end - p;
+    memcpy(st->mem, p, st->mem_len);
+}
+
+static uint64_t xxh64_digest(const xxh64_state_t* st) {
+    uint64_t h64;
+
+    if (st->total >= 32) {
+        h64 = rotl64(st->v1, 1) + rotl64(st->v2, 7) + rotl64(st->v3, 12) + rotl64(st->v4, 18);
+        h64 = xxh64_merge_round(h64, st->v1);
+        h64 = xxh64_merge_round(h64, st->v2);
+        h64 = xxh64_merge_round(h64, st->v3);
+        h64 = xxh64_merge_round(h64, st->v4);
+    } else {
+        h64 = st->seed + PRIME64_5;
+    }
+
+    h64 += st->total;
+
+    const uint8_t* p = st->mem;
+    const uint8_t* end = p + st->mem_len;
+
+    while (p + 8 <= end) {
+        h64 ^= xxh64_round(0, read64(p));
+        h64 = rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h64 ^= (uint64_t)read32(p) * PRIME64_1;
+        h64 = rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h64 ^= (*p) * PRIME64_5;
+        h64 = rotl64(h64, 11) * PRIME64_1;
+        p++;
+    }
+
+    // Final avalanche
+    h64 ^= h64 >> 33;
+    h64 *= PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= PRIME64_3;
+    h64 ^= h64 >> 32;
+
+    return h64;
+}
+
+uint64_t content_hash(const void* data, size_t len, uint64_t seed) {
+    xxh64_state_t st;
+    xxh64_init(&st, seed);
+    xxh64_update(&st, data, len);
+    return xxh64_digest(&st);
+}
+
+int content_hash_file(const char* path, uint64_t* out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    // read() rather than mmap: xochitl may truncate the file under us,
+    // which a mapping turns into SIGBUS and read() into a short count
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    xxh64_state_t st;
+    xxh64_init(&st, 0);
+
+    char buf[HASH_READ_LEN];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        if (n == 0) break;
+        xxh64_update(&st, buf, n);
+    }
+    close(fd);
+
+    uint64_t digest = xxh64_digest(&st);
+    *out = digest ? digest : 1;
+    return 0;
+}
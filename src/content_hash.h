@@ -0,0 +1,32 @@
+// content_hash.h - Fast content digests for change detection
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * content_hash - XXH64 digest of a memory buffer
+ *
+ * @param data: Bytes to hash
+ * @param len: Number of bytes
+ * @param seed: Hash seed (0 for cache digests)
+ * @return: 64-bit digest
+ */
+uint64_t content_hash(const void* data, size_t len, uint64_t seed);
+
+/**
+ * content_hash_file - XXH64 digest of a whole file
+ *
+ * @param path: File to hash
+ * @param out: Output digest
+ * @return: 0 on success, -1 on error
+ *
+ * The file is read and hashed in fixed-size pieces, so memory use does not
+ * grow with the file size, and a file truncated meanwhile just ends early
+ * (a later event rehashes it). A digest of 0 is remapped to 1 so that 0 can
+ * mean "unknown" in the cache.
+ */
+int content_hash_file(const char* path, uint64_t* out);
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,277 @@
+// event_queue.c - inotify ingestion thread and single-producer/single-consumer ring
+//
+// The ingestion thread sleeps in poll() on the inotify descriptor, drains
+// it on every wakeup and copies each event into a fixed-size ring slot.
+// The consumer (the watcher's event loop) is woken through an eventfd.
+// Head and tail are each written by exactly one thread, so plain
+// acquire/release ordering is enough.
+//
+// The ring never drops events. When it is full the ingestion thread keeps
+// what it has already read, stops reading the inotify descriptor and waits
+// for the consumer to free a slot, so further events wait in the kernel
+// queue (fs.inotify.max_queued_events, 16384 by default) and only its
+// overflow, reported as IN_Q_OVERFLOW, loses events.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "event_queue.h"
+
+#define INGEST_BUF_LEN (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+static watch_event_t ring[EVENT_QUEUE_SLOTS];
+static atomic_size_t head;          // Next slot to fill (producer)
+static atomic_size_t tail;          // Next slot to consume (consumer)
+
+static atomic_bool running;
+static atomic_bool producer_waiting; // Ingestion thread is waiting for a free slot
+static atomic_uint high_water;
+static atomic_ullong total_events;
+static atomic_ullong stalls;        // Times the ingestion thread waited for space
+static uint64_t max_latency_ms;     // Consumer only
+
+static int source_fd = -1;
+static int wake_fd = -1;            // Producer -> consumer
+static int stop_fd = -1;            // Consumer -> producer
+static int space_fd = -1;           // Consumer -> producer: slots were freed
+static pthread_t ingest_thread;
+
+/**
+ * elapsed_ms - Milliseconds from a CLOCK_MONOTONIC stamp until now
+ */
+static uint64_t elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (int64_t)(now.tv_sec - since->tv_sec) * 1000 +
+                 (now.tv_nsec - since->tv_nsec) / 1000000;
+    return ms > 0 ? (uint64_t)ms : 0;
+}
+
+/**
+ * push_event - Copy one kernel event into the ring
+ *
+ * @return: true if queued, false if the ring is full (nothing was copied)
+ */
+static bool push_event(const struct inotify_event* ev, const struct timespec* now) {
+    size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&tail, memory_order_acquire);
+
+    if (h - t >= EVENT_QUEUE_SLOTS) return false;
+
+    watch_event_t* slot = &ring[h & (EVENT_QUEUE_SLOTS - 1)];
+    slot->mask = ev->mask;
+    slot->cookie = ev->cookie;
+    slot->wd = ev->wd;
+    slot->name_len = ev->len ? strnlen(ev->name, ev->len) : 0;
+    memcpy(slot->name, ev->name, slot->name_len);
+    slot->name[slot->name_len] = '\0';
+    slot->queued = *now;
+
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+    atomic_fetch_add_explicit(&total_events, 1, memory_order_relaxed);
+
+    unsigned int used = (unsigned int)(h + 1 - t);
+    unsigned int peak = atomic_load_explicit(&high_water, memory_order_relaxed);
+    while (used > peak &&
+           !atomic_compare_exchange_weak(&high_water, &peak, used)) {
+    }
+    return true;
+}
+
+/**
+ * ring_full - Check for a free slot (producer side)
+ */
+static bool ring_full(void) {
+    size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&tail, memory_order_acquire);
+    return h - t >= EVENT_QUEUE_SLOTS;
+}
+
+/**
+ * ingest_main - Ingestion thread: read, decode, enqueue, wake
+ */
+static void* ingest_main(void* arg) {
+    (void)arg;
+    static char buf[INGEST_BUF_LEN]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t pos = 0, len = 0;       // Events read but not queued yet: buf[pos, len)
+
+    struct pollfd fds[3] = {
+        { .fd = source_fd, .events = POLLIN },
+        { .fd = stop_fd, .events = POLLIN },
+        { .fd = space_fd, .events = POLLIN },
+    };
+
+    while (atomic_load(&running)) {
+        // Leftover events mean the ring is full: leave the inotify fd
+        // alone (a negative fd is ignored by poll) and wait for space
+        bool wait = true;
+        fds[0].fd = source_fd;
+        if (pos < len) {
+            atomic_store(&producer_waiting, true);
+            atomic_thread_fence(memory_order_seq_cst);
+            // The consumer may have freed slots before it saw the flag
+            if (!ring_full()) {
+                atomic_store(&producer_waiting, false);
+                wait = false;
+            } else {
+                fds[0].fd = -1;
+                atomic_fetch_add_explicit(&stalls, 1, memory_order_relaxed);
+            }
+        }
+
+        if (wait) {
+            if (poll(fds, 3, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents) break;
+            if (fds[2].revents) {
+                uint64_t v;
+                ssize_t n = read(space_fd, &v, sizeof(v));
+                (void)n;
+            }
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        bool queued = false;
+        for (;;) {
+            // Queue what was read, stopping at the first event that does not fit
+            while (pos < len) {
+                const struct inotify_event* ev = (const struct inotify_event*)&buf[pos];
+                if (!push_event(ev, &now)) break;
+                queued = true;
+                pos += sizeof(struct inotify_event) + ev->len;
+            }
+            if (pos < len) break;   // Ring full: the rest waits in the kernel
+
+            len = read(source_fd, buf, sizeof(buf));
+            pos = 0;
+            if (len <= 0) {         // EAGAIN: kernel queue is empty
+                len = 0;
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+
+        if (queued) {
+            uint64_t one = 1;
+            ssize_t n = write(wake_fd, &one, sizeof(one));
+            (void)n;
+        }
+    }
+
+    return NULL;
+}
+
+int event_queue_start(int inotify_fd) {
+    if (atomic_load(&running)) return -1;
+
+    source_fd = inotify_fd;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0 || stop_fd < 0 || space_fd < 0) {
+        if (wake_fd >= 0) close(wake_fd);
+        if (stop_fd >= 0) close(stop_fd);
+        if (space_fd >= 0) close(space_fd);
+        wake_fd = stop_fd = space_fd = -1;
+        return -1;
+    }
+
+    atomic_init(&head, 0);
+    atomic_init(&tail, 0);
+    atomic_init(&producer_waiting, false);
+    atomic_init(&high_water, 0);
+    atomic_init(&total_events, 0);
+    atomic_init(&stalls, 0);
+    max_latency_ms = 0;
+
+    // Signals are handled by the main thread's signalfd only
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+    atomic_store(&running, true);
+    int rc = pthread_create(&ingest_thread, NULL, ingest_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (rc != 0) {
+        atomic_store(&running, false);
+        close(wake_fd);
+        close(stop_fd);
+        close(space_fd);
+        wake_fd = stop_fd = space_fd = -1;
+        return -1;
+    }
+
+    return wake_fd;
+}
+
+void event_queue_stop(void) {
+    if (!atomic_load(&running)) return;
+
+    atomic_store(&running, false);
+    uint64_t one = 1;
+    ssize_t n = write(stop_fd, &one, sizeof(one));
+    (void)n;
+    pthread_join(ingest_thread, NULL);
+
+    close(wake_fd);
+    close(stop_fd);
+    close(space_fd);
+    wake_fd = stop_fd = space_fd = -1;
+}
+
+void event_queue_ack(void) {
+    uint64_t v;
+    ssize_t n = read(wake_fd, &v, sizeof(v));
+    (void)n;
+}
+
+const watch_event_t* event_queue_peek(void) {
+    size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&head, memory_order_acquire);
+    if (t == h) return NULL;
+    return &ring[t & (EVENT_QUEUE_SLOTS - 1)];
+}
+
+void event_queue_release(void) {
+    size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+
+    uint64_t latency = elapsed_ms(&ring[t & (EVENT_QUEUE_SLOTS - 1)].queued);
+    if (latency > max_latency_ms) max_latency_ms = latency;
+
+    atomic_store_explicit(&tail, t + 1, memory_order_release);
+
+    // Resume a blocked ingestion thread (pairs with the fence in ingest_main)
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&producer_waiting, memory_order_relaxed) &&
+        atomic_exchange(&producer_waiting, false)) {
+        uint64_t one = 1;
+        ssize_t n = write(space_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void event_queue_stats(event_queue_stats_t* out) {
+    size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&head, memory_order_acquire);
+
+    out->occupancy = (uint32_t)(h - t);
+    out->high_water = atomic_exchange(&high_water, out->occupancy);
+    out->oldest_age_ms = (h != t) ? elapsed_ms(&ring[t & (EVENT_QUEUE_SLOTS - 1)].queued) : 0;
+    out->max_latency_ms = max_latency_ms;
+    out->total = atomic_load(&total_events);
+    out->stalls = atomic_load(&stalls);
+    max_latency_ms = 0;
+}
@@ -0,0 +1,80 @@
+// event_queue.h - inotify ingestion thread feeding a bounded event ring
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+
+#define EVENT_QUEUE_SLOTS 1024      // Ring capacity, must be a power of two
+
+// One decoded inotify event
+typedef struct {
+    uint32_t mask;                  // inotify event mask
+    uint32_t cookie;                // Rename pairing cookie
+    int32_t wd;                     // Watch descriptor
+    uint16_t name_len;              // Bytes used in name
+    struct timespec queued;         // CLOCK_MONOTONIC time the event was read
+    char name[NAME_MAX + 1];        // Entry name (NUL-terminated, may be empty)
+} watch_event_t;
+
+// Ring metrics reported by event_queue_stats
+typedef struct {
+    uint32_t occupancy;             // Events currently queued
+    uint32_t high_water;            // Peak occupancy since the last call
+    uint64_t oldest_age_ms;         // Age of the oldest queued event (0 if empty)
+    uint64_t max_latency_ms;        // Longest read-to-consume delay since the last call
+    uint64_t total;                 // Events ingested since start
+    uint64_t stalls;                // Times ingestion waited for the consumer to free slots
+} event_queue_stats_t;
+
+/**
+ * event_queue_start - Start the ingestion thread
+ *
+ * @param inotify_fd: Non-blocking inotify descriptor to drain
+ * @return: Descriptor that becomes readable when events are queued, or -1 on error
+ *
+ * The ingestion thread does nothing but read and decode events. If the
+ * ring fills up it stops reading until the consumer frees a slot, so
+ * events are never dropped here: they wait in the kernel queue, whose own
+ * overflow arrives as an IN_Q_OVERFLOW event.
+ */
+int event_queue_start(int inotify_fd);
+
+/**
+ * event_queue_stop - Stop and join the ingestion thread
+ */
+void event_queue_stop(void);
+
+/**
+ * event_queue_ack - Clear the wakeup descriptor before draining the ring
+ */
+void event_queue_ack(void);
+
+/**
+ * event_queue_peek - Get the oldest queued event without removing it
+ *
+ * @return: Pointer into the ring, or NULL if empty
+ *
+ * Single consumer only. The pointer stays valid until event_queue_release().
+ */
+const watch_event_t* event_queue_peek(void);
+
+/**
+ * event_queue_release - Remove the event returned by event_queue_peek
+ *
+ * Resumes the ingestion thread if it was waiting for a free slot.
+ */
+void event_queue_release(void);
+
+/**
+ * event_queue_stats - Snapshot ring metrics and reset the peak counters
+ *
+ * @param out: Output metrics
+ *
+ * Must be called from the consumer thread.
+ */
+void event_queue_stats(event_queue_stats_t* out);
+
+#endif // EVENT_QUEUE_H
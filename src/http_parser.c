@@ -0,0 +1,259 @@
+// http_parser.c - Incremental HTTP/1.x response parser
+//
+// A state machine over received bytes: the status line and headers are
+// handled one line at a time as soon as each line is complete, and the
+// body is framed by Content-Length, by chunked transfer coding, or by the
+// connection closing. Only the headers that decide framing and connection
+// reuse are interpreted; the rest are skipped.
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "http_parser.h"
+
+void http_parser_init(http_parser_t* parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_PARSE_STATUS;
+    parser->content_length = -1;
+}
+
+/**
+ * trim - Strip spaces and tabs from both ends of [*start, *end)
+ */
+static void trim(const char** start, const char** end) {
+    while (*start < *end && (**start == ' ' || **start == '\t')) (*start)++;
+    while (*end > *start && ((*end)[-1] == ' ' || (*end)[-1] == '\t')) (*end)--;
+}
+
+/**
+ * token_is - Case-insensitive comparison of [start, end) with a token
+ */
+static bool token_is(const char* start, const char* end, const char* token) {
+    size_t len = strlen(token);
+    return (size_t)(end - start) == len && strncasecmp(start, token, len) == 0;
+}
+
+/**
+ * parse_status_line - Read "HTTP/1.x code reason"
+ *
+ * @return: 0 on success, -1 if the line is not an HTTP/1 status line
+ */
+static int parse_status_line(http_parser_t* p, const char* line, size_t len) {
+    if (len < 12 || memcmp(line, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)line[7]) ||
+        line[8] != ' ') {
+        return -1;
+    }
+    p->minor_version = line[7] - '0';
+
+    int code = 0;
+    for (int i = 9; i < 12; i++) {
+        if (!isdigit((unsigned char)line[i])) return -1;
+        code = code * 10 + (line[i] - '0');
+    }
+    if (len > 12 && line[12] != ' ') return -1;
+    p->status_code = code;
+    return 0;
+}
+
+/**
+ * parse_header_line - Record the framing and connection headers
+ *
+ * @return: 0 on success, -1 on a malformed or conflicting header
+ */
+static int parse_header_line(http_parser_t* p, const char* line, size_t len) {
+    // Obsolete line folding continues the previous header, never one we use
+    if (line[0] == ' ' || line[0] == '\t') return 0;
+
+    const char* colon = memchr(line, ':', len);
+    if (!colon || colon == line) return -1;
+
+    const char* name_end = colon;
+    const char* value = colon + 1;
+    const char* value_end = line + len;
+    trim(&value, &value_end);
+
+    if (token_is(line, name_end, "Content-Length")) {
+        if (value == value_end) return -1;
+        long long length = 0;
+        for (const char* c = value; c < value_end; c++) {
+            if (!isdigit((unsigned char)*c)) return -1;
+            if (length > (0x7fffffffffffffffLL - 9) / 10) return -1;
+            length = length * 10 + (*c - '0');
+        }
+        // Repeated Content-Length headers must agree
+        if (p->content_length >= 0 && p->content_length != length) return -1;
+        p->content_length = length;
+    } else if (token_is(line, name_end, "Transfer-Encoding")) {
+        // The body is chunked only if chunked is the last coding applied
+        const char* last = value_end;
+        while (last > value && last[-1] != ',') last--;
+        const char* last_end = value_end;
+        trim(&last, &last_end);
+        p->transfer_encoded = true;
+        p->chunked = token_is(last, last_end, "chunked");
+    } else if (token_is(line, name_end, "Connection")) {
+        // Comma-separated options
+        const char* opt = value;
+        while (opt < value_end) {
+            const char* opt_end = memchr(opt, ',', value_end - opt);
+            if (!opt_end) opt_end = value_end;
+            const char* next = opt_end + 1;
+            trim(&opt, &opt_end);
+            if (token_is(opt, opt_end, "close")) p->conn_close = true;
+            if (token_is(opt, opt_end, "keep-alive")) p->conn_keep_alive = true;
+            opt = next;
+        }
+    }
+    return 0;
+}
+
+/**
+ * end_of_headers - Choose the body framing once the header block is complete
+ */
+static void end_of_headers(http_parser_t* p) {
+    // Interim response: the real one follows
+    if (p->status_code >= 100 && p->status_code < 200 && p->status_code != 101) {
+        http_parser_init(p);
+        return;
+    }
+
+    // These never have a body, whatever the headers say
+    if (p->status_code == 204 || p->status_code == 304) {
+        p->state = HTTP_PARSE_DONE;
+    } else if (p->transfer_encoded) {
+        // Transfer-Encoding overrides any Content-Length; without chunked
+        // as the final coding the body runs until the server closes
+        p->content_length = -1;
+        p->state = p->chunked ? HTTP_PARSE_CHUNK_SIZE : HTTP_PARSE_BODY_EOF;
+    } else if (p->content_length >= 0) {
+        p->remaining = p->content_length;
+        p->state = p->remaining > 0 ? HTTP_PARSE_BODY : HTTP_PARSE_DONE;
+    } else {
+        p->state = HTTP_PARSE_BODY_EOF;
+    }
+}
+
+/**
+ * parse_chunk_size - Read a chunk size line ("1a2b;ext=...")
+ *
+ * @return: 0 on success, -1 if malformed
+ */
+static int parse_chunk_size(http_parser_t* p, const char* line, size_t len) {
+    unsigned long long size = 0;
+    size_t i = 0;
+    for (; i < len && isxdigit((unsigned char)line[i]); i++) {
+        if (size >> 60) return -1;
+        int c = tolower((unsigned char)line[i]);
+        size = size * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+    if (i == 0) return -1;
+    while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+    if (i < len && line[i] != ';') return -1;
+
+    p->remaining = size;
+    p->state = size > 0 ? HTTP_PARSE_CHUNK_DATA : HTTP_PARSE_TRAILER;
+    return 0;
+}
+
+/**
+ * parse_line - Handle one complete line in a line-oriented state
+ *
+ * @param line: Line without its terminator
+ * @return: 0 on success, -1 if malformed
+ */
+static int parse_line(http_parser_t* p, const char* line, size_t len) {
+    switch (p->state) {
+    case HTTP_PARSE_STATUS:
+        if (parse_status_line(p, line, len) < 0) return -1;
+        p->state = HTTP_PARSE_HEADER;
+        return 0;
+
+    case HTTP_PARSE_HEADER:
+        if (len == 0) {
+            end_of_headers(p);
+            return 0;
+        }
+        return parse_header_line(p, line, len);
+
+    case HTTP_PARSE_CHUNK_SIZE:
+        return parse_chunk_size(p, line, len);
+
+    case HTTP_PARSE_CHUNK_END:
+        if (len != 0) return -1;
+        p->state = HTTP_PARSE_CHUNK_SIZE;
+        return 0;
+
+    case HTTP_PARSE_TRAILER:
+        // Trailer fields are ignored; a blank line ends the response
+        if (len == 0) p->state = HTTP_PARSE_DONE;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+ssize_t http_parser_feed(http_parser_t* parser, const char* data, size_t len,
+                         http_body_fn on_body, void* ctx) {
+    size_t pos = 0;
+
+    while (pos < len && parser->state != HTTP_PARSE_DONE) {
+        switch (parser->state) {
+        case HTTP_PARSE_BODY:
+        case HTTP_PARSE_CHUNK_DATA:
+        case HTTP_PARSE_BODY_EOF: {
+            size_t n = len - pos;
+            if (parser->state != HTTP_PARSE_BODY_EOF && n > parser->remaining) {
+                n = parser->remaining;
+            }
+            if (on_body && on_body(ctx, data + pos, n) < 0) return -1;
+            pos += n;
+            parser->body_size += n;
+
+            if (parser->state == HTTP_PARSE_BODY_EOF) break;
+            parser->remaining -= n;
+            if (parser->remaining == 0) {
+                parser->state = parser->state == HTTP_PARSE_BODY ? HTTP_PARSE_DONE
+                                                                 : HTTP_PARSE_CHUNK_END;
+            }
+            break;
+        }
+
+        default: {
+            // Line-oriented states: wait until the whole line is here
+            const char* eol = memchr(data + pos, '\n', len - pos);
+            if (!eol) return pos;
+
+            size_t line_len = eol - (data + pos);
+            if (line_len > 0 && data[pos + line_len - 1] == '\r') line_len--;
+            if (parse_line(parser, data + pos, line_len) < 0) return -1;
+            pos = eol + 1 - data;
+            break;
+        }
+        }
+    }
+
+    return pos;
+}
+
+int http_parser_finish(http_parser_t* parser) {
+    if (parser->state == HTTP_PARSE_BODY_EOF) {
+        parser->state = HTTP_PARSE_DONE;
+        return 0;
+    }
+    return parser->state == HTTP_PARSE_DONE ? 0 : -1;
+}
+
+bool http_parser_done(const http_parser_t* parser) {
+    return parser->state == HTTP_PARSE_DONE;
+}
+
+bool http_parser_keep_alive(const http_parser_t* parser) {
+    if (parser->state != HTTP_PARSE_DONE) return false;
+
+    // A body that ran to EOF used the connection up
+    if (!parser->chunked && parser->content_length < 0 &&
+        parser->status_code != 204 && parser->status_code != 304) {
+        return false;
+    }
+    return parser->minor_version >= 1 ? !parser->conn_close : parser->conn_keep_alive;
+}
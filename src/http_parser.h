@@ -0,0 +1,97 @@
+// http_parser.h - Incremental HTTP/1.x response parser
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * http_body_fn - Receives a response body piece by piece
+ *
+ * @param ctx: Caller context
+ * @param data: Next body bytes (chunk framing already removed)
+ * @param len: Number of bytes
+ * @return: 0 to continue, -1 to abort the response
+ */
+typedef int (*http_body_fn)(void* ctx, const char* data, size_t len);
+
+// Parser states, in the order a response goes through them
+typedef enum {
+    HTTP_PARSE_STATUS,              // Status line
+    HTTP_PARSE_HEADER,              // Header lines, up to the blank line
+    HTTP_PARSE_BODY,                // Content-Length body
+    HTTP_PARSE_BODY_EOF,            // Body delimited by the connection closing
+    HTTP_PARSE_CHUNK_SIZE,          // Chunk size line
+    HTTP_PARSE_CHUNK_DATA,          // Chunk payload
+    HTTP_PARSE_CHUNK_END,           // CRLF after a chunk payload
+    HTTP_PARSE_TRAILER,             // Trailer lines after the last chunk
+    HTTP_PARSE_DONE                 // Response complete
+} http_parse_state_t;
+
+/**
+ * http_parser_t - State of one response being parsed
+ *
+ * Holds no buffers: input is consumed in place and lines that are not
+ * complete yet are left to the caller to present again with more data.
+ */
+typedef struct {
+    http_parse_state_t state;
+    int status_code;
+    int minor_version;              // x in HTTP/1.x
+    long long content_length;       // -1 if not given
+    bool transfer_encoded;          // Transfer-Encoding given
+    bool chunked;                   // ... and ends in chunked
+    bool conn_close;                // Connection: close
+    bool conn_keep_alive;           // Connection: keep-alive (HTTP/1.0)
+    unsigned long long remaining;   // Bytes left in the body or current chunk
+    unsigned long long body_size;   // Body bytes delivered so far
+} http_parser_t;
+
+/**
+ * http_parser_init - Prepare a parser for the next response
+ */
+void http_parser_init(http_parser_t* parser);
+
+/**
+ * http_parser_feed - Consume received bytes
+ *
+ * @param parser: Parser state
+ * @param data: Received bytes not consumed yet
+ * @param len: Number of bytes
+ * @param on_body: Called with each piece of body (may be NULL to discard)
+ * @param ctx: Passed to on_body
+ * @return: Bytes consumed, or -1 if the response is malformed or on_body
+ *          aborted it
+ *
+ * Stops at the end of the response, so bytes of a following pipelined
+ * response are left unconsumed. A line that is not complete within data
+ * is not consumed either; call again once more bytes have arrived.
+ * Interim 1xx responses are skipped.
+ */
+ssize_t http_parser_feed(http_parser_t* parser, const char* data, size_t len,
+                         http_body_fn on_body, void* ctx);
+
+/**
+ * http_parser_finish - Tell the parser the connection was closed
+ *
+ * @return: 0 if that completes the response (a body running to EOF),
+ *          -1 if the response was cut short
+ */
+int http_parser_finish(http_parser_t* parser);
+
+/**
+ * http_parser_done - Check whether a whole response has been parsed
+ */
+bool http_parser_done(const http_parser_t* parser);
+
+/**
+ * http_parser_keep_alive - Check whether the connection can carry another request
+ *
+ * Only meaningful once the response is done: true unless the server asked
+ * to close (or, for HTTP/1.0, did not ask to keep the connection) or the
+ * body was delimited by closing it.
+ */
+bool http_parser_keep_alive(const http_parser_t* parser);
+
+#endif // HTTP_PARSER_H
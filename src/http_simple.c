@@ -1,21 +1,98 @@
 // http_simple_fixed.c - Fixed HTTP client with proper file upload
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <strings.h>
+#include <zlib.h>
 #include "http_simple.h"
+#include "http_parser.h"
 
 #define BUFFER_SIZE 4096
 #define MAX_HEADERS 32
+#define RECV_BUFFER_SIZE 16384      // Per-connection receive buffer (bounds the header block)
+#define DEFAULT_TIMEOUT 10
+#define HTTP_NO_REPLY (-2)          // Connection closed before any response byte
+#define DNS_CACHE_SIZE 4            // Host names whose addresses are remembered
+#define DNS_CACHE_TTL 300           // Seconds before a name is looked up again
+#define DNS_MAX_ADDRS 8             // Addresses kept (and tried) per name
+#define CONNECT_STAGGER_MS 250      // Head start each address gets before the next is tried
+#define STREAM_CHUNK_SIZE 16384     // Payload per chunk of a streamed body
+#define COMPRESS_SAMPLE_SIZE 16384  // Leading bytes compressed to judge a body
+#define GZIP_LEVEL 6
+#define GZIP_WINDOW_BITS 14         // 16 KB window; +16 selects the gzip wrapper
+#define GZIP_MEM_LEVEL 6            // With the window, about 100 KB of deflate state
+#define RESPONSE_BUFFER_KEEP 65536  // Largest response buffer kept for the next response
+
+/**
+ * dns_entry_t - Cached getaddrinfo result for one host:port
+ */
+typedef struct {
+    char host[256];
+    int port;
+    time_t resolved_at;             // When the list was fetched, 0 = refresh on next use
+    int count;                      // Number of addresses (0 = empty slot)
+    struct sockaddr_storage addrs[DNS_MAX_ADDRS];   // Preference order, families interleaved
+    socklen_t lens[DNS_MAX_ADDRS];
+} dns_entry_t;
+
+/**
+ * http_conn_t - One pooled connection
+ */
+typedef struct {
+    int fd;                         // Socket, -1 when the slot is free
+    char host[256];                 // Server host the socket is connected to
+    int port;                       // ... and port
+    time_t last_used;               // When the last response completed
+    char rbuf[RECV_BUFFER_SIZE];    // Received bytes not consumed yet
+    size_t rstart;                  // First unconsumed byte in rbuf
+    size_t rend;                    // End of received data in rbuf
+} http_conn_t;
+
+/**
+ * http_body_t - Request body held in memory, sent from a file, or streamed
+ */
+typedef struct http_body {
+    const void* data;               // In-memory body, or NULL to send from fd
+    int fd;                         // File to send from
+    off_t offset;                   // Start of the body in the file
+    size_t len;                     // Body length (not used for streams)
+    http_read_fn read;              // Streamed body of unknown length (chunked), or NULL
+    void* ctx;                      // Context for read
+    const struct http_body* parts;  // Send these segments gzip-compressed (chunked), or NULL
+    int part_count;                 // Number of parts
+} http_body_t;
+
+struct http_client {
+    int timeout_sec;
+    http_conn_t conns[HTTP_POOL_SIZE];
+    dns_entry_t dns[DNS_CACHE_SIZE];
+    http_client_stats_t stats;
+    http_compression_t compression;
+    z_stream zs;                    // Deflate state, reused for every compressed body
+    bool zs_ready;                  // zs has been initialized
+    char* body_buf;                 // Response bodies are collected here
+    size_t body_cap;                // Allocated size of body_buf
+};
 
 /**
  * parse_url - Extract host, port, and path from URL
+ *
+ * IPv6 literals are written in brackets ("http://[fd00::1]:8080/upload");
+ * host receives the address without them.
  */
 static int parse_url(const char* url, char* host, int* port, char* path) {
     const char* p = url;
@@ -25,137 +102,885 @@ static int parse_url(const char* url, char* host, int* port, char* path) {
         return -1;
     }
     
-    const char* slash = strchr(p, '/');
-    const char* colon = strchr(p, ':');
+    // Host part ends at the port, the path or the end of the URL
+    const char* host_start = p;
+    const char* host_end;
+    if (*p == '[') {
+        host_start = p + 1;
+        host_end = strchr(host_start, ']');
+        if (!host_end) return -1;
+        p = host_end + 1;
+    } else {
+        host_end = p + strcspn(p, ":/");
+        p = host_end;
+    }
     
-    if (colon && (!slash || colon < slash)) {
-        size_t host_len = colon - p;
-        if (host_len >= 256) return -1;
-        strncpy(host, p, host_len);
-        host[host_len] = '\0';
-        
-        *port = atoi(colon + 1);
+    size_t host_len = host_end - host_start;
+    if (host_len == 0 || host_len >= 256) return -1;
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+    
+    *port = 80;
+    if (*p == ':') {
+        *port = atoi(p + 1);
         if (*port <= 0 || *port > 65535) return -1;
-        
-        p = slash ? slash : colon + strlen(colon + 1);
-    } else {
-        *port = 80;
-        
-        if (slash) {
-            size_t host_len = slash - p;
-            if (host_len >= 256) return -1;
-            strncpy(host, p, host_len);
-            host[host_len] = '\0';
-            p = slash;
-        } else {
-            strcpy(host, p);
-            p = p + strlen(p);
-        }
+        p += strcspn(p, "/");
+    } else if (*p && *p != '/') {
+        return -1;
     }
     
     strcpy(path, *p ? p : "/");
     return 0;
 }
 
+/**
+ * format_host_header - Value for the Host header
+ */
+static void format_host_header(const char* host, int port, char* out, size_t out_size) {
+    bool literal6 = strchr(host, ':') != NULL;
+    if (port == 80) {
+        snprintf(out, out_size, literal6 ? "[%s]" : "%s", host);
+    } else {
+        snprintf(out, out_size, literal6 ? "[%s]:%d" : "%s:%d", host, port);
+    }
+}
+
+/**
+ * now_ms - Monotonic clock in milliseconds
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * resolve_host - Get the address list for host:port, from the cache if fresh
+ *
+ * @return: Cache entry, or NULL if the name cannot be resolved
+ *
+ * Addresses are kept for DNS_CACHE_TTL seconds. If a refresh fails, the
+ * previous list is used until the next attempt. Families are interleaved
+ * (in getaddrinfo's preference order) so a broken IPv6 or IPv4 path costs
+ * at most one connect stagger.
+ */
+static dns_entry_t* resolve_host(http_client_t* client, const char* host, int port) {
+    time_t now = time(NULL);
+    dns_entry_t* entry = NULL;
+    dns_entry_t* oldest = &client->dns[0];
+
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_entry_t* e = &client->dns[i];
+        if (e->count > 0 && e->port == port && strcmp(e->host, host) == 0) {
+            entry = e;
+            break;
+        }
+        if (e->resolved_at < oldest->resolved_at) oldest = e;
+    }
+
+    if (entry && entry->resolved_at != 0 && now - entry->resolved_at < DNS_CACHE_TTL) {
+        return entry;
+    }
+
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    struct addrinfo* list = NULL;
+    int rc = getaddrinfo(host, port_str, &hints, &list);
+    client->stats.resolves++;
+    if (rc != 0) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", host, gai_strerror(rc));
+        if (entry) {
+            entry->resolved_at = now;   // Retry the lookup after another TTL
+            return entry;
+        }
+        return NULL;
+    }
+
+    if (!entry) entry = oldest;
+    strcpy(entry->host, host);
+    entry->port = port;
+    entry->resolved_at = now;
+    entry->count = 0;
+
+    // Alternate between the two families, starting with the preferred one
+    const struct addrinfo* next[2] = { NULL, NULL };
+    int first_family = list->ai_family;
+    for (const struct addrinfo* ai = list; ai; ai = ai->ai_next) {
+        int k = ai->ai_family == first_family ? 0 : 1;
+        if (!next[k]) next[k] = ai;
+    }
+    for (int k = 0; entry->count < DNS_MAX_ADDRS && (next[0] || next[1]); k ^= 1) {
+        const struct addrinfo* ai = next[k];
+        if (!ai) continue;
+        if (ai->ai_addrlen <= sizeof(entry->addrs[0])) {
+            memcpy(&entry->addrs[entry->count], ai->ai_addr, ai->ai_addrlen);
+            entry->lens[entry->count] = ai->ai_addrlen;
+            entry->count++;
+        }
+        // Advance to the next address of the same family group
+        const struct addrinfo* n = ai->ai_next;
+        while (n && (n->ai_family == first_family) != (k == 0)) n = n->ai_next;
+        next[k] = n;
+    }
+
+    freeaddrinfo(list);
+    return entry->count > 0 ? entry : NULL;
+}
+
+/**
+ * happy_connect - Connect to the first address that answers
+ *
+ * @param entry: Resolved addresses, in preference order
+ * @param timeout_ms: Overall connect deadline
+ * @param winner: Output index of the address that connected
+ * @return: Connected (blocking) socket, or -1
+ *
+ * Happy-eyeballs style: each address gets CONNECT_STAGGER_MS to connect
+ * before the next one is tried alongside it, and an address that fails
+ * outright hands over at once. All attempts share the one deadline, so a
+ * dead address cannot stall the upload for a full kernel connect timeout.
+ */
+static int happy_connect(const dns_entry_t* entry, int timeout_ms, int* winner) {
+    struct pollfd pfds[DNS_MAX_ADDRS];
+    int which[DNS_MAX_ADDRS];
+    int pending = 0;
+    int next = 0;
+    int fd = -1;
+
+    long long deadline = now_ms() + timeout_ms;
+    long long next_start = 0;
+
+    while (fd < 0) {
+        long long now = now_ms();
+        if (now >= deadline) break;
+
+        // Start the next attempt when the stagger expires or nothing is in flight
+        if (next < entry->count && (now >= next_start || pending == 0)) {
+            const struct sockaddr* addr = (const struct sockaddr*)&entry->addrs[next];
+            int s = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (s >= 0) {
+                if (connect(s, addr, entry->lens[next]) == 0) {
+                    fd = s;
+                    *winner = next;
+                    break;
+                }
+                if (errno == EINPROGRESS) {
+                    pfds[pending].fd = s;
+                    pfds[pending].events = POLLOUT;
+                    which[pending++] = next;
+                } else {
+                    close(s);
+                }
+            }
+            next++;
+            next_start = now + CONNECT_STAGGER_MS;
+            continue;
+        }
+        if (pending == 0) break;    // Every address failed
+
+        long long wait = deadline - now;
+        if (next < entry->count && next_start - now < wait) wait = next_start - now;
+
+        int n = poll(pfds, pending, (int)wait);
+        if (n < 0 && errno != EINTR) break;
+
+        for (int i = pending - 1; n > 0 && i >= 0 && fd < 0; i--) {
+            if (!pfds[i].revents) continue;
+
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0) {
+                fd = pfds[i].fd;
+                *winner = which[i];
+            } else {
+                close(pfds[i].fd);
+                next_start = 0;
+            }
+            pfds[i] = pfds[--pending];
+            which[i] = which[pending];
+        }
+    }
+
+    for (int i = 0; i < pending; i++) {
+        close(pfds[i].fd);
+    }
+
+    if (fd >= 0) {
+        int flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    return fd;
+}
+
 /**
  * connect_to_server - Create socket and connect to HTTP server
  */
-static int connect_to_server(const char* host, int port, int timeout_sec) {
-    struct hostent* server;
-    struct sockaddr_in serv_addr;
-    int sockfd;
+static int connect_to_server(http_client_t* client, const char* host, int port) {
+    dns_entry_t* entry = resolve_host(client, host, port);
+    if (!entry) {
+        return -1;
+    }
     
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int winner = 0;
+    int sockfd = happy_connect(entry, client->timeout_sec * 1000, &winner);
     if (sockfd < 0) {
+        // Maybe the server moved: look the name up again next time
+        entry->resolved_at = 0;
         return -1;
     }
     
+    // Try the address that worked first next time
+    if (winner > 0) {
+        struct sockaddr_storage addr = entry->addrs[winner];
+        socklen_t len = entry->lens[winner];
+        memmove(&entry->addrs[1], &entry->addrs[0], winner * sizeof(entry->addrs[0]));
+        memmove(&entry->lens[1], &entry->lens[0], winner * sizeof(entry->lens[0]));
+        entry->addrs[0] = addr;
+        entry->lens[0] = len;
+    }
+    
     struct timeval tv;
-    tv.tv_sec = timeout_sec;
+    tv.tv_sec = client->timeout_sec;
     tv.tv_usec = 0;
     setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
     setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
     
-    server = gethostbyname(host);
-    if (server == NULL) {
-        close(sockfd);
-        return -1;
-    }
-    
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    serv_addr.sin_port = htons(port);
-    
-    if (connect(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        close(sockfd);
-        return -1;
-    }
+    // Requests go out as header + body writes on a kept-alive socket; with
+    // Nagle the body would wait for the ACK of the headers
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
     
     return sockfd;
 }
 
 /**
- * read_http_response - Read HTTP response from socket
+ * conn_close - Close a pooled connection and free its slot
  */
-static int read_http_response(int sockfd, http_response_t* response) {
-    char buffer[BUFFER_SIZE];
-    size_t total_read = 0;
-    size_t capacity = BUFFER_SIZE;
-    char* data = malloc(capacity);
-    
-    if (!data) return -1;
-    
+static void conn_close(http_conn_t* conn) {
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+    conn->fd = -1;
+    conn->rstart = conn->rend = 0;
+}
+
+/**
+ * conn_is_stale - Check whether an idle connection can still carry a request
+ *
+ * An idle keep-alive socket should have nothing to read. If it is
+ * readable, the server has closed it (EOF) or sent something unsolicited;
+ * either way it must not be reused.
+ */
+static bool conn_is_stale(const http_conn_t* conn) {
+    if (conn->rend > conn->rstart) return true;
+
+    struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) != 0) return true;
+    return false;
+}
+
+/**
+ * conn_fill - Read more data into a connection's receive buffer
+ *
+ * @return: Bytes read, 0 on EOF, -1 on error or a full buffer
+ */
+static ssize_t conn_fill(http_conn_t* conn) {
+    if (conn->rstart > 0) {
+        memmove(conn->rbuf, conn->rbuf + conn->rstart, conn->rend - conn->rstart);
+        conn->rend -= conn->rstart;
+        conn->rstart = 0;
+    }
+    if (conn->rend == sizeof(conn->rbuf)) return -1;
+
     ssize_t n;
-    while ((n = read(sockfd, buffer, BUFFER_SIZE)) > 0) {
-        if (total_read + n > capacity) {
-            capacity *= 2;
-            char* new_data = realloc(data, capacity);
-            if (!new_data) {
-                free(data);
-                return -1;
+    do {
+        n = recv(conn->fd, conn->rbuf + conn->rend, sizeof(conn->rbuf) - conn->rend, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) conn->rend += n;
+    return n;
+}
+
+/**
+ * pool_acquire - Get a connection to host:port, reusing an idle one if possible
+ *
+ * @param reused: Set when the connection carried earlier requests
+ * @return: Connection or NULL if connecting failed
+ */
+static http_conn_t* pool_acquire(http_client_t* client, const char* host, int port,
+                                 bool* reused) {
+    time_t now = time(NULL);
+    http_conn_t* victim = NULL;
+
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_conn_t* conn = &client->conns[i];
+        if (conn->fd >= 0 && conn->port == port && strcmp(conn->host, host) == 0) {
+            if (now - conn->last_used <= HTTP_IDLE_TIMEOUT && !conn_is_stale(conn)) {
+                *reused = true;
+                return conn;
             }
-            data = new_data;
+            client->stats.stale++;
+            conn_close(conn);
+        }
+        // Prefer a free slot, otherwise evict the least recently used
+        if (!victim || (victim->fd >= 0 &&
+                        (conn->fd < 0 || conn->last_used < victim->last_used))) {
+            victim = conn;
         }
-        
-        memcpy(data + total_read, buffer, n);
-        total_read += n;
     }
-    
-    if (total_read < 12) {
-        free(data);
-        return -1;
+
+    conn_close(victim);
+    victim->fd = connect_to_server(client, host, port);
+    if (victim->fd < 0) return NULL;
+
+    strcpy(victim->host, host);
+    victim->port = port;
+    victim->last_used = now;
+    client->stats.connects++;
+    *reused = false;
+    return victim;
+}
+
+/**
+ * send_all - Write a whole buffer to a socket
+ *
+ * @param flags: Extra send flags (MSG_MORE when a body follows)
+ * @return: 0 on success, -1 on error
+ */
+static int send_all(int sockfd, const void* data, size_t len, int flags) {
+    const char* p = data;
+    while (len > 0) {
+        // MSG_NOSIGNAL: a peer that closed the socket gives EPIPE, not SIGPIPE
+        ssize_t n = send(sockfd, p, len, flags | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
     }
-    
-    char* status_start = strchr(data, ' ');
-    if (!status_start) {
-        free(data);
-        return -1;
+    return 0;
+}
+
+/**
+ * send_file - Stream part of a file to a socket
+ *
+ * @param sockfd: Connected socket
+ * @param fd: File descriptor to read from
+ * @param offset: Starting offset in the file
+ * @param len: Number of bytes to send
+ * @return: 0 on success, -1 on error
+ *
+ * Uses sendfile so the data goes from the page cache to the socket
+ * without passing through user space. Falls back to read/send through a
+ * small stack buffer where sendfile is not supported for the file.
+ */
+static int send_file(int sockfd, int fd, off_t offset, size_t len) {
+    bool use_sendfile = true;
+    char buffer[BUFFER_SIZE];
+
+    while (len > 0) {
+        ssize_t n;
+        if (use_sendfile) {
+            n = sendfile(sockfd, fd, &offset, len);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                use_sendfile = false;
+                continue;
+            }
+        } else {
+            size_t chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+            n = pread(fd, buffer, chunk, offset);
+            if (n > 0 && send_all(sockfd, buffer, n, 0) < 0) return -1;
+            if (n > 0) offset += n;
+        }
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            // The file shrank after the Content-Length was sent
+            errno = EIO;
+            return -1;
+        }
+        len -= n;
     }
-    response->status_code = atoi(status_start + 1);
-    
-    char* body_start = strstr(data, "\r\n\r\n");
-    if (body_start) {
-        body_start += 4;
-        response->body_size = total_read - (body_start - data);
-        response->body = malloc(response->body_size + 1);
+    return 0;
+}
+
+/**
+ * send_chunk - Send one chunk of a chunked body
+ *
+ * @param data: Chunk payload, with 10 writable bytes before it and 2 after
+ * @param len: Payload length (not 0, which would end the body)
+ * @return: 0 on success, -1 on error
+ *
+ * The size line and trailing CRLF are written around the payload in
+ * place, so the whole chunk goes out in one send.
+ */
+static int send_chunk(int sockfd, char* data, size_t len) {
+    char size_line[12];
+    int line_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    char* start = data - line_len;
+    memcpy(start, size_line, line_len);
+    memcpy(data + len, "\r\n", 2);
+    return send_all(sockfd, start, line_len + len + 2, 0);
+}
+
+/**
+ * send_chunked - Stream a body with Transfer-Encoding: chunked
+ *
+ * @param consumed: Set once the body source has been read from
+ * @return: 0 on success, -1 on error
+ *
+ * Memory use is one STREAM_CHUNK_SIZE buffer whatever the body length.
+ * Each chunk's size line, data and trailing CRLF go out in one send.
+ */
+static int send_chunked(int sockfd, const http_body_t* body, bool* consumed) {
+    // Room for the hex size line before the data and the CRLF after it
+    char buffer[10 + STREAM_CHUNK_SIZE + 2];
+    char* data = buffer + 10;
+
+    for (;;) {
+        ssize_t n = body->read(body->ctx, data, STREAM_CHUNK_SIZE);
+        *consumed = true;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        if (send_chunk(sockfd, data, n) < 0) return -1;
+    }
+
+    return send_all(sockfd, "0\r\n\r\n", 5, 0);
+}
+
+/**
+ * deflate_stream - The client's deflate state, reset for a new body
+ *
+ * @return: Stream ready for deflate, or NULL if zlib cannot allocate it
+ *
+ * The state is allocated on first use and kept, so compressing a body
+ * costs no allocation.
+ */
+static z_stream* deflate_stream(http_client_t* client) {
+    if (client->zs_ready) {
+        return deflateReset(&client->zs) == Z_OK ? &client->zs : NULL;
+    }
+    memset(&client->zs, 0, sizeof(client->zs));
+    if (deflateInit2(&client->zs, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS + 16,
+                     GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    client->zs_ready = true;
+    return &client->zs;
+}
+
+/**
+ * should_compress - Decide whether a body is worth sending compressed
+ *
+ * @param parts: Body segments (in memory or from files)
+ * @param count: Number of segments
+ * @param total: Body length
+ * @return: true to send the body gzip-compressed
+ *
+ * Judged on the first COMPRESS_SAMPLE_SIZE bytes, so the cost of a wrong
+ * guess is bounded whatever the body length.
+ */
+static bool should_compress(http_client_t* client, const http_body_t* parts, int count,
+                            unsigned long long total) {
+    if (!client->compression.enabled || total < client->compression.min_size) {
+        return false;
+    }
+
+    unsigned char sample[COMPRESS_SAMPLE_SIZE];
+    size_t sampled = 0;
+    for (int i = 0; i < count && sampled < sizeof(sample); i++) {
+        size_t want = parts[i].len;
+        if (want > sizeof(sample) - sampled) want = sizeof(sample) - sampled;
+        if (parts[i].data) {
+            memcpy(sample + sampled, parts[i].data, want);
+            sampled += want;
+            continue;
+        }
+        ssize_t n = pread(parts[i].fd, sample + sampled, want, parts[i].offset);
+        if (n < 0) return false;
+        sampled += n;
+        if ((size_t)n < want) break;
+    }
+    if (sampled == 0) return false;
+
+    z_stream* zs = deflate_stream(client);
+    if (!zs) return false;
+
+    // Output beyond the threshold is not needed: running out of room
+    // already means the sample did not shrink enough
+    unsigned char out[COMPRESS_SAMPLE_SIZE];
+    size_t limit = sampled * client->compression.max_percent / 100;
+    if (limit > sizeof(out)) limit = sizeof(out);
+    zs->next_in = sample;
+    zs->avail_in = sampled;
+    zs->next_out = out;
+    zs->avail_out = limit;
+    return deflate(zs, Z_FINISH) == Z_STREAM_END;
+}
+
+/**
+ * send_gzip - Send body segments gzip-compressed, chunked
+ *
+ * @param parts: Segments making up the uncompressed body
+ * @param count: Number of segments
+ * @return: 0 on success, -1 on error
+ *
+ * Compression runs as the body is sent: file data is read one
+ * STREAM_CHUNK_SIZE piece at a time and each full output buffer goes out
+ * as one chunk, so memory use does not depend on the body length. The
+ * segments are only read, so a failed request can be sent again.
+ */
+static int send_gzip(http_client_t* client, int sockfd, const http_body_t* parts, int count) {
+    z_stream* zs = deflate_stream(client);
+    if (!zs) return -1;
+
+    unsigned char in[STREAM_CHUNK_SIZE];
+    char buffer[10 + STREAM_CHUNK_SIZE + 2];
+    char* out = buffer + 10;
+    zs->next_out = (unsigned char*)out;
+    zs->avail_out = STREAM_CHUNK_SIZE;
+
+    unsigned long long raw = 0, wire = 0;
+    for (int i = 0; i <= count; i++) {
+        bool last = i == count;
+        off_t offset = last ? 0 : parts[i].offset;
+        size_t left = last ? 0 : parts[i].len;
+
+        do {
+            int flush = last ? Z_FINISH : Z_NO_FLUSH;
+            if (!last && parts[i].data) {
+                zs->next_in = (unsigned char*)parts[i].data;
+                zs->avail_in = left;
+            } else if (!last) {
+                size_t want = left < sizeof(in) ? left : sizeof(in);
+                ssize_t n = pread(parts[i].fd, in, want, offset);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    // The file shrank since its size was taken
+                    if (n == 0) errno = EIO;
+                    return -1;
+                }
+                offset += n;
+                zs->next_in = in;
+                zs->avail_in = n;
+            }
+            raw += zs->avail_in;
+            left -= zs->avail_in;
+
+            // Drain the input, sending every buffer that fills up
+            int rc;
+            do {
+                rc = deflate(zs, flush);
+                if (rc == Z_STREAM_ERROR) return -1;
+                bool full = zs->avail_out == 0;
+                bool tail = rc == Z_STREAM_END && zs->avail_out < STREAM_CHUNK_SIZE;
+                if (full || tail) {
+                    size_t n = STREAM_CHUNK_SIZE - zs->avail_out;
+                    if (send_chunk(sockfd, out, n) < 0) return -1;
+                    wire += n;
+                    zs->next_out = (unsigned char*)out;
+                    zs->avail_out = STREAM_CHUNK_SIZE;
+                }
+            } while (zs->avail_in > 0 || (last && rc != Z_STREAM_END));
+        } while (left > 0);
+    }
+
+    if (send_all(sockfd, "0\r\n\r\n", 5, 0) < 0) return -1;
+
+    client->stats.compressed++;
+    client->stats.raw_bytes += raw;
+    client->stats.wire_bytes += wire;
+    return 0;
+}
+
+/**
+ * send_body - Send a request body from memory, a file or a stream
+ */
+static int send_body(http_client_t* client, int sockfd, const http_body_t* body,
+                     bool* consumed) {
+    if (body->parts) {
+        return send_gzip(client, sockfd, body->parts, body->part_count);
+    }
+    if (body->read) {
+        return send_chunked(sockfd, body, consumed);
+    }
+    if (body->data) {
+        return send_all(sockfd, body->data, body->len, 0);
+    }
+    return send_file(sockfd, body->fd, body->offset, body->len);
+}
+
+/**
+ * body_sink_t - Collects a response body in the client's buffer
+ */
+typedef struct {
+    http_client_t* client;
+    size_t len;                     // Bytes collected so far
+} body_sink_t;
+
+/**
+ * collect_body - http_body_fn appending to the client's response buffer
+ *
+ * The buffer survives from one response to the next, so a body of
+ * unknown length (chunked or up to EOF) is not grown by repeated
+ * realloc on every response. The caller still gets its own copy: see
+ * read_http_response.
+ */
+static int collect_body(void* ctx, const char* data, size_t len) {
+    body_sink_t* sink = ctx;
+    http_client_t* client = sink->client;
+
+    if (sink->len + len > client->body_cap) {
+        size_t capacity = client->body_cap ? client->body_cap : BUFFER_SIZE;
+        while (capacity < sink->len + len) capacity *= 2;
+        char* grown = realloc(client->body_buf, capacity);
+        if (!grown) return -1;
+        client->body_buf = grown;
+        client->body_cap = capacity;
+    }
+    memcpy(client->body_buf + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+/**
+ * release_body_buffer - Drop the response buffer if it grew unusually large
+ */
+static void release_body_buffer(http_client_t* client) {
+    if (client->body_cap > RESPONSE_BUFFER_KEEP) {
+        free(client->body_buf);
+        client->body_buf = NULL;
+        client->body_cap = 0;
+    }
+}
+
+/**
+ * read_http_response - Read one HTTP response from a connection
+ *
+ * @param conn: Connection (bytes past the response stay in its buffer)
+ * @param response: Output response structure
+ * @param on_body: Receives the body as it arrives, or NULL to collect it
+ *                 into response->body
+ * @param ctx: Passed to on_body
+ * @param keep_alive: Set when the connection may carry another request
+ * @return: 0 on success, HTTP_NO_REPLY if the connection closed before
+ *          any response byte arrived, -1 on other errors
+ *
+ * Received bytes are parsed as they arrive (see http_parser.h), so the
+ * body may be framed by Content-Length, chunked, or run to EOF; only in
+ * the last case is the connection not reused. A header line must fit in
+ * the connection's receive buffer.
+ */
+static int read_http_response(http_client_t* client, http_conn_t* conn,
+                              http_response_t* response,
+                              http_body_fn on_body, void* ctx, bool* keep_alive) {
+    response->status_code = 0;
+    response->body = NULL;
+    response->body_size = 0;
+    *keep_alive = false;
+
+    http_parser_t parser;
+    http_parser_init(&parser);
+
+    body_sink_t sink = { .client = client, .len = 0 };
+    bool collect = !on_body;
+    if (collect) {
+        on_body = collect_body;
+        ctx = &sink;
+    }
+
+    bool received = conn->rend > conn->rstart;
+    int rc = 0;
+    for (;;) {
+        if (conn->rend > conn->rstart) {
+            ssize_t used = http_parser_feed(&parser, conn->rbuf + conn->rstart,
+                                            conn->rend - conn->rstart, on_body, ctx);
+            if (used < 0) {
+                rc = -1;
+                break;
+            }
+            conn->rstart += used;
+            if (http_parser_done(&parser)) break;
+        }
+
+        ssize_t n = conn_fill(conn);
+        if (n > 0) {
+            received = true;
+            continue;
+        }
+        if (n == 0 && received && http_parser_finish(&parser) == 0) break;
+
+        rc = !received && (n == 0 || errno == ECONNRESET) ? HTTP_NO_REPLY : -1;
+        break;
+    }
+
+    if (rc == 0 && collect) {
+        // The caller owns response->body (http_response_free), so it gets
+        // one exact-size allocation copied from the shared buffer
+        response->body = malloc(sink.len + 1);
         if (response->body) {
-            memcpy(response->body, body_start, response->body_size);
-            response->body[response->body_size] = '\0';
+            if (sink.len > 0) memcpy(response->body, client->body_buf, sink.len);
+            response->body[sink.len] = '\0';
+            response->body_size = sink.len;
+        } else {
+            rc = -1;
         }
-    } else {
-        response->body = NULL;
-        response->body_size = 0;
     }
-    
-    free(data);
+    if (collect) release_body_buffer(client);
+    if (rc != 0) return rc;
+
+    response->status_code = parser.status_code;
+    *keep_alive = http_parser_keep_alive(&parser);
     return 0;
 }
 
 /**
- * http_get - Perform HTTP GET request
+ * client_exchange - Send one request and read its response
+ *
+ * @param head: Request line and headers
+ * @param body: Request body segments (NULL if none); sent again from the start on a retry
+ * @param body_count: Number of segments
+ * @param on_body: Receives the response body, or NULL to collect it in response
+ * @param ctx: Passed to on_body
+ * @return: 0 on success, -1 on error
+ *
+ * A reused connection may have been closed by the server just as the
+ * request went out; if it fails before any reply byte, the request is
+ * sent once more on a new connection. A streamed body cannot be rewound,
+ * so it is only retried if nothing had been read from it yet.
  */
-int http_get(const char* url, http_response_t* response) {
+static int client_exchange(http_client_t* client, const char* host, int port,
+                           const char* head, size_t head_len,
+                           const http_body_t* body, int body_count,
+                           http_body_fn on_body, void* ctx,
+                           http_response_t* response) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = false;
+        http_conn_t* conn = pool_acquire(client, host, port, &reused);
+        if (!conn) {
+            fprintf(stderr, "Cannot connect to server %s:%d\n", host, port);
+            return -1;
+        }
+
+        // MSG_MORE holds the headers back so they share a segment with the
+        // start of the body instead of going out on their own
+        bool has_body = body && body_count > 0 &&
+                        (body->len > 0 || body->read || body->parts);
+        bool consumed = false;
+
+        // A body in several segments is corked as a whole, so segment
+        // boundaries do not turn into short packets
+        bool corked = has_body && body_count > 1;
+        int one = 1, zero = 0;
+        if (corked) setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+
+        int rc = send_all(conn->fd, head, head_len, has_body ? MSG_MORE : 0);
+        for (int i = 0; rc == 0 && has_body && i < body_count; i++) {
+            rc = send_body(client, conn->fd, &body[i], &consumed);
+        }
+
+        if (corked) setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+
+        bool keep_alive = false;
+        if (rc == 0) {
+            rc = read_http_response(client, conn, response, on_body, ctx, &keep_alive);
+        } else {
+            fprintf(stderr, "Send error: %s\n", strerror(errno));
+            rc = HTTP_NO_REPLY;
+        }
+
+        if (rc == 0) {
+            client->stats.requests++;
+            if (reused) client->stats.reused++;
+            if (keep_alive) {
+                conn->last_used = time(NULL);
+            } else {
+                conn_close(conn);
+            }
+            return 0;
+        }
+
+        conn_close(conn);
+        if (rc != HTTP_NO_REPLY || !reused || consumed) return -1;
+        client->stats.stale++;
+    }
+    return -1;
+}
+
+http_client_t* http_client_create(int timeout_sec) {
+    http_client_t* client = calloc(1, sizeof(*client));
+    if (!client) return NULL;
+
+    client->timeout_sec = timeout_sec > 0 ? timeout_sec : DEFAULT_TIMEOUT;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        client->conns[i].fd = -1;
+    }
+    return client;
+}
+
+void http_client_destroy(http_client_t* client) {
+    if (!client) return;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        conn_close(&client->conns[i]);
+    }
+    if (client->zs_ready) deflateEnd(&client->zs);
+    free(client->body_buf);
+    free(client);
+}
+
+void http_client_get_stats(const http_client_t* client, http_client_stats_t* stats) {
+    *stats = client->stats;
+}
+
+void http_client_set_compression(http_client_t* client, const http_compression_t* settings) {
+    if (settings) {
+        client->compression = *settings;
+        if (client->compression.max_percent <= 0 || client->compression.max_percent > 100) {
+            client->compression.max_percent = HTTP_COMPRESS_MAX_PERCENT;
+        }
+    } else {
+        client->compression.enabled = false;
+    }
+}
+
+/**
+ * compression_refused - Handle a server that does not accept compressed bodies
+ *
+ * @param compressed: The request body was sent compressed
+ * @return: true if the request must be sent again uncompressed (response
+ *          has been freed and compression is now off)
+ */
+static bool compression_refused(http_client_t* client, bool compressed,
+                                http_response_t* response) {
+    if (!compressed || response->status_code != 415) return false;
+
+    fprintf(stderr, "Server does not accept compressed uploads, sending them as is\n");
+    client->compression.enabled = false;
+    http_response_free(response);
+    return true;
+}
+
+/**
+ * http_client_get - Perform HTTP GET request on a pooled connection
+ */
+int http_client_get(http_client_t* client, const char* url, http_response_t* response) {
+    return http_client_get_stream(client, url, NULL, NULL, response);
+}
+
+/**
+ * http_client_get_stream - GET with the body handed over as it arrives
+ */
+int http_client_get_stream(http_client_t* client, const char* url,
+                           http_body_fn on_body, void* ctx,
+                           http_response_t* response) {
     char host[256];
     char path[1024];
     int port;
@@ -164,38 +989,97 @@ int http_get(const char* url, http_response_t* response) {
         return -1;
     }
     
-    int sockfd = connect_to_server(host, port, 10);
-    if (sockfd < 0) {
-        return -1;
-    }
+    char host_header[300];
+    format_host_header(host, port, host_header, sizeof(host_header));
     
     char request[2048];
-    snprintf(request, sizeof(request),
+    int request_len = snprintf(request, sizeof(request),
         "GET %s HTTP/1.1\r\n"
         "Host: %s\r\n"
         "User-Agent: RemarkableSyncClient/1.0\r\n"
-        "Connection: close\r\n"
         "\r\n",
-        path, host);
+        path, host_header);
+    
+    return client_exchange(client, host, port, request, request_len, NULL, 0,
+                           on_body, ctx, response);
+}
+
+/**
+ * format_upload_headers - Build the request line and headers of an upload
+ *
+ * @param framing: Content-Length or Transfer-Encoding header line (no CRLF)
+ * @return: Header length, or -1 if it does not fit
+ */
+static int format_upload_headers(char* out, size_t out_size, const char* path,
+                                 const char* host, int port, const char* api_key,
+                                 const char* virtual_path, const char* filename,
+                                 const char* framing) {
+    char host_header[300];
+    format_host_header(host, port, host_header, sizeof(host_header));
+    
+    int len = snprintf(out, out_size,
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "User-Agent: RemarkableSyncClient/1.0\r\n"
+        "X-API-Key: %s\r\n"
+        "X-Document-Path: %s\r\n"
+        "X-Filename: %s\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "%s\r\n"
+        "\r\n",
+        path, host_header, api_key, virtual_path, filename, framing);
+    if (len < 0 || (size_t)len >= out_size) {
+        fprintf(stderr, "Request headers too long\n");
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * http_client_post_stream - Upload a body of unknown length on a pooled connection
+ */
+int http_client_post_stream(http_client_t* client, const char* url, const char* api_key,
+                            const char* filename, const char* virtual_path,
+                            http_read_fn read_fn, void* ctx,
+                            http_response_t* response) {
+    char host[256];
+    char path[1024];
+    int port;
     
-    if (write(sockfd, request, strlen(request)) < 0) {
-        close(sockfd);
+    if (parse_url(url, host, &port, path) < 0) {
+        fprintf(stderr, "Failed to parse URL: %s\n", url);
         return -1;
     }
     
-    int result = read_http_response(sockfd, response);
-    close(sockfd);
+    char headers[2048];
+    int header_len = format_upload_headers(headers, sizeof(headers), path, host, port,
+                                           api_key, virtual_path, filename,
+                                           "Transfer-Encoding: chunked");
+    if (header_len < 0) return -1;
     
-    return result;
+    http_body_t body = { .data = NULL, .fd = -1, .read = read_fn, .ctx = ctx };
+    return client_exchange(client, host, port, headers, header_len, &body, 1,
+                           NULL, NULL, response);
 }
 
 /**
- * http_post_file - Upload file via HTTP POST with custom headers
- * FIXED VERSION: Properly sends file content
+ * read_fd - http_read_fn over a file descriptor
  */
-int http_post_file(const char* url, const char* api_key,
-                   const char* file_path, const char* virtual_path,
-                   http_response_t* response) {
+static ssize_t read_fd(void* ctx, char* buf, size_t size) {
+    int fd = *(int*)ctx;
+    ssize_t n;
+    do {
+        n = read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/**
+ * http_client_post_file - Upload a file on a pooled connection
+ */
+int http_client_post_file(http_client_t* client, const char* url, const char* api_key,
+                          const char* file_path, const char* virtual_path,
+                          http_response_t* response) {
     char host[256];
     char path[1024];
     int port;
@@ -206,110 +1090,405 @@ int http_post_file(const char* url, const char* api_key,
         return -1;
     }
     
-    // Open and read file
-    FILE* f = fopen(file_path, "rb");
-    if (!f) {
+    // The body is streamed from the file, so only its size is needed here
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         fprintf(stderr, "Cannot open file: %s\n", file_path);
         return -1;
     }
     
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    if (file_size <= 0 || file_size > 10*1024*1024) {
-        fprintf(stderr, "Invalid file size: %ld\n", file_size);
-        fclose(f);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot stat file: %s\n", file_path);
+        close(fd);
         return -1;
     }
     
-    // Read file content
-    unsigned char* file_data = malloc(file_size);
-    if (!file_data) {
-        fprintf(stderr, "Cannot allocate memory for file\n");
-        fclose(f);
+    // Extract filename
+    const char* filename = strrchr(file_path, '/');
+    filename = filename ? filename + 1 : file_path;
+    
+    // Anything but a regular file has no reliable size: send it chunked
+    if (!S_ISREG(st.st_mode)) {
+        int result = http_client_post_stream(client, url, api_key, filename,
+                                             virtual_path, read_fd, &fd, response);
+        close(fd);
+        return result;
+    }
+    
+    if (st.st_size <= 0) {
+        fprintf(stderr, "Invalid file size: %lld\n", (long long)st.st_size);
+        close(fd);
         return -1;
     }
     
-    size_t bytes_read = fread(file_data, 1, file_size, f);
-    fclose(f);
+    http_body_t body = { .data = NULL, .fd = fd, .offset = 0, .len = st.st_size };
+    http_body_t gzip_body = { .data = NULL, .fd = -1, .parts = &body, .part_count = 1 };
+    bool compress = should_compress(client, &body, 1, st.st_size);
     
-    if (bytes_read != (size_t)file_size) {
-        fprintf(stderr, "Failed to read complete file: %zu/%ld\n", bytes_read, file_size);
-        free(file_data);
-        return -1;
+    int result;
+    for (;;) {
+        // Build headers
+        char framing[64];
+        if (compress) {
+            snprintf(framing, sizeof(framing),
+                     "Content-Encoding: gzip\r\nTransfer-Encoding: chunked");
+        } else {
+            snprintf(framing, sizeof(framing), "Content-Length: %lld",
+                     (long long)st.st_size);
+        }
+        
+        char headers[2048];
+        int header_len = format_upload_headers(headers, sizeof(headers), path, host, port,
+                                               api_key, virtual_path, filename, framing);
+        if (header_len < 0) {
+            result = -1;
+            break;
+        }
+        
+        result = client_exchange(client, host, port, headers, header_len,
+                                 compress ? &gzip_body : &body, 1, NULL, NULL, response);
+        if (result != 0 || !compression_refused(client, compress, response)) break;
+        compress = false;
     }
+    close(fd);
+    return result;
+}
+
+/**
+ * put_be - Store an unsigned value big-endian in n bytes
+ */
+static unsigned char* put_be(unsigned char* p, uint32_t value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        p[i] = value & 0xff;
+        value >>= 8;
+    }
+    return p + n;
+}
+
+/**
+ * http_client_post_batch - Upload several files in one request
+ */
+int http_client_post_batch(http_client_t* client, const char* url, const char* api_key,
+                           const http_batch_item_t* items, int count,
+                           http_response_t* response) {
+    char host[256];
+    char path[1024];
+    int port;
     
-    // Connect to server
-    int sockfd = connect_to_server(host, port, 10);
-    if (sockfd < 0) {
-        fprintf(stderr, "Cannot connect to server %s:%d\n", host, port);
-        free(file_data);
+    if (count <= 0 || count > HTTP_BATCH_MAX_ITEMS) return -1;
+    if (parse_url(url, host, &port, path) < 0) {
+        fprintf(stderr, "Failed to parse URL: %s\n", url);
         return -1;
     }
     
-    // Extract filename
-    const char* filename = strrchr(file_path, '/');
-    filename = filename ? filename + 1 : file_path;
+    // Each item is a small framing prefix followed by the file itself
+    http_body_t body[2 * HTTP_BATCH_MAX_ITEMS];
+    int fds[HTTP_BATCH_MAX_ITEMS];
+    unsigned char* prefixes = NULL;
+    size_t prefix_size = 0;
+    int opened = 0;
+    int result = -1;
     
-    // Build headers
-    char headers[2048];
-    int header_len = snprintf(headers, sizeof(headers),
-        "POST %s HTTP/1.1\r\n"
-        "Host: %s\r\n"
-        "User-Agent: RemarkableSyncClient/1.0\r\n"
-        "X-API-Key: %s\r\n"
-        "X-Document-Path: %s\r\n"
-        "X-Filename: %s\r\n"
-        "Content-Type: application/octet-stream\r\n"
-        "Content-Length: %ld\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        path, host, api_key, virtual_path, filename, file_size);
-    
-    // Send headers
-    ssize_t sent = write(sockfd, headers, header_len);
-    if (sent != header_len) {
-        fprintf(stderr, "Failed to send headers: %zd/%d\n", sent, header_len);
-        close(sockfd);
-        free(file_data);
-        return -1;
+    for (int i = 0; i < count; i++) {
+        const char* filename = strrchr(items[i].file_path, '/');
+        filename = filename ? filename + 1 : items[i].file_path;
+        size_t path_len = strlen(items[i].virtual_path);
+        size_t name_len = strlen(filename);
+        if (path_len > 0xffff || name_len > 0xffff) goto out;
+        prefix_size += 2 + path_len + 2 + name_len + 4;
     }
+    prefixes = malloc(prefix_size);
+    if (!prefixes) goto out;
     
-    // Send file data
-    size_t total_sent = 0;
-    while (total_sent < (size_t)file_size) {
-        size_t chunk = file_size - total_sent;
-        if (chunk > BUFFER_SIZE) chunk = BUFFER_SIZE;
+    unsigned char* p = prefixes;
+    unsigned long long total = 0;
+    for (int i = 0; i < count; i++) {
+        fds[i] = open(items[i].file_path, O_RDONLY | O_CLOEXEC);
+        if (fds[i] < 0) {
+            fprintf(stderr, "Cannot open file: %s\n", items[i].file_path);
+            goto out;
+        }
+        opened = i + 1;
         
-        ssize_t n = write(sockfd, file_data + total_sent, chunk);
-        if (n <= 0) {
-            if (n < 0) {
-                fprintf(stderr, "Write error: %s\n", strerror(errno));
-            } else {
-                fprintf(stderr, "Connection closed by server\n");
-            }
-            close(sockfd);
-            free(file_data);
-            return -1;
+        struct stat st;
+        if (fstat(fds[i], &st) != 0 || !S_ISREG(st.st_mode) ||
+            st.st_size <= 0 || st.st_size > 0xffffffffLL) {
+            fprintf(stderr, "Invalid file for batch: %s\n", items[i].file_path);
+            goto out;
         }
-        total_sent += n;
+        
+        const char* filename = strrchr(items[i].file_path, '/');
+        filename = filename ? filename + 1 : items[i].file_path;
+        size_t path_len = strlen(items[i].virtual_path);
+        size_t name_len = strlen(filename);
+        
+        unsigned char* start = p;
+        p = put_be(p, path_len, 2);
+        memcpy(p, items[i].virtual_path, path_len);
+        p += path_len;
+        p = put_be(p, name_len, 2);
+        memcpy(p, filename, name_len);
+        p += name_len;
+        p = put_be(p, st.st_size, 4);
+        
+        body[2 * i] = (http_body_t){ .data = start, .fd = -1, .len = p - start };
+        body[2 * i + 1] = (http_body_t){ .data = NULL, .fd = fds[i], .offset = 0,
+                                         .len = st.st_size };
+        total += (p - start) + st.st_size;
     }
     
-    free(file_data);
+    char host_header[300];
+    format_host_header(host, port, host_header, sizeof(host_header));
     
-    // Verify all data was sent
-    if (total_sent != (size_t)file_size) {
-        fprintf(stderr, "Incomplete send: %zu/%ld bytes\n", total_sent, file_size);
-        close(sockfd);
-        return -1;
-    }
+    // The whole batch is compressed as one stream, so small pages that
+    // would not be worth it alone share one dictionary
+    http_body_t gzip_body = { .data = NULL, .fd = -1, .parts = body, .part_count = 2 * count };
+    bool compress = should_compress(client, body, 2 * count, total);
     
-    // Read response
-    int result = read_http_response(sockfd, response);
-    close(sockfd);
+    for (;;) {
+        char framing[64];
+        if (compress) {
+            snprintf(framing, sizeof(framing),
+                     "Content-Encoding: gzip\r\nTransfer-Encoding: chunked");
+        } else {
+            snprintf(framing, sizeof(framing), "Content-Length: %llu", total);
+        }
+        
+        char headers[1024];
+        int header_len = snprintf(headers, sizeof(headers),
+            "POST %s HTTP/1.1\r\n"
+            "Host: %s\r\n"
+            "User-Agent: RemarkableSyncClient/1.0\r\n"
+            "X-API-Key: %s\r\n"
+            "X-Batch-Count: %d\r\n"
+            "Content-Type: " HTTP_BATCH_CONTENT_TYPE "\r\n"
+            "%s\r\n"
+            "\r\n",
+            path, host_header, api_key, count, framing);
+        if (header_len < 0 || header_len >= (int)sizeof(headers)) goto out;
+        
+        result = client_exchange(client, host, port, headers, header_len,
+                                 compress ? &gzip_body : body,
+                                 compress ? 1 : 2 * count, NULL, NULL, response);
+        if (result != 0 || !compression_refused(client, compress, response)) break;
+        compress = false;
+    }
     
+out:
+    for (int i = 0; i < opened; i++) {
+        close(fds[i]);
+    }
+    free(prefixes);
+    return result;
+}
+
+/**
+ * send_upload - Send one file upload request on a connection
+ *
+ * @param compressed: Set if the body went out compressed
+ * @return: 0 on success, -1 if the send failed, -2 if the file cannot be
+ *          read (nothing was sent)
+ */
+static int send_upload(http_client_t* client, http_conn_t* conn, const char* path,
+                       const char* host, int port, const char* api_key,
+                       const http_batch_item_t* item, bool* compressed) {
+    int fd = open(item->file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -2;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return -2;
+    }
+
+    const char* filename = strrchr(item->file_path, '/');
+    filename = filename ? filename + 1 : item->file_path;
+
+    http_body_t body = { .data = NULL, .fd = fd, .offset = 0, .len = st.st_size };
+    *compressed = should_compress(client, &body, 1, st.st_size);
+
+    char framing[64];
+    if (*compressed) {
+        snprintf(framing, sizeof(framing),
+                 "Content-Encoding: gzip\r\nTransfer-Encoding: chunked");
+    } else {
+        snprintf(framing, sizeof(framing), "Content-Length: %lld", (long long)st.st_size);
+    }
+
+    char headers[2048];
+    int header_len = format_upload_headers(headers, sizeof(headers), path, host, port,
+                                           api_key, item->virtual_path, filename, framing);
+    int rc = -2;
+    if (header_len >= 0) {
+        rc = send_all(conn->fd, headers, header_len, MSG_MORE);
+        if (rc == 0 && *compressed) {
+            rc = send_gzip(client, conn->fd, &body, 1);
+        } else if (rc == 0) {
+            rc = send_file(conn->fd, fd, 0, st.st_size);
+        }
+    }
+    close(fd);
+    return rc;
+}
+
+/**
+ * http_client_post_pipeline - Upload several files as pipelined requests
+ */
+int http_client_post_pipeline(http_client_t* client, const char* url, const char* api_key,
+                              const http_batch_item_t* items, int count, int depth,
+                              http_response_t* responses) {
+    char host[256];
+    char path[1024];
+    int port;
+
+    if (count <= 0) return 0;
+    for (int i = 0; i < count; i++) {
+        memset(&responses[i], 0, sizeof(responses[i]));
+    }
+    if (parse_url(url, host, &port, path) < 0) {
+        fprintf(stderr, "Failed to parse URL: %s\n", url);
+        return 0;
+    }
+    if (depth < 1) depth = 1;
+    if (depth > HTTP_PIPELINE_MAX_DEPTH) depth = HTTP_PIPELINE_MAX_DEPTH;
+
+    // Per item: 0 = waiting to be sent, 1 = in flight, 2 = finished
+    unsigned char state[count];
+    unsigned char tries[count];
+    bool compressed[count];
+    memset(state, 0, count);
+    memset(tries, 0, count);
+
+    int finished = 0;
+    int answered = 0;
+    int inflight[HTTP_PIPELINE_MAX_DEPTH];
+
+    while (finished < count) {
+        bool reused = false;
+        http_conn_t* conn = pool_acquire(client, host, port, &reused);
+        if (!conn) {
+            fprintf(stderr, "Cannot connect to server %s:%d\n", host, port);
+            break;
+        }
+
+        int head = 0, queued = 0;
+        int next = 0;
+        bool broken = false;
+        bool closed = false;
+        bool first = true;
+
+        for (;;) {
+            // Keep the window full
+            while (queued < depth && !broken) {
+                while (next < count && state[next] != 0) next++;
+                if (next == count) break;
+
+                int rc = send_upload(client, conn, path, host, port, api_key,
+                                     &items[next], &compressed[next]);
+                if (rc == -2) {
+                    // Unreadable file: fail just this item
+                    fprintf(stderr, "Cannot read file: %s\n", items[next].file_path);
+                    state[next++] = 2;
+                    finished++;
+                    continue;
+                }
+                if (rc != 0) {
+                    // Collect what was already answered, then start over. Only
+                    // a request at the head of the line counts as attempted.
+                    if (queued == 0 && ++tries[next] > 1) {
+                        state[next] = 2;
+                        finished++;
+                    }
+                    broken = true;
+                    break;
+                }
+                if (queued > 0) client->stats.pipelined++;
+                state[next] = 1;
+                inflight[(head + queued++) % HTTP_PIPELINE_MAX_DEPTH] = next++;
+            }
+            if (queued == 0) break;
+
+            // Responses come back in request order
+            int i = inflight[head];
+            bool keep_alive = false;
+            if (read_http_response(client, conn, &responses[i], NULL, NULL,
+                                   &keep_alive) != 0) {
+                broken = true;
+                break;
+            }
+            client->stats.requests++;
+            if (reused || !first) client->stats.reused++;
+            first = false;
+
+            // Refused for its encoding: queue it again, to go out as is
+            if (compression_refused(client, compressed[i], &responses[i])) {
+                responses[i].status_code = 0;
+                state[i] = 0;
+            } else {
+                state[i] = 2;
+                finished++;
+                answered++;
+            }
+            head = (head + 1) % HTTP_PIPELINE_MAX_DEPTH;
+            queued--;
+
+            // The server may close after any response; the rest start over
+            if (!keep_alive) {
+                broken = closed = true;
+                break;
+            }
+        }
+
+        if (!broken) {
+            conn->last_used = time(NULL);
+            continue;
+        }
+
+        // Requests left unanswered on a closed connection go out again on a
+        // new one. Only the first of them may have been processed (the
+        // server handles requests in order), so only it counts as an attempt
+        // and it is retried at most once; after an announced close none of
+        // them was processed.
+        conn_close(conn);
+        for (int k = 0; k < queued; k++) {
+            int j = inflight[(head + k) % HTTP_PIPELINE_MAX_DEPTH];
+            if (k == 0 && !closed && ++tries[j] > 1) {
+                state[j] = 2;
+                finished++;
+            } else {
+                state[j] = 0;
+            }
+        }
+    }
+
+    return answered;
+}
+
+/**
+ * http_get - Perform HTTP GET request
+ */
+int http_get(const char* url, http_response_t* response) {
+    http_client_t* client = http_client_create(DEFAULT_TIMEOUT);
+    if (!client) return -1;
+
+    int result = http_client_get(client, url, response);
+    http_client_destroy(client);
+    return result;
+}
+
+/**
+ * http_post_file - Upload file via HTTP POST with custom headers
+ */
+int http_post_file(const char* url, const char* api_key,
+                   const char* file_path, const char* virtual_path,
+                   http_response_t* response) {
+    http_client_t* client = http_client_create(DEFAULT_TIMEOUT);
+    if (!client) return -1;
+
+    int result = http_client_post_file(client, url, api_key, file_path,
+                                       virtual_path, response);
+    http_client_destroy(client);
     return result;
 }
 
@@ -322,4 +1501,4 @@ void http_response_free(http_response_t* response) {
         response->body = NULL;
         response->body_size = 0;
     }
-}
\ No newline at end of file
+}
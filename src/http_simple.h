@@ -2,7 +2,18 @@
 #ifndef HTTP_SIMPLE_H
 #define HTTP_SIMPLE_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
+#include "http_parser.h"
+
+#define HTTP_POOL_SIZE 4            // Persistent connections kept per client
+#define HTTP_IDLE_TIMEOUT 30        // Seconds an idle connection is trusted for reuse
+#define HTTP_BATCH_MAX_ITEMS 32     // Files per batch upload request
+#define HTTP_BATCH_CONTENT_TYPE "application/x-rmsync-batch"
+#define HTTP_PIPELINE_MAX_DEPTH 16  // Upper bound on requests in flight per connection
+#define HTTP_COMPRESS_MIN_SIZE 1024 // Default smallest body worth compressing
+#define HTTP_COMPRESS_MAX_PERCENT 90    // Default: compress if a sample shrinks to this or less
 
 /**
  * http_response_t - HTTP response structure
@@ -13,6 +24,209 @@ typedef struct http_response {
     size_t body_size;      // Size of body in bytes
 } http_response_t;
 
+/**
+ * http_client_t - Client handle owning a pool of keep-alive connections
+ *
+ * Connections are HTTP/1.1, keyed by host:port and reused across
+ * requests. An idle socket the server has closed is detected before reuse
+ * and replaced; a request that fails on a reused socket before any reply
+ * byte arrives is retried once on a fresh connection.
+ */
+typedef struct http_client http_client_t;
+
+/**
+ * http_client_stats_t - Connection reuse counters
+ */
+typedef struct {
+    unsigned long requests;         // Requests completed
+    unsigned long connects;         // TCP connections opened
+    unsigned long reused;           // Requests sent on an existing connection
+    unsigned long stale;            // Idle connections found closed and dropped
+    unsigned long resolves;         // getaddrinfo lookups (the rest hit the cache)
+    unsigned long pipelined;        // Requests sent while earlier ones were unanswered
+    unsigned long compressed;       // Request bodies sent gzip-compressed
+    unsigned long long raw_bytes;   // Size of those bodies before compression
+    unsigned long long wire_bytes;  // ... and as sent
+} http_client_stats_t;
+
+/**
+ * http_compression_t - Upload body compression settings
+ *
+ * Upload bodies of at least min_size bytes are candidates. The start of
+ * each one is compressed as a sample, and the body is sent with
+ * Content-Encoding: gzip only if the sample shrank to max_percent of its
+ * size or less, so data that does not compress is not paid for twice.
+ */
+typedef struct {
+    bool enabled;
+    size_t min_size;                // Smaller bodies are always sent as is
+    int max_percent;                // Largest sampled ratio still worth compressing
+} http_compression_t;
+
+/**
+ * http_client_create - Create a client with an empty connection pool
+ * 
+ * @param timeout_sec: Socket send/receive timeout in seconds
+ * @return: Client handle or NULL on allocation failure
+ */
+http_client_t* http_client_create(int timeout_sec);
+
+/**
+ * http_client_destroy - Close all pooled connections and free the client
+ */
+void http_client_destroy(http_client_t* client);
+
+/**
+ * http_client_set_compression - Configure compression of upload bodies
+ * 
+ * @param client: Client handle
+ * @param settings: New settings, or NULL to disable compression (the default)
+ * 
+ * Applies to http_client_post_file, http_client_post_batch and
+ * http_client_post_pipeline. A compressed body is produced while it is
+ * sent, one small buffer at a time, with Transfer-Encoding: chunked. If
+ * the server answers 415 Unsupported Media Type to a compressed request,
+ * compression is switched off and the request is sent again as is.
+ */
+void http_client_set_compression(http_client_t* client, const http_compression_t* settings);
+
+/**
+ * http_client_get - Perform HTTP GET request on a pooled connection
+ * 
+ * @param client: Client handle
+ * @param url: Full URL to fetch (http://host:port/path)
+ * @param response: Output response structure
+ * @return: 0 on success, -1 on error
+ */
+int http_client_get(http_client_t* client, const char* url, http_response_t* response);
+
+/**
+ * http_client_get_stream - GET a response body without holding it in memory
+ * 
+ * @param client: Client handle
+ * @param url: Full URL to fetch (http://host:port/path)
+ * @param on_body: Called with each piece of the body as it is received
+ *                 (chunked framing removed); returning -1 aborts
+ * @param ctx: Passed to on_body
+ * @param response: Output response structure; body stays NULL
+ * @return: 0 on success, -1 on error (including on_body aborting)
+ * 
+ * on_body may be called before the whole response has arrived, so a
+ * failure after it was first called means a partial body was delivered.
+ */
+int http_client_get_stream(http_client_t* client, const char* url,
+                           http_body_fn on_body, void* ctx,
+                           http_response_t* response);
+
+/**
+ * http_client_post_file - Upload a file on a pooled connection
+ * 
+ * @param client: Client handle
+ * @param url: Upload URL
+ * @param api_key: API key for X-API-Key header
+ * @param file_path: Path to file to upload
+ * @param virtual_path: Virtual path for X-Document-Path header
+ * @param response: Output response structure
+ * @return: 0 on success, -1 on error
+ * 
+ * Same request format as http_post_file. A regular file is sent with a
+ * Content-Length straight from the page cache (no size limit), or gzip
+ * compressed if compression is enabled and pays off; anything else (a
+ * pipe, a device) is streamed as with http_client_post_stream.
+ */
+int http_client_post_file(http_client_t* client, const char* url, const char* api_key,
+                          const char* file_path, const char* virtual_path,
+                          http_response_t* response);
+
+/**
+ * http_read_fn - Supplies the next part of a streamed request body
+ * 
+ * @param ctx: Caller context
+ * @param buf: Buffer to fill
+ * @param size: Size of buf
+ * @return: Bytes written to buf, 0 at the end of the body, -1 on error
+ */
+typedef ssize_t (*http_read_fn)(void* ctx, char* buf, size_t size);
+
+/**
+ * http_client_post_stream - Upload a body of unknown length on a pooled connection
+ * 
+ * @param client: Client handle
+ * @param url: Upload URL
+ * @param api_key: API key for X-API-Key header
+ * @param filename: Value for the X-Filename header
+ * @param virtual_path: Virtual path for X-Document-Path header
+ * @param read_fn: Called repeatedly for the body until it returns 0
+ * @param ctx: Passed to read_fn
+ * @param response: Output response structure
+ * @return: 0 on success, -1 on error (including read_fn failing)
+ * 
+ * The body is sent with Transfer-Encoding: chunked, read in fixed-size
+ * pieces, so memory use does not depend on its length.
+ */
+int http_client_post_stream(http_client_t* client, const char* url, const char* api_key,
+                            const char* filename, const char* virtual_path,
+                            http_read_fn read_fn, void* ctx,
+                            http_response_t* response);
+
+/**
+ * http_batch_item_t - One file of a batch upload
+ */
+typedef struct {
+    const char* file_path;          // File to upload (regular file)
+    const char* virtual_path;       // Virtual path, as in X-Document-Path
+} http_batch_item_t;
+
+/**
+ * http_client_post_batch - Upload several files in one request
+ * 
+ * @param client: Client handle
+ * @param url: Batch upload URL
+ * @param api_key: API key for X-API-Key header
+ * @param items: Files to upload
+ * @param count: Number of items (at most HTTP_BATCH_MAX_ITEMS)
+ * @return: 0 if a response was received, -1 on error
+ * 
+ * The body (Content-Type HTTP_BATCH_CONTENT_TYPE) is the items back to
+ * back, each framed with big-endian lengths:
+ *   u16 path length, path, u16 filename length, filename, u32 size, data
+ * X-Batch-Count gives the number of items. The server answers once for
+ * the whole batch; per-item results are in the response body. File data
+ * is sent with sendfile, as for single uploads.
+ */
+int http_client_post_batch(http_client_t* client, const char* url, const char* api_key,
+                           const http_batch_item_t* items, int count,
+                           http_response_t* response);
+
+/**
+ * http_client_post_pipeline - Upload several files as pipelined requests
+ * 
+ * @param client: Client handle
+ * @param url: Upload URL
+ * @param api_key: API key for X-API-Key header
+ * @param items: Files to upload, each sent as an ordinary single upload
+ * @param count: Number of items
+ * @param depth: Requests allowed in flight at once (1 disables pipelining)
+ * @param responses: Output, one per item; status_code stays 0 for items
+ *                   that got no response (free each with http_response_free)
+ * @return: Number of items that got a response
+ * 
+ * Up to depth requests are written before the first response is read, so
+ * the link does not sit idle for a round trip per file. Responses are
+ * matched to requests in order. If the server closes the connection with
+ * requests still unanswered (after a Connection: close response, or
+ * abruptly), those are sent again on a new connection; the one at the head
+ * of the line, which the server may have processed, is retried only once.
+ */
+int http_client_post_pipeline(http_client_t* client, const char* url, const char* api_key,
+                              const http_batch_item_t* items, int count, int depth,
+                              http_response_t* responses);
+
+/**
+ * http_client_get_stats - Read the client's connection counters
+ */
+void http_client_get_stats(const http_client_t* client, http_client_stats_t* stats);
+
 /**
  * http_get - Perform HTTP GET request
  * 
@@ -20,6 +234,9 @@ typedef struct http_response {
  * @param response: Output response structure
  * @return: 0 on success, -1 on error
  * 
+ * One-shot request on its own connection; use http_client_get to reuse
+ * connections.
+ * 
  * Example:
  *   http_response_t resp;
  *   if (http_get("http://192.168.1.100:8080/config", &resp) == 0) {
@@ -46,6 +263,9 @@ int http_get(const char* url, http_response_t* response);
  *   X-Filename: <basename of file_path>
  *   Content-Type: application/octet-stream
  * 
+ * One-shot request on its own connection; use http_client_post_file to
+ * reuse connections.
+ * 
  * Example:
  *   http_response_t resp;
  *   if (http_post_file("http://server/upload", "secret-key",
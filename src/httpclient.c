@@ -5,11 +5,16 @@
 #include <unistd.h>
 #include <time.h>
 #include <signal.h>
-#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/signalfd.h>
 #include "cache_io.h"
 #include "metadata_parser.h"
 #include "http_simple.h"
+#include "sync_notify.h"
+#include "logger.h"
+#include "json_scan.h"
 
 // Configuration defaults
 #define DEFAULT_SERVER_URL "http://192.168.1.100:8080/upload"
@@ -23,7 +28,9 @@
 #define DEFAULT_MAX_RETRIES 5
 #define DEFAULT_RETRY_DELAY 20
 #define DEFAULT_TIMEOUT 10
+#define DEFAULT_PIPELINE_DEPTH 4
 #define MAX_BATCH_SIZE 10  // Process up to 10 files per cycle
+#define BATCH_FILE_MAX (256 * 1024)     // Larger pages get a request of their own
 
 // Configuration structure
 typedef struct {
@@ -34,43 +41,24 @@ typedef struct {
     int max_retries;
     int retry_delay_seconds;
     int timeout_seconds;
+    bool batch_upload;
+    int pipeline_depth;
+    bool compress;
+    size_t compress_min_size;
+    char notify_socket[256];
+    log_level_t log_level;
+    size_t log_max_size;
 } config_t;
 
 // Global variables
 static volatile int keep_running = 1;
 static config_t config;
 static CacheHandle* cache = NULL;
-
-/**
- * signal_handler - Handle SIGINT/SIGTERM for clean shutdown
- */
-void signal_handler(int sig) {
-    keep_running = 0;
-}
-
-/**
- * log_msg - Write timestamped log message
- */
-void log_msg(const char* fmt, ...) {
-    FILE* f = fopen(DEFAULT_LOG_PATH, "a");
-    if (!f) return;
-
-    time_t now = time(NULL);
-    struct tm tm;
-    localtime_r(&now, &tm);
-    char timestr[20];
-    strftime(timestr, sizeof(timestr), "[%Y-%m-%d %H:%M:%S]", &tm);
-
-    fprintf(f, "%s ", timestr);
-
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(f, fmt, ap);
-    va_end(ap);
-
-    fprintf(f, "\n");
-    fclose(f);
-}
+static time_t retry_not_before = 0;  // Backoff after a failed upload
+static path_filter_t* shared_filter = NULL;     // Compiled SHARED_PATH
+static http_client_t* http = NULL;      // Keep-alive connection pool
+static char batch_url[300];             // SERVER_URL + "/batch"
+static bool batch_supported = true;     // Cleared if the server rejects batches
 
 /**
  * load_config_from_file - Load configuration from local file
@@ -84,6 +72,13 @@ void load_config_from_file() {
     config.max_retries = DEFAULT_MAX_RETRIES;
     config.retry_delay_seconds = DEFAULT_RETRY_DELAY;
     config.timeout_seconds = DEFAULT_TIMEOUT;
+    config.batch_upload = true;
+    config.pipeline_depth = DEFAULT_PIPELINE_DEPTH;
+    config.compress = false;
+    config.compress_min_size = HTTP_COMPRESS_MIN_SIZE;
+    strcpy(config.notify_socket, DEFAULT_NOTIFY_SOCKET);
+    config.log_level = LOG_LEVEL_INFO;
+    config.log_max_size = LOG_DEFAULT_MAX_SIZE;
 
     FILE* f = fopen(DEFAULT_CONFIG_PATH, "r");
     if (!f) {
@@ -121,6 +116,20 @@ void load_config_from_file() {
             config.retry_delay_seconds = atoi(val);
         } else if (strcmp(key, "TIMEOUT") == 0) {
             config.timeout_seconds = atoi(val);
+        } else if (strcmp(key, "BATCH_UPLOAD") == 0) {
+            config.batch_upload = atoi(val) != 0;
+        } else if (strcmp(key, "PIPELINE_DEPTH") == 0) {
+            config.pipeline_depth = atoi(val);
+        } else if (strcmp(key, "COMPRESS") == 0) {
+            config.compress = atoi(val) != 0;
+        } else if (strcmp(key, "COMPRESS_MIN_SIZE") == 0) {
+            config.compress_min_size = strtoul(val, NULL, 10);
+        } else if (strcmp(key, "NOTIFY_SOCKET") == 0) {
+            strncpy(config.notify_socket, val, sizeof(config.notify_socket) - 1);
+        } else if (strcmp(key, "LOG_LEVEL") == 0) {
+            config.log_level = log_level_from_string(val, LOG_LEVEL_INFO);
+        } else if (strcmp(key, "LOG_MAX_SIZE") == 0) {
+            config.log_max_size = strtoul(val, NULL, 10);
         }
     }
 
@@ -142,163 +151,517 @@ int fetch_config_from_server() {
 }
 
 /**
- * upload_file - Upload a single .rm file
+ * upload_item_t - One page ready to upload
+ */
+typedef struct {
+    const char* doc_id;                 // Document the page belongs to
+    PageEntry* page;                    // Cache entry of the page
+    char file_path[PATH_MAX];           // .rm file in the xochitl tree
+    char virtual_path[PATH_MAX];        // Virtual path including "Page N"
+    off_t size;                         // File size when prepared
+} upload_item_t;
+
+/**
+ * prepare_upload - Fill in the file and virtual paths of a page
  *
+ * @param item: Output item
  * @param doc_id: Document UUID
- * @param page_uuid: Page UUID
- * @param page_num: Page number
- * @param virtual_path: Virtual path for metadata
- * @return: 0 on success, -1 on error
+ * @param page: Page entry
+ * @param virtual_path: Virtual path of the document
+ * @return: 0 on success, -1 if the page file is missing
  */
-int upload_file(const char* doc_id, const char* page_uuid,
-               const char* page_num, const char* virtual_path) {
+static int prepare_upload(upload_item_t* item, const char* doc_id, PageEntry* page,
+                          const char* virtual_path) {
+    item->doc_id = doc_id;
+    item->page = page;
+
     // Build file path
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "%s/%s/%s.rm",
-            DEFAULT_XOCHITL_PATH, doc_id, page_uuid);
+    snprintf(item->file_path, sizeof(item->file_path), "%s/%s/%s.rm",
+            DEFAULT_XOCHITL_PATH, doc_id, page->uuid);
 
     // Check if file exists
     struct stat st;
-    if (stat(file_path, &st) != 0) {
-        log_msg("File not found: %s", file_path);
+    if (stat(item->file_path, &st) != 0) {
+        log_msg("File not found: %s", item->file_path);
         return -1;
     }
+    item->size = st.st_size;
 
     // Build complete virtual path with page
-    char full_virtual_path[PATH_MAX];
-    if (page_num && *page_num) {
-        snprintf(full_virtual_path, sizeof(full_virtual_path),
-                "%s/Page %s", virtual_path, page_num);
+    if (page->page_num[0]) {
+        snprintf(item->virtual_path, sizeof(item->virtual_path),
+                "%s/Page %s", virtual_path, page->page_num);
     } else {
-        strcpy(full_virtual_path, virtual_path);
+        snprintf(item->virtual_path, sizeof(item->virtual_path), "%s", virtual_path);
+    }
+    return 0;
+}
+
+/**
+ * upload_succeeded - Log the outcome of one upload response
+ *
+ * @return: true if the server accepted the page
+ */
+static bool upload_succeeded(const upload_item_t* item, const http_response_t* response) {
+    log_debug("Upload response: status=%d, size=%zu",
+              response->status_code, response->body_size);
+
+    if (response->status_code == 200 || response->status_code == 201) {
+        log_msg("Uploaded %s", item->virtual_path);
+        return true;
     }
 
-    log_msg("Uploading %s -> %s", file_path, full_virtual_path);
+    log_warn("Upload failed with status %d", response->status_code);
+    if (response->body) {
+        log_warn("Server error: %s", response->body);
+    }
+    return false;
+}
+
+/**
+ * upload_file - Upload a single .rm file
+ *
+ * @param item: Prepared page
+ * @return: 0 on success, -1 on error
+ */
+int upload_file(const upload_item_t* item) {
+    log_debug("Uploading %s -> %s", item->file_path, item->virtual_path);
 
     // Perform upload
     http_response_t response;
-    int result = http_post_file(config.server_url, config.api_key,
-                               file_path, full_virtual_path, &response);
+    int result = http_client_post_file(http, config.server_url, config.api_key,
+                                       item->file_path, item->virtual_path, &response);
+    if (result != 0) {
+        log_warn("Failed to connect to server");
+        return -1;
+    }
 
-    if (result == 0) {
-        log_msg("Upload response: status=%d, size=%zu",
-               response.status_code, response.body_size);
+    bool ok = upload_succeeded(item, &response);
+    http_response_free(&response);
+    return ok ? 0 : -1;
+}
 
-        if (response.status_code == 200 || response.status_code == 201) {
-            log_msg("Upload successful");
-            http_response_free(&response);
-            return 0;
-        } else {
-            log_msg("Upload failed with status %d", response.status_code);
-            if (response.body) {
-                log_msg("Server error: %s", response.body);
+/**
+ * upload_pipelined - Upload pages as pipelined requests on one connection
+ *
+ * @param items: Pages to upload
+ * @param count: Number of pages
+ * @param ok: Output per-page success flags
+ */
+static void upload_pipelined(upload_item_t* const* items, int count, bool* ok) {
+    http_batch_item_t files[MAX_BATCH_SIZE];
+    http_response_t responses[MAX_BATCH_SIZE];
+    for (int i = 0; i < count; i++) {
+        files[i].file_path = items[i]->file_path;
+        files[i].virtual_path = items[i]->virtual_path;
+        log_debug("Uploading %s -> %s", items[i]->file_path, items[i]->virtual_path);
+    }
+
+    int answered = http_client_post_pipeline(http, config.server_url, config.api_key,
+                                             files, count, config.pipeline_depth, responses);
+    if (answered < count) {
+        log_warn("No response for %d of %d pipelined uploads", count - answered, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        ok[i] = responses[i].status_code != 0 && upload_succeeded(items[i], &responses[i]);
+        http_response_free(&responses[i]);
+    }
+}
+
+/**
+ * parse_batch_results - Read per-item outcomes from a batch response
+ *
+ * @param body: Response body, {"results": [{"status": 200, ...}, ...]}
+ * @param len: Length of body
+ * @param ok: Output per-item success flags, in request order
+ * @param count: Number of items sent
+ * @return: Number of results read
+ *
+ * Items without a result count as failed.
+ */
+static int parse_batch_results(const char* body, size_t len, bool* ok, int count) {
+    for (int i = 0; i < count; i++) ok[i] = false;
+    if (!body) return 0;
+
+    json_scanner_t s;
+    json_token_t tok, key, value;
+    json_scanner_init(&s, body, len);
+    if (json_next(&s, &tok) != JSON_TOK_BEGIN_OBJECT) return 0;
+
+    while (json_next(&s, &key) == JSON_TOK_STRING) {
+        if (json_next(&s, &value) <= JSON_TOK_EOF) return 0;
+        if (value.type != JSON_TOK_BEGIN_ARRAY || !json_token_equals(&key, "results")) {
+            if (!json_skip(&s, &value)) return 0;
+            continue;
+        }
+
+        int n = 0;
+        while (json_next(&s, &tok) == JSON_TOK_BEGIN_OBJECT) {
+            while (json_next(&s, &key) == JSON_TOK_STRING) {
+                if (json_next(&s, &value) <= JSON_TOK_EOF) return n;
+                if (n < count && json_token_equals(&key, "status")) {
+                    char text[16];
+                    if (value.type == JSON_TOK_NUMBER) {
+                        int code = atoi(value.start);
+                        ok[n] = code == 200 || code == 201;
+                    } else if (value.type == JSON_TOK_STRING) {
+                        json_decode_string(&value, text, sizeof(text));
+                        ok[n] = strcmp(text, "success") == 0;
+                    }
+                } else if (!json_skip(&s, &value)) {
+                    return n;
+                }
             }
+            n++;
         }
-        http_response_free(&response);
+        return n < count ? n : count;
+    }
+    return 0;
+}
+
+/**
+ * upload_batch - Upload several prepared pages in one request
+ *
+ * @param items: Pages to upload
+ * @param count: Number of pages (2 to HTTP_BATCH_MAX_ITEMS)
+ * @param ok: Output per-page success flags
+ * @return: 0 if the server answered for the batch, 1 if it does not
+ *          support batches, -1 if the request failed
+ */
+static int upload_batch(upload_item_t* const* items, int count, bool* ok) {
+    http_batch_item_t batch[HTTP_BATCH_MAX_ITEMS];
+    for (int i = 0; i < count; i++) {
+        batch[i].file_path = items[i]->file_path;
+        batch[i].virtual_path = items[i]->virtual_path;
+        log_debug("Batching %s -> %s", items[i]->file_path, items[i]->virtual_path);
+    }
+
+    http_response_t response;
+    if (http_client_post_batch(http, batch_url, config.api_key, batch, count,
+                               &response) != 0) {
+        log_warn("Failed to connect to server");
+        return -1;
+    }
+
+    int result = 0;
+    int status = response.status_code;
+    if (status == 404 || status == 405 || status == 501) {
+        result = 1;
+    } else if (status == 200 || status == 201 || status == 207) {
+        int n = parse_batch_results(response.body, response.body_size, ok, count);
+        log_msg("Batch of %d pages: server reported %d results", count, n);
     } else {
-        log_msg("Failed to connect to server");
+        log_warn("Batch upload failed with status %d", status);
+        if (response.body) {
+            log_warn("Server error: %s", response.body);
+        }
+        result = -1;
     }
 
-    return -1;
+    http_response_free(&response);
+    return result;
+}
+
+/**
+ * record_result - Update a page's status after an upload attempt
+ *
+ * @return: true if the page was uploaded
+ */
+static bool record_result(const upload_item_t* item, bool uploaded) {
+    const char* doc_id = item->doc_id;
+    PageEntry* page = item->page;
+
+    if (uploaded) {
+        cache_update_page_status(cache, doc_id, page->uuid, SYNC_UPLOADED, 0);
+        return true;
+    }
+
+    // Failed - increment retry count
+    uint8_t new_retry_count = page->retry_count + 1;
+
+    if (new_retry_count >= config.max_retries) {
+        log_error("Page %s failed after %d attempts, marking as failed",
+                  page->uuid, new_retry_count);
+        cache_update_page_status(cache, doc_id, page->uuid,
+                               SYNC_FAILED, new_retry_count);
+    } else {
+        log_warn("Page %s failed (attempt %d/%d), will retry in %d seconds",
+                 page->uuid, new_retry_count, config.max_retries,
+                 config.retry_delay_seconds);
+        cache_update_page_status(cache, doc_id, page->uuid,
+                               SYNC_PENDING, new_retry_count);
+    }
+
+    // Back off: the rest of the batch waits for the retry timer
+    retry_not_before = time(NULL) + config.retry_delay_seconds;
+    return false;
+}
+
+/**
+ * resolve_document_path - Find a document's virtual path and SHARED_PATH verdict
+ *
+ * @param doc: Document entry
+ * @param full_path: Output virtual path (PATH_MAX bytes)
+ * @return: 1 if the document is shared, 0 if outside SHARED_PATH, -1 on error
+ */
+static int resolve_document_path(DocumentEntry* doc, char* full_path) {
+    // Virtual path: built from the IDs the watcher interned when it
+    // queued the pages, so no xochitl metadata is read here
+    if (doc->path_id != 0 &&
+        cache_build_path(cache, doc->path_id, full_path, PATH_MAX) >= 0) {
+        return path_filter_matches(shared_filter, full_path) ? 1 : 0;
+    }
+
+    // Entries from before path interning: fall back to metadata.
+    // The filter works folder by folder and needs no path string.
+    int included = metadata_path_included(doc->doc_id);
+    if (included <= 0) return included;
+
+    path_info_t path_info;
+    if (reconstruct_virtual_path(doc->doc_id, NULL, &path_info) != 0) return -1;
+    memcpy(full_path, path_info.full_path, PATH_MAX);
+    return 1;
+}
+
+/**
+ * skip_group - Mark every page of a pending group as skipped
+ */
+static void skip_group(const PendingGroup* group) {
+    for (int j = 0; j < group->count; j++) {
+        cache_update_page_status(cache, group->doc->doc_id, group->pages[j]->uuid,
+                               SYNC_SKIPPED, 0);
+    }
 }
 
 /**
  * process_pending_pages - Process pages pending upload
  *
+ * @param more_work: Set when a full batch completed and more pages may remain
  * @return: Number of pages processed
+ *
+ * The batch is grouped by document: metadata, virtual path and the
+ * SHARED_PATH check are resolved once per document. Small pages are then
+ * sent together in one batch request when the server supports it; the
+ * rest go one request per page, pipelined on a single connection.
  */
-int process_pending_pages() {
+int process_pending_pages(bool* more_work) {
+    *more_work = false;
+
     // Reload cache to get latest changes from watcher
     cache_reload(cache);
     // Get pending pages
-    PageEntry** pending = cache_get_pending_pages(cache, MAX_BATCH_SIZE);
-    if (!pending) {
+    int num_groups;
+    PendingGroup* groups = cache_get_pending_groups(cache, MAX_BATCH_SIZE, &num_groups);
+    if (!groups) {
         return 0;
     }
-    int processed = 0;
-    for (int i = 0; pending[i] != NULL; i++) {
-        PageEntry* page = pending[i];
 
-        // Find which document this page belongs to
-        const char* doc_id = cache_get_document_for_page(cache, page->uuid);
-        if (!doc_id) {
-            log_msg("Cannot find document for page %s", page->uuid);
+    static upload_item_t items[MAX_BATCH_SIZE];
+    int num_items = 0;
+    int fetched = 0;
+    int processed = 0;
+    bool backing_off = false;
+
+    for (int g = 0; g < num_groups; g++) {
+        const PendingGroup* group = &groups[g];
+        const char* doc_id = group->doc->doc_id;
+        fetched += group->count;
+        if (backing_off) continue;
+
+        char full_path[PATH_MAX];
+        int included = resolve_document_path(group->doc, full_path);
+        if (included == 0) {
+            log_debug("Document %s not under shared path '%s', skipping %d pages",
+                      doc_id, config.shared_path, group->count);
+            skip_group(group);
             continue;
         }
-
-        // Reconstruct virtual path
-        path_info_t path_info;
-        if (reconstruct_virtual_path(doc_id, page->page_num, &path_info) != 0) {
-            log_msg("Cannot reconstruct path for document %s", doc_id);
+        if (included < 0) {
+            log_warn("Cannot reconstruct path for document %s", doc_id);
             // Mark as skipped if we can't get the path
-            cache_update_page_status(cache, doc_id, page->uuid,
-                                   SYNC_SKIPPED, 0);
+            skip_group(group);
             continue;
         }
 
-        // Check if path matches filter
-        if (!is_under_shared_path(path_info.full_path, config.shared_path)) {
-            log_msg("Path '%s' not under shared path '%s', skipping",
-                   path_info.full_path, config.shared_path);
-            cache_update_page_status(cache, doc_id, page->uuid,
-                                   SYNC_SKIPPED, 0);
-            continue;
+        log_debug("Document %s: %d pending pages under '%s'", doc_id, group->count, full_path);
+
+        for (int j = 0; j < group->count && !backing_off; j++) {
+            upload_item_t* item = &items[num_items];
+            if (prepare_upload(item, doc_id, group->pages[j], full_path) != 0) {
+                backing_off = !record_result(item, false);
+                continue;
+            }
+            num_items++;
         }
+    }
 
-        // Attempt upload
-        int upload_result = upload_file(doc_id, page->uuid,
-                                       page->page_num, path_info.full_path);
+    // Split off the pages small enough to share a batch request
+    upload_item_t* batched[MAX_BATCH_SIZE];
+    upload_item_t* singles[MAX_BATCH_SIZE];
+    int num_batched = 0;
+    int num_singles = 0;
+    for (int i = 0; i < num_items; i++) {
+        bool small = items[i].size <= BATCH_FILE_MAX && num_batched < HTTP_BATCH_MAX_ITEMS;
+        if (config.batch_upload && batch_supported && small) {
+            batched[num_batched++] = &items[i];
+        } else {
+            singles[num_singles++] = &items[i];
+        }
+    }
 
-        if (upload_result == 0) {
-            // Success
-            cache_update_page_status(cache, doc_id, page->uuid,
-                                   SYNC_UPLOADED, 0);
-            processed++;
+    if (num_batched >= 2 && !backing_off) {
+        bool ok[MAX_BATCH_SIZE];
+        int rc = upload_batch(batched, num_batched, ok);
+        if (rc == 1) {
+            log_warn("Server does not support batch uploads (%s), sending pages one by one",
+                     batch_url);
+            batch_supported = false;
         } else {
-            // Failed - increment retry count
-            uint8_t new_retry_count = page->retry_count + 1;
-
-            if (new_retry_count >= config.max_retries) {
-                log_msg("Page %s failed after %d attempts, marking as failed",
-                       page->uuid, new_retry_count);
-                cache_update_page_status(cache, doc_id, page->uuid,
-                                       SYNC_FAILED, new_retry_count);
-            } else {
-                log_msg("Page %s failed (attempt %d/%d), will retry",
-                       page->uuid, new_retry_count, config.max_retries);
-                cache_update_page_status(cache, doc_id, page->uuid,
-                                       SYNC_PENDING, new_retry_count);
-
-                // Wait before next retry
-                if (i < MAX_BATCH_SIZE - 1 && pending[i + 1] != NULL) {
-                    sleep(config.retry_delay_seconds);
+            for (int i = 0; i < num_batched; i++) {
+                bool uploaded = rc == 0 && ok[i];
+                if (uploaded) log_msg("Uploaded %s", batched[i]->virtual_path);
+                if (record_result(batched[i], uploaded)) {
+                    processed++;
+                } else {
+                    backing_off = true;
                 }
             }
+            num_batched = 0;
         }
     }
 
-    free(pending);
+    // Whatever was not batched goes one request per page, pipelined on
+    // one connection when there are several
+    for (int i = 0; i < num_batched; i++) {
+        singles[num_singles++] = batched[i];
+    }
+    if (num_singles >= 2 && config.pipeline_depth > 1 && !backing_off) {
+        bool ok[MAX_BATCH_SIZE];
+        upload_pipelined(singles, num_singles, ok);
+        for (int i = 0; i < num_singles; i++) {
+            if (record_result(singles[i], ok[i])) {
+                processed++;
+            } else {
+                backing_off = true;
+            }
+        }
+        num_singles = 0;
+    }
+    for (int i = 0; i < num_singles && !backing_off; i++) {
+        if (record_result(singles[i], upload_file(singles[i]) == 0)) {
+            processed++;
+        } else {
+            backing_off = true;
+        }
+    }
+
+    // Reaching the end of a full batch means there may be more to do
+    *more_work = (fetched == MAX_BATCH_SIZE) && !backing_off;
+    free(groups);
 
-    // Save cache after processing
+    // Record our statuses without undoing what the watcher saved meanwhile
     if (processed > 0 || cache->dirty) {
-        cache_save(cache);
+        cache_save_status(cache);
     }
 
     return processed;
 }
 
+/**
+ * setup_signalfd - Route SIGINT/SIGTERM through a signalfd
+ *
+ * @return: Signal file descriptor or -1 on error
+ */
+static int setup_signalfd(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/**
+ * wait_for_work - Sleep until a watcher notification, timeout or signal
+ *
+ * @param sig_fd: Signal descriptor
+ * @param notify_fd: Wakeup channel descriptor (-1 if unavailable)
+ * @param timeout_ms: Maximum time to wait (-1 = until woken)
+ */
+static void wait_for_work(int sig_fd, int notify_fd, int timeout_ms) {
+    struct pollfd fds[2];
+    int nfds = 0;
+
+    fds[nfds].fd = sig_fd;
+    fds[nfds++].events = POLLIN;
+    if (notify_fd >= 0) {
+        fds[nfds].fd = notify_fd;
+        fds[nfds++].events = POLLIN;
+    }
+
+    int n = poll(fds, nfds, timeout_ms);
+    if (n <= 0) return;
+
+    if (fds[0].revents & POLLIN) {
+        struct signalfd_siginfo si;
+        while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+            log_msg("Received signal %u", si.ssi_signo);
+            keep_running = 0;
+        }
+    }
+    if (nfds > 1 && (fds[1].revents & POLLIN)) {
+        int wakeups = notify_drain(notify_fd);
+        log_debug("Woken by watcher (%d notifications)", wakeups);
+    }
+}
+
+/**
+ * next_timeout_ms - How long the main loop may sleep
+ *
+ * @param notify_fd: Wakeup channel descriptor (-1 if unavailable)
+ * @param more_work: Whether the last cycle left pending pages behind
+ * @return: Timeout in milliseconds, -1 to wait for a notification
+ */
+static int next_timeout_ms(int notify_fd, bool more_work) {
+    time_t now = time(NULL);
+
+    if (retry_not_before > now) {
+        return (int)(retry_not_before - now) * 1000;
+    }
+    if (more_work) {
+        return 0;
+    }
+    if (notify_fd < 0) {
+        // No wakeup channel - poll the cache periodically
+        return config.upload_interval_seconds * 1000;
+    }
+    return -1;
+}
+
 /**
  * main - Main entry point
  */
 int main(int argc, char** argv) {
-    // Setup signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    // Shutdown signals are read from a signalfd in the main loop
+    int sig_fd = setup_signalfd();
+
+    // Load configuration (messages before log_init go to stderr)
+    load_config_from_file();
+
+    if (log_init(DEFAULT_LOG_PATH, config.log_level, config.log_max_size,
+                 LOG_DEFAULT_MAX_FILES) != 0) {
+        fprintf(stderr, "Cannot open log file %s\n", DEFAULT_LOG_PATH);
+    }
 
     log_msg("=== HTTP Client started ===");
 
-    // Load configuration
-    load_config_from_file();
+    if (sig_fd < 0) {
+        log_error("Failed to set up signalfd: %s", strerror(errno));
+        log_shutdown();
+        return 1;
+    }
 
     // Try to fetch config from server (optional)
     if (fetch_config_from_server() == 0) {
@@ -311,13 +674,65 @@ int main(int argc, char** argv) {
     log_msg("  Upload interval: %d seconds", config.upload_interval_seconds);
     log_msg("  Max retries: %d", config.max_retries);
 
+    snprintf(batch_url, sizeof(batch_url), "%s/batch", config.server_url);
+    if (config.batch_upload) {
+        log_msg("  Batch uploads: %s", batch_url);
+    }
+    log_msg("  Pipeline depth: %d", config.pipeline_depth);
+    if (config.compress) {
+        log_msg("  Compression: gzip for uploads of %zu bytes or more", config.compress_min_size);
+    }
+
+    // Compile the shared-path filter once; it is evaluated per folder
+    shared_filter = path_filter_compile(config.shared_path);
+    if (!shared_filter) {
+        log_error("Invalid SHARED_PATH '%s' (at most %d patterns and %d components)",
+                  config.shared_path, PATH_FILTER_MAX_PATTERNS, PATH_FILTER_MAX_NODES - 1);
+        close(sig_fd);
+        log_shutdown();
+        return 1;
+    }
+    metadata_set_path_filter(shared_filter);
+
     // Open cache
     cache = cache_open(DEFAULT_CACHE_PATH);
     if (!cache) {
-        log_msg("ERROR: Failed to open cache");
+        log_error("Failed to open cache");
+        path_filter_free(shared_filter);
+        close(sig_fd);
+        log_shutdown();
         return 1;
     }
 
+    // Connections to the server are kept open between uploads
+    http = http_client_create(config.timeout_seconds);
+    if (!http) {
+        log_error("Failed to create HTTP client");
+        cache_close(cache, false);
+        path_filter_free(shared_filter);
+        close(sig_fd);
+        log_shutdown();
+        return 1;
+    }
+    if (config.compress) {
+        http_compression_t compression = {
+            .enabled = true,
+            .min_size = config.compress_min_size,
+            .max_percent = HTTP_COMPRESS_MAX_PERCENT,
+        };
+        http_client_set_compression(http, &compression);
+    }
+
+    // Wakeup channel from the watcher
+    int notify_fd = notify_listen(config.notify_socket);
+    if (notify_fd < 0) {
+        log_warn("Cannot listen on %s (%s), polling every %d seconds instead",
+                 config.notify_socket, strerror(errno),
+                 config.upload_interval_seconds);
+    } else {
+        log_msg("  Wakeup socket: %s", config.notify_socket);
+    }
+
     // Report cache status
     int pending = cache_count_by_status(cache, SYNC_PENDING);
     int uploaded = cache_count_by_status(cache, SYNC_UPLOADED);
@@ -329,44 +744,65 @@ int main(int argc, char** argv) {
 
     // Main loop
     int cycle = 0;
+    bool more_work = false;
     while (keep_running) {
-        cycle++;
-        log_msg("--- Sync cycle %d starting ---", cycle);
+        if (time(NULL) >= retry_not_before) {
+            cycle++;
+            log_debug("--- Sync cycle %d starting ---", cycle);
 
-        // Process pending pages
-        int processed = process_pending_pages();
+            // Process pending pages
+            int processed = process_pending_pages(&more_work);
+            pending = cache_count_by_status(cache, SYNC_PENDING);
 
-        if (processed > 0) {
-            log_msg("Processed %d pages in cycle %d", processed, cycle);
+            if (processed > 0) {
+                log_msg("Processed %d pages in cycle %d", processed, cycle);
 
-            // Update stats
-            pending = cache_count_by_status(cache, SYNC_PENDING);
-            uploaded = cache_count_by_status(cache, SYNC_UPLOADED);
-            failed = cache_count_by_status(cache, SYNC_FAILED);
+                // Update stats
+                uploaded = cache_count_by_status(cache, SYNC_UPLOADED);
+                failed = cache_count_by_status(cache, SYNC_FAILED);
 
-            log_msg("Updated cache status: %d pending, %d uploaded, %d failed",
-                   pending, uploaded, failed);
-        } else if (pending > 0) {
-            log_msg("No pages processed, but %d still pending", pending);
-        } else {
-            log_msg("No pending pages to process");
+                log_msg("Updated cache status: %d pending, %d uploaded, %d failed",
+                       pending, uploaded, failed);
+            } else if (pending > 0) {
+                log_debug("No pages processed, but %d still pending", pending);
+            } else {
+                log_debug("No pending pages to process");
+            }
         }
 
-        // Wait for next cycle
+        // Wait for the watcher, the retry timer or a signal
         if (keep_running) {
-            log_msg("Sleeping for %d seconds...", config.upload_interval_seconds);
-
-            // Use interruptible sleep
-            for (int i = 0; i < config.upload_interval_seconds && keep_running; i++) {
-                sleep(1);
-            }
+            int timeout_ms = next_timeout_ms(notify_fd, more_work);
+            log_debug("Waiting for work (timeout %d ms)", timeout_ms);
+            wait_for_work(sig_fd, notify_fd, timeout_ms);
         }
     }
 
     // Cleanup
     log_msg("Shutdown signal received, cleaning up...");
-    cache_close(cache, true);
+    notify_close(notify_fd, notify_fd >= 0 ? config.notify_socket : NULL);
+    close(sig_fd);
+    cache_save_status(cache);
+    cache_close(cache, false);
+
+    http_client_stats_t http_stats;
+    http_client_get_stats(http, &http_stats);
+    log_msg("HTTP: %lu requests over %lu connections (%lu reused, %lu pipelined, "
+            "%lu stale dropped), %lu address lookups",
+            http_stats.requests, http_stats.connects, http_stats.reused, http_stats.pipelined,
+            http_stats.stale, http_stats.resolves);
+    if (http_stats.compressed > 0) {
+        log_msg("HTTP: %lu uploads compressed, %llu bytes sent for %llu (%llu saved)",
+                http_stats.compressed, http_stats.wire_bytes, http_stats.raw_bytes,
+                http_stats.raw_bytes > http_stats.wire_bytes
+                    ? http_stats.raw_bytes - http_stats.wire_bytes : 0ULL);
+    }
+    http_client_destroy(http);
+
+    metadata_set_path_filter(NULL);
+    path_filter_free(shared_filter);
     log_msg("=== HTTP Client stopped ===");
+    log_shutdown();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,427 @@
+// json_scan.c - Allocation-free pull tokenizer for xochitl's JSON files
+//
+// The hot loops are the searches for the end of a string (quote or
+// backslash) and, when skipping nested values, for the next structural
+// character. Both compare 16 bytes at a time with NEON on the device and
+// SSE2 on x86 builds, with a scalar fallback elsewhere.
+#include <string.h>
+#include <stdint.h>
+#include "json_scan.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define JSON_SCAN_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_SCAN_SSE2 1
+#endif
+
+#if JSON_SCAN_NEON
+/**
+ * neon_first_set - Index of the first 0xFF byte in a comparison mask, or -1
+ */
+static inline int neon_first_set(uint8x16_t mask) {
+    // Narrow each byte to a nibble so the whole mask fits in 64 bits
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+    return bits ? (int)(__builtin_ctzll(bits) >> 2) : -1;
+}
+#endif
+
+/**
+ * find_string_special - First '"' or '\\' in [p, end), or end
+ */
+static const char* find_string_special(const char* p, const char* end) {
+#if JSON_SCAN_NEON
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    while (end - p >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        int i = neon_first_set(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)));
+        if (i >= 0) return p + i;
+        p += 16;
+    }
+#elif JSON_SCAN_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                  _mm_cmpeq_epi8(v, backslash)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\') p++;
+    return p;
+}
+
+/**
+ * find_structural - First '"', '{', '}', '[' or ']' in [p, end), or end
+ *
+ * '[' and ']' differ from '{' and '}' only in bit 0x20, so OR-ing that
+ * bit in lets two compares cover four characters.
+ */
+static const char* find_structural(const char* p, const char* end) {
+#if JSON_SCAN_NEON
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bit20 = vdupq_n_u8(0x20);
+    const uint8x16_t open = vdupq_n_u8('{');
+    const uint8x16_t close = vdupq_n_u8('}');
+    while (end - p >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        uint8x16_t folded = vorrq_u8(v, bit20);
+        uint8x16_t m = vorrq_u8(vceqq_u8(v, quote),
+                                vorrq_u8(vceqq_u8(folded, open), vceqq_u8(folded, close)));
+        int i = neon_first_set(m);
+        if (i >= 0) return p + i;
+        p += 16;
+    }
+#elif JSON_SCAN_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bit20 = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i folded = _mm_or_si128(v, bit20);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                 _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                                              _mm_cmpeq_epi8(folded, close)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '{' && *p != '}' && *p != '[' && *p != ']') p++;
+    return p;
+}
+
+/**
+ * skip_string_body - Advance past a string whose opening quote was consumed
+ *
+ * @param p: First byte after the opening quote
+ * @param end: End of input
+ * @param escaped: Set to true if a backslash was seen
+ * @return: Pointer to the closing quote, or NULL if unterminated
+ */
+static const char* skip_string_body(const char* p, const char* end, bool* escaped) {
+    for (;;) {
+        p = find_string_special(p, end);
+        if (p >= end) return NULL;
+        if (*p == '"') return p;
+
+        // Backslash: the next byte is escaped whatever it is
+        *escaped = true;
+        p += 2;
+        if (p > end) return NULL;
+    }
+}
+
+void json_scanner_init(json_scanner_t* s, const char* data, size_t len) {
+    s->p = data;
+    s->end = data + len;
+}
+
+json_tok_type_t json_next(json_scanner_t* s, json_token_t* tok) {
+    const char* p = s->p;
+    const char* end = s->end;
+
+    // Whitespace and separators
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ||
+                       *p == ',' || *p == ':')) {
+        p++;
+    }
+
+    tok->start = p;
+    tok->len = 0;
+    tok->escaped = false;
+
+    if (p >= end || *p == '\0') {
+        s->p = p;
+        return tok->type = JSON_TOK_EOF;
+    }
+
+    switch (*p) {
+    case '{': s->p = p + 1; tok->len = 1; return tok->type = JSON_TOK_BEGIN_OBJECT;
+    case '}': s->p = p + 1; tok->len = 1; return tok->type = JSON_TOK_END_OBJECT;
+    case '[': s->p = p + 1; tok->len = 1; return tok->type = JSON_TOK_BEGIN_ARRAY;
+    case ']': s->p = p + 1; tok->len = 1; return tok->type = JSON_TOK_END_ARRAY;
+    case '"': {
+        const char* close = skip_string_body(p + 1, end, &tok->escaped);
+        if (!close) {
+            s->p = end;
+            return tok->type = JSON_TOK_ERROR;
+        }
+        tok->start = p + 1;
+        tok->len = close - (p + 1);
+        s->p = close + 1;
+        return tok->type = JSON_TOK_STRING;
+    }
+    default:
+        break;
+    }
+
+    // Number or literal: runs until a delimiter
+    const char* q = p;
+    while (q < end && *q != ',' && *q != '}' && *q != ']' && *q != ':' &&
+           *q != ' ' && *q != '\t' && *q != '\n' && *q != '\r' && *q != '\0') {
+        q++;
+    }
+    tok->len = q - p;
+    s->p = q;
+
+    if (tok->len == 4 && memcmp(p, "true", 4) == 0) return tok->type = JSON_TOK_TRUE;
+    if (tok->len == 5 && memcmp(p, "false", 5) == 0) return tok->type = JSON_TOK_FALSE;
+    if (tok->len == 4 && memcmp(p, "null", 4) == 0) return tok->type = JSON_TOK_NULL;
+    if (*p == '-' || (*p >= '0' && *p <= '9')) return tok->type = JSON_TOK_NUMBER;
+    return tok->type = JSON_TOK_ERROR;
+}
+
+bool json_skip(json_scanner_t* s, const json_token_t* tok) {
+    if (tok->type != JSON_TOK_BEGIN_OBJECT && tok->type != JSON_TOK_BEGIN_ARRAY) {
+        return tok->type != JSON_TOK_ERROR;
+    }
+
+    int depth = 1;
+    const char* p = s->p;
+    const char* end = s->end;
+
+    while (depth > 0) {
+        p = find_structural(p, end);
+        if (p >= end) {
+            s->p = end;
+            return false;
+        }
+
+        if (*p == '"') {
+            bool escaped = false;
+            p = skip_string_body(p + 1, end, &escaped);
+            if (!p) {
+                s->p = end;
+                return false;
+            }
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else {
+            depth--;
+        }
+        p++;
+    }
+
+    s->p = p;
+    return true;
+}
+
+/**
+ * hex4 - Parse four hex digits
+ *
+ * @return: Value, or -1 if not hex
+ */
+static int hex4(const char* p) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    return v;
+}
+
+/**
+ * put_utf8 - Append a code point as UTF-8 if it fits whole
+ *
+ * @return: Bytes written (0 if it did not fit)
+ */
+static size_t put_utf8(uint32_t cp, char* out, size_t room) {
+    if (cp < 0x80) {
+        if (room < 1) return 0;
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        if (room < 2) return 0;
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        if (room < 3) return 0;
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    if (room < 4) return 0;
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/**
+ * utf8_boundary - Largest length <= len that does not split a UTF-8 sequence
+ */
+static size_t utf8_boundary(const char* s, size_t len) {
+    size_t i = len;
+    // Back up over continuation bytes to the lead byte
+    while (i > 0 && ((unsigned char)s[i - 1] & 0xC0) == 0x80) i--;
+    if (i == 0) return len;
+
+    unsigned char lead = (unsigned char)s[i - 1];
+    size_t need = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    return (len - (i - 1) >= need) ? len : i - 1;
+}
+
+size_t json_decode_string(const json_token_t* tok, char* out, size_t out_size) {
+    if (!out || out_size == 0) return 0;
+    size_t room = out_size - 1;
+    size_t n = 0;
+
+    if (!tok->escaped) {
+        size_t len = tok->len;
+        if (len > room) len = utf8_boundary(tok->start, room);
+        memcpy(out, tok->start, len);
+        out[len] = '\0';
+        return len;
+    }
+
+    const char* p = tok->start;
+    const char* end = tok->start + tok->len;
+
+    while (p < end) {
+        // Copy the run up to the next escape in one go
+        const char* bs = memchr(p, '\\', end - p);
+        const char* run_end = bs ? bs : end;
+        size_t run = run_end - p;
+        if (run > room - n) {
+            size_t fit = utf8_boundary(p, room - n);
+            memcpy(out + n, p, fit);
+            n += fit;
+            break;
+        }
+        memcpy(out + n, p, run);
+        n += run;
+        p = run_end;
+        if (p >= end) break;
+
+        // Escape sequence
+        if (p + 1 >= end) break;
+        char c = p[1];
+        uint32_t cp;
+        p += 2;
+
+        switch (c) {
+        case '"': cp = '"'; break;
+        case '\\': cp = '\\'; break;
+        case '/': cp = '/'; break;
+        case 'b': cp = '\b'; break;
+        case 'f': cp = '\f'; break;
+        case 'n': cp = '\n'; break;
+        case 'r': cp = '\r'; break;
+        case 't': cp = '\t'; break;
+        case 'u': {
+            int hi = (end - p >= 4) ? hex4(p) : -1;
+            if (hi < 0) {
+                cp = 0xFFFD;
+                break;
+            }
+            p += 4;
+            cp = (uint32_t)hi;
+
+            if (hi >= 0xD800 && hi <= 0xDBFF) {
+                // High surrogate: must be followed by \uDC00-\uDFFF
+                int lo = (end - p >= 6 && p[0] == '\\' && p[1] == 'u') ? hex4(p + 2) : -1;
+                if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                    cp = 0x10000 + (((uint32_t)hi - 0xD800) << 10) + ((uint32_t)lo - 0xDC00);
+                    p += 6;
+                } else {
+                    cp = 0xFFFD;
+                }
+            } else if (hi >= 0xDC00 && hi <= 0xDFFF) {
+                cp = 0xFFFD;    // Lone low surrogate
+            }
+            break;
+        }
+        default:
+            cp = (unsigned char)c;  // Unknown escape: keep the character
+            break;
+        }
+
+        size_t w = put_utf8(cp, out + n, room - n);
+        if (w == 0) break;
+        n += w;
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+bool json_token_equals(const json_token_t* tok, const char* literal) {
+    if (tok->type != JSON_TOK_STRING) return false;
+
+    size_t lit_len = strlen(literal);
+    if (!tok->escaped) {
+        return tok->len == lit_len && memcmp(tok->start, literal, lit_len) == 0;
+    }
+
+    // Escaped keys are rare; decode into a small buffer
+    char buf[256];
+    if (lit_len >= sizeof(buf)) return false;
+    size_t n = json_decode_string(tok, buf, sizeof(buf));
+    return n == lit_len && memcmp(buf, literal, lit_len) == 0;
+}
+
+int json_extract_fields(const char* data, size_t len, json_field_t* fields, int count) {
+    json_scanner_t s;
+    json_token_t tok;
+
+    for (int i = 0; i < count; i++) {
+        fields[i].found = false;
+        if (fields[i].out && fields[i].out_size > 0) fields[i].out[0] = '\0';
+    }
+
+    json_scanner_init(&s, data, len);
+    if (json_next(&s, &tok) != JSON_TOK_BEGIN_OBJECT) return -1;
+
+    int found = 0;
+    while (found < count) {
+        json_token_t key;
+        if (json_next(&s, &key) != JSON_TOK_STRING) break;    // '}' or malformed
+
+        json_token_t value;
+        if (json_next(&s, &value) <= JSON_TOK_EOF) break;
+
+        json_field_t* field = NULL;
+        for (int i = 0; i < count; i++) {
+            if (!fields[i].found && json_token_equals(&key, fields[i].key)) {
+                field = &fields[i];
+                break;
+            }
+        }
+
+        if (!field || value.type == JSON_TOK_BEGIN_OBJECT ||
+            value.type == JSON_TOK_BEGIN_ARRAY) {
+            if (!json_skip(&s, &value)) break;
+            continue;
+        }
+
+        if (value.type == JSON_TOK_STRING) {
+            json_decode_string(&value, field->out, field->out_size);
+        } else if (value.type == JSON_TOK_NULL) {
+            field->out[0] = '\0';
+        } else {
+            size_t n = value.len < field->out_size - 1 ? value.len : field->out_size - 1;
+            memcpy(field->out, value.start, n);
+            field->out[n] = '\0';
+        }
+        field->found = true;
+        found++;
+    }
+
+    return found;
+}
@@ -0,0 +1,123 @@
+// json_scan.h - Allocation-free pull tokenizer for xochitl's JSON files
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Token types returned by json_next
+typedef enum {
+    JSON_TOK_ERROR = -1,            // Malformed input
+    JSON_TOK_EOF = 0,               // End of input
+    JSON_TOK_BEGIN_OBJECT,
+    JSON_TOK_END_OBJECT,
+    JSON_TOK_BEGIN_ARRAY,
+    JSON_TOK_END_ARRAY,
+    JSON_TOK_STRING,
+    JSON_TOK_NUMBER,
+    JSON_TOK_TRUE,
+    JSON_TOK_FALSE,
+    JSON_TOK_NULL
+} json_tok_type_t;
+
+/**
+ * json_token_t - One token, pointing into the input buffer
+ *
+ * For strings, start/len cover the raw bytes between the quotes and
+ * escaped says whether json_decode_string is needed to read them.
+ */
+typedef struct {
+    json_tok_type_t type;
+    const char* start;
+    size_t len;
+    bool escaped;
+} json_token_t;
+
+/**
+ * json_scanner_t - Tokenizer state (the input is never copied)
+ */
+typedef struct {
+    const char* p;
+    const char* end;
+} json_scanner_t;
+
+/**
+ * json_field_t - One top-level field requested from json_extract_fields
+ */
+typedef struct {
+    const char* key;                // Field name
+    char* out;                      // Output buffer (always NUL-terminated)
+    size_t out_size;                // Size of out
+    bool found;                     // Set when the field had a scalar value
+} json_field_t;
+
+/**
+ * json_scanner_init - Start tokenizing a buffer
+ *
+ * @param s: Scanner state
+ * @param data: JSON text (need not be NUL-terminated)
+ * @param len: Length of data
+ */
+void json_scanner_init(json_scanner_t* s, const char* data, size_t len);
+
+/**
+ * json_next - Read the next token
+ *
+ * @param s: Scanner state
+ * @param tok: Output token
+ * @return: Token type (also stored in tok->type)
+ *
+ * Commas and colons are consumed silently; callers track whether a token
+ * is an object key from its position.
+ */
+json_tok_type_t json_next(json_scanner_t* s, json_token_t* tok);
+
+/**
+ * json_skip - Skip the rest of a value whose first token was just read
+ *
+ * @param s: Scanner state
+ * @param tok: Token returned by the last json_next call
+ * @return: true on success, false on malformed input
+ *
+ * Scalars need no skipping. For objects and arrays this jumps to the
+ * matching close using a vectorised search for structural characters.
+ */
+bool json_skip(json_scanner_t* s, const json_token_t* tok);
+
+/**
+ * json_decode_string - Decode a string token into UTF-8
+ *
+ * @param tok: String token
+ * @param out: Output buffer
+ * @param out_size: Size of out (including the terminator)
+ * @return: Bytes written, excluding the terminator
+ *
+ * Handles all JSON escapes, including \uXXXX and surrogate pairs. Output
+ * that does not fit is truncated on a character boundary.
+ */
+size_t json_decode_string(const json_token_t* tok, char* out, size_t out_size);
+
+/**
+ * json_token_equals - Compare a string token with a literal
+ *
+ * @param tok: String token
+ * @param literal: NUL-terminated text to compare with
+ * @return: true if the decoded token equals literal
+ */
+bool json_token_equals(const json_token_t* tok, const char* literal);
+
+/**
+ * json_extract_fields - Read selected scalar fields of a top-level object
+ *
+ * @param data: JSON text
+ * @param len: Length of data
+ * @param fields: Fields to look up; out/found are filled in
+ * @param count: Number of fields
+ * @return: Number of fields found, or -1 if data is not an object
+ *
+ * Keys inside nested values never match. Strings are decoded; numbers
+ * and booleans are copied as written; null yields an empty string.
+ */
+int json_extract_fields(const char* data, size_t len, json_field_t* fields, int count);
+
+#endif // JSON_SCAN_H
@@ -0,0 +1,427 @@
+// logger.c - Asynchronous buffered logger implementation
+//
+// Producers format messages directly into the slots of a bounded lock-free
+// ring (multi-producer, single-consumer). A background thread drains the
+// ring, prepends timestamps and writes batches to a persistent file
+// descriptor, rotating the file when it grows past the configured size.
+// Messages too long for a slot are formatted into a heap buffer that the
+// slot points to, so nothing is cut short.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "logger.h"
+
+#define LOG_RING_SLOTS 1024         // Must be a power of two
+#define LOG_MSG_MAX 224             // Longest message held in the slot itself
+#define LOG_LINE_EXTRA 40           // Prefix, level tag and newline around a message
+#define LOG_WRITE_BUF (16 * 1024)   // Writer batch size
+#define LOG_PATH_MAX 4096
+
+typedef struct {
+    atomic_size_t seq;              // Slot sequence number (ring protocol)
+    time_t when;                    // Time the message was queued
+    uint8_t level;                  // Message level
+    uint32_t len;                   // Message length
+    char* spill;                    // Longer message: heap buffer (message at
+                                    // LOG_LINE_EXTRA), NULL if it is in text
+    char text[LOG_MSG_MAX];         // Formatted message (not terminated)
+} log_slot_t;
+
+volatile int log_threshold = LOG_LEVEL_INFO;
+
+static log_slot_t ring[LOG_RING_SLOTS];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;          // Only touched by the writer thread
+static atomic_ulong dropped;
+
+static atomic_bool running;
+static atomic_bool writer_idle;
+static int wake_fd = -1;
+static pthread_t writer_thread;
+
+static int log_fd = -1;
+static char log_path[LOG_PATH_MAX];
+static size_t log_size;
+static size_t log_max_size;
+static int log_max_files;
+
+static const char* const level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+/**
+ * open_log_file - Open (or reopen) the log file for appending
+ */
+static int open_log_file(void) {
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) return -1;
+
+    struct stat st;
+    log_size = (fstat(log_fd, &st) == 0) ? (size_t)st.st_size : 0;
+    return 0;
+}
+
+/**
+ * rotate_log_file - Shift path.N-1 -> path.N ... path -> path.1 and reopen
+ */
+static void rotate_log_file(void) {
+    char from[LOG_PATH_MAX + 16];
+    char to[LOG_PATH_MAX + 16];
+
+    close(log_fd);
+    log_fd = -1;
+
+    for (int i = log_max_files - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", log_path, i);
+        snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+        rename(from, to);
+    }
+    if (log_max_files > 0) {
+        snprintf(to, sizeof(to), "%s.1", log_path);
+        rename(log_path, to);
+    } else {
+        unlink(log_path);
+    }
+
+    open_log_file();
+}
+
+/**
+ * flush_batch - Write a batch to the log file, rotating first if needed
+ */
+static void flush_batch(const char* buf, size_t len) {
+    if (len == 0) return;
+
+    if (log_fd >= 0 && log_max_size > 0 && log_size > 0 &&
+        log_size + len > log_max_size) {
+        rotate_log_file();
+    }
+    if (log_fd < 0) return;
+
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(log_fd, buf + off, len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        off += n;
+    }
+    log_size += len;
+}
+
+/**
+ * format_prefix - Build "[YYYY-mm-dd HH:MM:SS] " once per second
+ */
+static size_t format_prefix(time_t when, char* out) {
+    static time_t cached_when = (time_t)-1;
+    static char cached[24];
+    static size_t cached_len;
+
+    if (when != cached_when) {
+        struct tm tm;
+        localtime_r(&when, &tm);
+        cached_len = strftime(cached, sizeof(cached), "[%Y-%m-%d %H:%M:%S] ", &tm);
+        cached_when = when;
+    }
+    memcpy(out, cached, cached_len);
+    return cached_len;
+}
+
+/**
+ * drain_ring - Move every published slot into write batches
+ *
+ * @return: Number of messages drained
+ */
+static int drain_ring(void) {
+    static char batch[LOG_WRITE_BUF];
+    size_t used = 0;
+    int count = 0;
+
+    for (;;) {
+        log_slot_t* slot = &ring[dequeue_pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != dequeue_pos + 1) break;
+
+        // prefix + level tag + message + newline
+        size_t need = LOG_LINE_EXTRA + slot->len;
+        if (used + need > sizeof(batch)) {
+            flush_batch(batch, used);
+            used = 0;
+        }
+
+        if (need > sizeof(batch)) {
+            // Longer than a whole batch: finish the line in the message's
+            // own buffer, in front of and after the text, and write it alone
+            char head[LOG_LINE_EXTRA];
+            size_t head_len = format_prefix(slot->when, head);
+            if (slot->level != LOG_LEVEL_INFO) {
+                head_len += sprintf(head + head_len, "%s: ", level_names[slot->level]);
+            }
+            char* line = slot->spill + LOG_LINE_EXTRA - head_len;
+            memcpy(line, head, head_len);
+            slot->spill[LOG_LINE_EXTRA + slot->len] = '\n';
+            flush_batch(line, head_len + slot->len + 1);
+        } else {
+            used += format_prefix(slot->when, batch + used);
+            if (slot->level != LOG_LEVEL_INFO) {
+                used += sprintf(batch + used, "%s: ", level_names[slot->level]);
+            }
+            const char* text = slot->spill ? slot->spill + LOG_LINE_EXTRA : slot->text;
+            memcpy(batch + used, text, slot->len);
+            used += slot->len;
+            batch[used++] = '\n';
+        }
+        free(slot->spill);
+        slot->spill = NULL;
+
+        atomic_store_explicit(&slot->seq, dequeue_pos + LOG_RING_SLOTS,
+                              memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+
+    unsigned long lost = atomic_exchange(&dropped, 0);
+    if (lost > 0) {
+        if (used + 96 > sizeof(batch)) {
+            flush_batch(batch, used);
+            used = 0;
+        }
+        used += format_prefix(time(NULL), batch + used);
+        used += sprintf(batch + used, "WARN: logger dropped %lu messages (ring full)\n",
+                        lost);
+    }
+
+    flush_batch(batch, used);
+    return count;
+}
+
+/**
+ * ring_has_data - Check whether the next slot has been published
+ */
+static bool ring_has_data(void) {
+    log_slot_t* slot = &ring[dequeue_pos & (LOG_RING_SLOTS - 1)];
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) == dequeue_pos + 1;
+}
+
+/**
+ * writer_main - Background thread draining the ring
+ */
+static void* writer_main(void* arg) {
+    (void)arg;
+
+    while (atomic_load(&running)) {
+        if (drain_ring() > 0) continue;
+
+        // Announce that we are about to sleep, then re-check the ring so a
+        // producer that published before seeing the flag is not missed.
+        atomic_store(&writer_idle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (ring_has_data() || !atomic_load(&running)) {
+            atomic_store(&writer_idle, false);
+            continue;
+        }
+
+        uint64_t v;
+        if (read(wake_fd, &v, sizeof(v)) < 0 && errno != EINTR) break;
+    }
+
+    drain_ring();
+    return NULL;
+}
+
+/**
+ * wake_writer - Kick the writer thread if it is sleeping
+ */
+static void wake_writer(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&writer_idle, memory_order_relaxed) &&
+        atomic_exchange(&writer_idle, false)) {
+        uint64_t one = 1;
+        ssize_t n = write(wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+/**
+ * log_write_sync - Fallback used when the writer thread is not running
+ */
+static void log_write_sync(log_level_t level, const char* fmt, va_list ap) {
+    char prefix[24];
+    size_t plen = format_prefix(time(NULL), prefix);
+    fprintf(stderr, "%.*s", (int)plen, prefix);
+    if (level != LOG_LEVEL_INFO) {
+        fprintf(stderr, "%s: ", level_names[level]);
+    }
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+}
+
+/**
+ * truncate_message - Shorten a message that lost its full-length buffer
+ *
+ * @param text: Message formatted into a buffer that was too small
+ * @param size: Size of text
+ * @return: New length
+ *
+ * Cuts on a UTF-8 character boundary and marks the cut, so a shortened
+ * line is never mistaken for the whole message.
+ */
+static int truncate_message(char* text, size_t size) {
+    static const char marker[] = " [truncated]";
+    size_t len = size - sizeof(marker);
+    while (len > 0 && ((unsigned char)text[len] & 0xc0) == 0x80) len--;
+    memcpy(text + len, marker, sizeof(marker) - 1);
+    return (int)(len + sizeof(marker) - 1);
+}
+
+void log_write(log_level_t level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        log_write_sync(level, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    // Claim a slot (bounded MPMC ring protocol, single consumer here)
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    log_slot_t* slot;
+    for (;;) {
+        slot = &ring[pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Ring full - never block the caller
+            atomic_fetch_add(&dropped, 1);
+            va_end(ap);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+    va_end(ap);
+    if (n < 0) n = 0;
+
+    slot->spill = NULL;
+    if (n >= (int)sizeof(slot->text)) {
+        // Too long for the slot: format it again into a buffer of its own,
+        // with room for the writer to put the line prefix in front
+        slot->spill = malloc(LOG_LINE_EXTRA + (size_t)n + 1);
+        if (slot->spill) {
+            vsnprintf(slot->spill + LOG_LINE_EXTRA, (size_t)n + 1, fmt, again);
+        } else {
+            n = truncate_message(slot->text, sizeof(slot->text));
+        }
+    }
+    va_end(again);
+
+    slot->len = (uint32_t)n;
+    slot->level = (uint8_t)level;
+    slot->when = time(NULL);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    wake_writer();
+}
+
+int log_init(const char* path, log_level_t level, size_t max_size, int max_files) {
+    if (!path || atomic_load(&running)) return -1;
+
+    strncpy(log_path, path, sizeof(log_path) - 1);
+    log_path[sizeof(log_path) - 1] = '\0';
+    log_max_size = max_size;
+    log_max_files = max_files < 0 ? 0 : max_files;
+    log_set_level(level);
+
+    if (open_log_file() < 0) return -1;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++) {
+        atomic_init(&ring[i].seq, i);
+    }
+    atomic_init(&enqueue_pos, 0);
+    dequeue_pos = 0;
+    atomic_init(&dropped, 0);
+    atomic_init(&writer_idle, false);
+
+    // The writer never handles signals; leave them to the daemon's main thread
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+    atomic_store(&running, true);
+    int rc = pthread_create(&writer_thread, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (rc != 0) {
+        atomic_store(&running, false);
+        close(wake_fd);
+        close(log_fd);
+        wake_fd = log_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void log_shutdown(void) {
+    if (!atomic_load(&running)) return;
+
+    atomic_store(&running, false);
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd, &one, sizeof(one));
+    (void)n;
+    pthread_join(writer_thread, NULL);
+
+    close(wake_fd);
+    close(log_fd);
+    wake_fd = log_fd = -1;
+}
+
+void log_set_level(log_level_t level) {
+    if (level < LOG_LEVEL_DEBUG) level = LOG_LEVEL_DEBUG;
+    if (level > LOG_LEVEL_ERROR) level = LOG_LEVEL_ERROR;
+    log_threshold = level;
+}
+
+log_level_t log_level_from_string(const char* str, log_level_t fallback) {
+    if (!str) return fallback;
+
+    if (strcasecmp(str, "debug") == 0) return LOG_LEVEL_DEBUG;
+    if (strcasecmp(str, "info") == 0) return LOG_LEVEL_INFO;
+    if (strcasecmp(str, "warn") == 0 || strcasecmp(str, "warning") == 0)
+        return LOG_LEVEL_WARN;
+    if (strcasecmp(str, "error") == 0) return LOG_LEVEL_ERROR;
+
+    return fallback;
+}
@@ -0,0 +1,97 @@
+// logger.h - Asynchronous buffered logger shared by watcher and httpclient
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+
+#define LOG_DEFAULT_MAX_SIZE (1024 * 1024)  // Rotate after 1 MB
+#define LOG_DEFAULT_MAX_FILES 3             // Keep log.1 .. log.3
+
+// Log levels, lowest first
+typedef enum {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_WARN = 2,
+    LOG_LEVEL_ERROR = 3
+} log_level_t;
+
+/**
+ * log_threshold - Current minimum level that gets recorded
+ *
+ * Exposed so the log_* macros can test it inline; disabled call sites
+ * cost a single load and compare and never evaluate their arguments.
+ * Use log_set_level() to change it.
+ */
+extern volatile int log_threshold;
+
+#define LOG_ENABLED(level) ((int)(level) >= log_threshold)
+
+#define log_at(level, ...) \
+    do { if (LOG_ENABLED(level)) log_write((level), __VA_ARGS__); } while (0)
+
+// Debug is off by default, so only its call sites are hinted as cold
+#define log_debug(...) \
+    do { \
+        if (__builtin_expect(LOG_ENABLED(LOG_LEVEL_DEBUG), 0)) \
+            log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); \
+    } while (0)
+#define log_info(...)  log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// log_msg is kept as the general-purpose (INFO) entry point
+#define log_msg(...)   log_info(__VA_ARGS__)
+
+/**
+ * log_init - Open the log file and start the background writer thread
+ *
+ * @param path: Log file path (opened once with O_APPEND)
+ * @param level: Minimum level to record
+ * @param max_size: Rotate when the file grows past this many bytes (0 = never)
+ * @param max_files: Number of rotated files to keep (path.1 .. path.N)
+ * @return: 0 on success, -1 on error
+ *
+ * Messages logged before log_init (or after log_shutdown) are written
+ * synchronously to stderr.
+ */
+int log_init(const char* path, log_level_t level, size_t max_size, int max_files);
+
+/**
+ * log_shutdown - Drain all queued messages, stop the writer and close the file
+ */
+void log_shutdown(void);
+
+/**
+ * log_set_level - Change the minimum recorded level at runtime
+ *
+ * @param level: New minimum level
+ */
+void log_set_level(log_level_t level);
+
+/**
+ * log_level_from_string - Parse "debug", "info", "warn" or "error"
+ *
+ * @param str: Level name (case-insensitive)
+ * @param fallback: Level returned if str is not recognised
+ * @return: Parsed level
+ */
+log_level_t log_level_from_string(const char* str, log_level_t fallback);
+
+/**
+ * log_write - Queue a formatted message for the writer thread
+ *
+ * @param level: Message level
+ * @param fmt: printf-style format
+ *
+ * Lock-free and never blocks: the message is formatted straight into a
+ * ring slot. A message longer than a slot (deep virtual paths) is kept
+ * whole in a heap buffer the slot points to; only if that allocation
+ * fails is it cut, on a UTF-8 boundary and marked " [truncated]". If the
+ * ring is full the message is dropped and counted; the writer reports the
+ * number of dropped messages once space frees up.
+ * Prefer the log_* macros, which skip formatting for disabled levels.
+ */
+void log_write(log_level_t level, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif // LOGGER_H
@@ -1,71 +1,22 @@
 // metadata_parser.c - Reconstruct virtual paths from reMarkable metadata
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "metadata_parser.h"
 #include "cache_io.h"
+#include "json_scan.h"
 
 #define XOCHITL_PATH "/home/root/.local/share/remarkable/xochitl"
 #define MAX_PATH_DEPTH 32
-
-/**
- * read_json_value - Simple JSON parser to extract a value for a key
- * 
- * @param json: JSON string
- * @param key: Key to search for (e.g., "visibleName", "parent")
- * @param value: Output buffer for value
- * @param value_size: Size of output buffer
- * @return: true if found, false otherwise
- * 
- * Note: This is a simple parser that assumes well-formed JSON
- * and doesn't handle escaped characters in strings
- */
-static bool read_json_value(const char* json, const char* key, 
-                           char* value, size_t value_size) {
-    char search_key[256];
-    snprintf(search_key, sizeof(search_key), "\"%s\"", key);
-    
-    const char* key_pos = strstr(json, search_key);
-    if (!key_pos) return false;
-    
-    // Find the colon after the key
-    const char* colon = strchr(key_pos + strlen(search_key), ':');
-    if (!colon) return false;
-    
-    // Skip whitespace after colon
-    const char* p = colon + 1;
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
-    
-    if (*p == '"') {
-        // String value
-        p++; // Skip opening quote
-        const char* end = strchr(p, '"');
-        if (!end) return false;
-        
-        size_t len = end - p;
-        if (len >= value_size) len = value_size - 1;
-        strncpy(value, p, len);
-        value[len] = '\0';
-        return true;
-    } else if (*p == 'n' && strncmp(p, "null", 4) == 0) {
-        // Null value
-        value[0] = '\0';
-        return true;
-    } else {
-        // Number or boolean - copy until comma, }, or whitespace
-        size_t i = 0;
-        while (p[i] && p[i] != ',' && p[i] != '}' && 
-               p[i] != ' ' && p[i] != '\n' && p[i] != '\r' && 
-               i < value_size - 1) {
-            value[i] = p[i];
-            i++;
-        }
-        value[i] = '\0';
-        return i > 0;
-    }
-}
+#define META_TREE_BUCKETS 1024
+#define META_TREE_VALIDATE_MS 1000  // Trust a cached node this long without a stat
 
 /**
  * read_metadata_file - Read and parse a .metadata file
@@ -89,58 +40,337 @@ static bool read_metadata_file(const char* doc_id, metadata_info_t* info) {
     if (len == 0) return false;
     buffer[len] = '\0';
     
-    // Extract fields
+    // Extract fields (top-level keys only; escapes are decoded)
     strncpy(info->doc_id, doc_id, UUID_LEN);
     info->doc_id[UUID_LEN] = '\0';
-    
-    if (!read_json_value(buffer, "visibleName", info->visible_name, 
-                        sizeof(info->visible_name))) {
+
+    char last_modified[32];
+    char deleted[8];
+    json_field_t fields[] = {
+        { "visibleName", info->visible_name, sizeof(info->visible_name), false },
+        { "parent", info->parent, sizeof(info->parent), false },
+        { "type", info->type, sizeof(info->type), false },
+        { "lastModified", last_modified, sizeof(last_modified), false },
+        { "deleted", deleted, sizeof(deleted), false },
+    };
+    if (json_extract_fields(buffer, len, fields, 5) < 0) return false;
+
+    if (!fields[0].found) {
         strcpy(info->visible_name, "Untitled");
     }
     
-    if (!read_json_value(buffer, "parent", info->parent, sizeof(info->parent))) {
-        info->parent[0] = '\0';
-    }
-    
     // Handle "trash" as empty parent (document is in root)
     if (strcmp(info->parent, "trash") == 0) {
         info->parent[0] = '\0';
     }
     
-    read_json_value(buffer, "type", info->type, sizeof(info->type));
+    info->last_modified = fields[3].found ? strtoll(last_modified, NULL, 10) : 0;
+    info->deleted = fields[4].found && strcmp(deleted, "true") == 0;
     
     return true;
 }
 
 /**
- * build_path_recursive - Recursively build path from child to root
+ * read_document_metadata - Read and parse a document's .metadata file
  * 
- * @param doc_id: Current document/folder UUID
- * @param path_parts: Array to store path components
- * @param depth: Current recursion depth
- * @param max_depth: Maximum allowed depth
- * @return: Number of path components found
+ * @param doc_id: Document or folder UUID
+ * @param info: Output metadata info
+ * @return: true on success, false if the file is missing or empty
  */
-static int build_path_recursive(const char* doc_id, char path_parts[][256], 
-                               int depth, int max_depth) {
-    if (!doc_id || !*doc_id || depth >= max_depth) {
-        return depth;
-    }
+bool read_document_metadata(const char* doc_id, metadata_info_t* info) {
+    if (!doc_id || !info) return false;
     
+    memset(info, 0, sizeof(*info));
+    return read_metadata_file(doc_id, info);
+}
+
+/**
+ * meta_node_t - Cached metadata of one document or folder
+ *
+ * Nodes are loaded lazily and trusted for META_TREE_VALIDATE_MS; after
+ * that a stat() of the .metadata file decides whether to re-read it.
+ * Resolved paths are stamped with the tree generation, which is bumped
+ * whenever any node's name or parent changes, so renaming or moving a
+ * folder invalidates the paths of all its descendants in one step.
+ */
+typedef struct meta_node {
+    char doc_id[UUID_LEN + 1];
+    char visible_name[256];
+    char parent[UUID_LEN + 1];
+    ino_t file_ino;                 // .metadata identity when last read
+    int64_t file_mtime_ns;
+    off_t file_size;
+    uint64_t checked_ms;            // Last validation (CLOCK_MONOTONIC)
+    char* path;                     // Resolved virtual path, own name included
+    unsigned long path_generation;  // Tree generation the path was built in
+    path_filter_state_t filter_state;   // Shared-path filter state after this node
+    unsigned long filter_generation;    // Tree generation filter_state was built in
+    struct meta_node* next;         // Hash chain
+} meta_node_t;
+
+static meta_node_t* meta_tree[META_TREE_BUCKETS];
+static unsigned long meta_tree_generation = 1;
+static const path_filter_t* shared_filter = NULL;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int meta_tree_bucket(const char* doc_id) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *doc_id++)) {
+        hash = ((hash << 5) + hash) + c;
+    }
+    return hash % META_TREE_BUCKETS;
+}
+
+static meta_node_t* meta_tree_find(const char* doc_id) {
+    for (meta_node_t* node = meta_tree[meta_tree_bucket(doc_id)]; node; node = node->next) {
+        if (strcmp(node->doc_id, doc_id) == 0) return node;
+    }
+    return NULL;
+}
+
+/**
+ * meta_tree_remove - Drop a node whose .metadata is gone
+ */
+static void meta_tree_remove(meta_node_t* node) {
+    meta_node_t** link = &meta_tree[meta_tree_bucket(node->doc_id)];
+    while (*link != node) link = &(*link)->next;
+    *link = node->next;
+
+    free(node->path);
+    free(node);
+    meta_tree_generation++;
+}
+
+/**
+ * meta_tree_lookup - Get a validated node, loading it if needed
+ *
+ * @param doc_id: Document or folder UUID
+ * @return: Node or NULL if the .metadata file is missing or unreadable
+ */
+static meta_node_t* meta_tree_lookup(const char* doc_id) {
+    meta_node_t* node = meta_tree_find(doc_id);
+    uint64_t now = monotonic_ms();
+
+    if (node && now - node->checked_ms < META_TREE_VALIDATE_MS) {
+        return node;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.metadata", XOCHITL_PATH, doc_id);
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        if (node) meta_tree_remove(node);
+        return NULL;
+    }
+
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (node && node->file_ino == st.st_ino && node->file_mtime_ns == mtime_ns &&
+        node->file_size == st.st_size) {
+        node->checked_ms = now;
+        return node;
+    }
+
     metadata_info_t info;
-    if (!read_metadata_file(doc_id, &info)) {
-        return depth;
+    if (!read_document_metadata(doc_id, &info)) {
+        if (node) meta_tree_remove(node);
+        return NULL;
     }
-    
-    // Store this component's name
-    strcpy(path_parts[depth], info.visible_name);
-    
-    // If there's a parent, recurse
-    if (info.parent[0] != '\0') {
-        return build_path_recursive(info.parent, path_parts, depth + 1, max_depth);
+
+    if (!node) {
+        node = calloc(1, sizeof(*node));
+        if (!node) return NULL;
+        strncpy(node->doc_id, doc_id, UUID_LEN);
+
+        unsigned int bucket = meta_tree_bucket(node->doc_id);
+        node->next = meta_tree[bucket];
+        meta_tree[bucket] = node;
+    } else if (strcmp(node->visible_name, info.visible_name) != 0 ||
+               strcmp(node->parent, info.parent) != 0) {
+        // Renamed or moved: every path below this node is stale
+        meta_tree_generation++;
     }
-    
-    return depth + 1;
+
+    memcpy(node->visible_name, info.visible_name, sizeof(node->visible_name));
+    memcpy(node->parent, info.parent, sizeof(node->parent));
+    node->file_ino = st.st_ino;
+    node->file_mtime_ns = mtime_ns;
+    node->file_size = st.st_size;
+    node->checked_ms = now;
+    return node;
+}
+
+/**
+ * meta_tree_resolve - Resolve a node's full virtual path
+ *
+ * @param node: Node to resolve
+ * @param depth: Recursion depth (guards against parent cycles)
+ * @return: Path owned by the node (valid until the next tree change)
+ *
+ * An ancestor whose metadata cannot be read ends the path there, as
+ * reading the chain file by file always did.
+ */
+static const char* meta_tree_resolve(meta_node_t* node, int depth) {
+    if (node->path && node->path_generation == meta_tree_generation) {
+        return node->path;
+    }
+
+    const char* parent_path = NULL;
+    if (node->parent[0] != '\0' && depth < MAX_PATH_DEPTH) {
+        meta_node_t* parent = meta_tree_lookup(node->parent);
+        if (parent && parent != node) {
+            parent_path = meta_tree_resolve(parent, depth + 1);
+        }
+    }
+
+    char buf[PATH_MAX];
+    if (parent_path) {
+        snprintf(buf, sizeof(buf), "%s/%s", parent_path, node->visible_name);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", node->visible_name);
+    }
+
+    char* path = strdup(buf);
+    if (!path) return node->visible_name;
+
+    free(node->path);
+    node->path = path;
+    node->path_generation = meta_tree_generation;
+    return node->path;
+}
+
+/**
+ * meta_tree_filter - Shared-path filter state for a node's path
+ *
+ * @param node: Node to evaluate
+ * @param depth: Recursion depth (guards against parent cycles)
+ * @return: State owned by the node (valid until the next tree change)
+ *
+ * Memoized per node like the path itself. Once an ancestor's verdict is
+ * decided, descendants copy it without matching their own names, and no
+ * path string is ever built.
+ */
+static const path_filter_state_t* meta_tree_filter(meta_node_t* node, int depth) {
+    if (node->filter_generation == meta_tree_generation) {
+        return &node->filter_state;
+    }
+
+    path_filter_state_t root;
+    const path_filter_state_t* parent_state = NULL;
+    if (node->parent[0] != '\0' && depth < MAX_PATH_DEPTH) {
+        meta_node_t* parent = meta_tree_lookup(node->parent);
+        if (parent && parent != node) {
+            parent_state = meta_tree_filter(parent, depth + 1);
+        }
+    }
+    if (!parent_state) {
+        path_filter_start(shared_filter, &root);
+        parent_state = &root;
+    }
+
+    path_filter_step(shared_filter, parent_state, node->visible_name, &node->filter_state);
+    node->filter_generation = meta_tree_generation;
+    return &node->filter_state;
+}
+
+/**
+ * metadata_set_path_filter - Select the filter used by metadata_path_included
+ *
+ * @param filter: Compiled filter (NULL includes everything); must outlive its use
+ */
+void metadata_set_path_filter(const path_filter_t* filter) {
+    shared_filter = filter;
+    meta_tree_generation++;
+}
+
+/**
+ * metadata_filter_state - Shared-path filter state of a document or folder
+ *
+ * @param doc_id: Document or folder UUID
+ * @param state: Output state
+ * @return: true on success, false if its metadata is unreadable
+ */
+bool metadata_filter_state(const char* doc_id, path_filter_state_t* state) {
+    meta_node_t* node = doc_id ? meta_tree_lookup(doc_id) : NULL;
+    if (!node) return false;
+
+    if (!shared_filter) {
+        // No filter: everything is included and nothing below can change that
+        memset(state, 0, sizeof(*state));
+        state->best = -1;
+        state->decided = true;
+        return true;
+    }
+
+    *state = *meta_tree_filter(node, 0);
+    return true;
+}
+
+/**
+ * metadata_path_included - Check a document against the shared-path filter
+ *
+ * @param doc_id: Document UUID
+ * @return: 1 if included, 0 if excluded, -1 if its metadata is unreadable
+ */
+int metadata_path_included(const char* doc_id) {
+    path_filter_state_t state;
+    if (!metadata_filter_state(doc_id, &state)) return -1;
+    if (!shared_filter) return 1;
+
+    return path_filter_included(shared_filter, &state) ? 1 : 0;
+}
+
+/**
+ * metadata_path_chain - Folders and document leading to a document, root first
+ *
+ * @param doc_id: Document or folder UUID
+ * @param links: Output array
+ * @param max: Capacity of links
+ * @return: Number of links (the last is doc_id itself), or -1 if unreadable
+ *
+ * Follows the same rules as path reconstruction: the chain starts at the
+ * first ancestor whose parent is missing or unreadable.
+ */
+int metadata_path_chain(const char* doc_id, metadata_chain_link_t* links, int max) {
+    meta_node_t* node = doc_id ? meta_tree_lookup(doc_id) : NULL;
+    if (!node || max <= 0) return -1;
+
+    meta_node_t* chain[MAX_PATH_DEPTH + 1];
+    int depth = 0;
+    while (node && depth <= MAX_PATH_DEPTH && depth < max) {
+        chain[depth++] = node;
+        if (node->parent[0] == '\0') break;
+        meta_node_t* parent = meta_tree_lookup(node->parent);
+        if (parent == node) break;
+        node = parent;
+    }
+
+    for (int i = 0; i < depth; i++) {
+        const meta_node_t* n = chain[depth - 1 - i];
+        memcpy(links[i].id, n->doc_id, sizeof(links[i].id));
+        memcpy(links[i].name, n->visible_name, sizeof(links[i].name));
+    }
+    return depth;
+}
+
+/**
+ * metadata_tree_invalidate - Force a node to be re-read on its next lookup
+ *
+ * @param doc_id: Document or folder UUID whose .metadata changed
+ */
+void metadata_tree_invalidate(const char* doc_id) {
+    meta_node_t* node = doc_id ? meta_tree_find(doc_id) : NULL;
+    if (!node) return;
+
+    // Forget the file identity too, in case the change kept the same mtime
+    node->checked_ms = 0;
+    node->file_ino = 0;
 }
 
 /**
@@ -152,7 +382,9 @@ static int build_path_recursive(const char* doc_id, char path_parts[][256],
  * @return: 0 on success, -1 on error
  * 
  * This function traverses the parent chain from the document up to the root,
- * building the complete virtual path as seen in the reMarkable UI
+ * building the complete virtual path as seen in the reMarkable UI. The chain
+ * comes from the metadata tree cache, so pages of the same document (and
+ * documents sharing folders) do not re-read the same files.
  */
 int reconstruct_virtual_path(const char* doc_id, const char* page_num, 
                             path_info_t* info) {
@@ -160,38 +392,17 @@ int reconstruct_virtual_path(const char* doc_id, const char* page_num,
     
     memset(info, 0, sizeof(path_info_t));
     
-    // Read the document's metadata
-    metadata_info_t doc_meta;
-    if (!read_metadata_file(doc_id, &doc_meta)) {
+    meta_node_t* node = meta_tree_lookup(doc_id);
+    if (!node) {
         return -1;
     }
     
     // Store document name
-    strncpy(info->document_name, doc_meta.visible_name, 
+    strncpy(info->document_name, node->visible_name, 
             sizeof(info->document_name) - 1);
     
-    // Build path from document to root
-    char path_parts[MAX_PATH_DEPTH][256];
-    int num_parts = 0;
-    
-    if (doc_meta.parent[0] != '\0') {
-        num_parts = build_path_recursive(doc_meta.parent, path_parts, 0, MAX_PATH_DEPTH);
-    }
-    
-    // Construct full path (parts are in reverse order)
-    info->full_path[0] = '\0';
-    for (int i = num_parts - 1; i >= 0; i--) {
-        if (info->full_path[0] != '\0') {
-            strcat(info->full_path, "/");
-        }
-        strcat(info->full_path, path_parts[i]);
-    }
-    
-    // Add document name to path
-    if (info->full_path[0] != '\0') {
-        strcat(info->full_path, "/");
-    }
-    strcat(info->full_path, doc_meta.visible_name);
+    // Full path from root to document
+    strncpy(info->full_path, meta_tree_resolve(node, 0), sizeof(info->full_path) - 1);
     
     // Add page name if provided
     if (page_num && *page_num) {
@@ -204,288 +415,337 @@ int reconstruct_virtual_path(const char* doc_id, const char* page_num,
 }
 
 /**
- * is_under_shared_path - Check if a path matches the filter
- * 
- * @param full_path: Full virtual path to check
- * @param filter: Filter path (or "*" for all)
- * @return: true if path should be synced, false otherwise
- * 
- * Examples:
- *   filter="*" matches everything
- *   filter="Shared Vault" matches "Shared Vault/Math/Page1"
- *   filter="Work/Projects" matches "Work/Projects/Design/Draft"
+ * content_page_fn - Called for each page listed in a .content file
+ *
+ * @param id: Page UUID (points into the file buffer, not NUL-terminated)
+ * @param id_len: Length of id
+ * @param index: 0-based position of the page in the document
+ * @param ctx: Caller context
+ * @return: false to stop iterating
  */
-bool is_under_shared_path(const char* full_path, const char* filter) {
-    if (!full_path || !filter) return false;
-    
-    // "*" means sync everything
-    if (strcmp(filter, "*") == 0) {
-        return true;
-    }
-    
-    // Check if full_path starts with filter
-    size_t filter_len = strlen(filter);
-    if (strncmp(full_path, filter, filter_len) != 0) {
-        return false;
-    }
-    
-    // Make sure it's a complete path component match
-    // (so "Work" doesn't match "Workspace")
-    if (full_path[filter_len] == '\0' || full_path[filter_len] == '/') {
-        return true;
-    }
-    
-    return false;
-}
+typedef bool (*content_page_fn)(const char* id, size_t id_len, int index, void* ctx);
 
 /**
- * parse_content_file_fixed - Parse .content file to get page numbers
+ * read_content_file - Read a document's .content file into memory
  *
  * @param doc_id: Document UUID
- * @param page_uuid: Page UUID to look for
- * @param page_num: Output buffer for page number
- * @param page_num_size: Size of output buffer
- * @return: true if found, false otherwise
- *
- * The .content file contains a JSON array of pages. Each page has an ID.
- * The page number is determined by the position in the array (0-based index).
+ * @param size: Output number of bytes read
+ * @return: Buffer (release with free), or NULL if missing, empty or on error
  *
- * Example content structure:
- * {
- *   "pages": [
- *     {"id": "uuid1", ...},  // This is page 0
- *     {"id": "uuid2", ...},  // This is page 1
- *     {"id": "uuid3", ...}   // This is page 2
- *   ]
- * }
+ * Read rather than mapped: xochitl rewrites .content in place, and a file
+ * truncated under a mapping raises SIGBUS. Whatever read() returns is a
+ * consistent prefix; the tokenizer copes with a cut-off document.
  */
-bool parse_content_file(const char* doc_id, const char* page_uuid,
-    char* page_num, size_t page_num_size) {
+static char* read_content_file(const char* doc_id, size_t* size) {
     char path[PATH_MAX];
     snprintf(path, sizeof(path), "%s/%s.content", XOCHITL_PATH, doc_id);
 
-    FILE* f = fopen(path, "r");
-    if (!f) {
-        // No content file - this might be a single-page document
-        // Default to page 1
-        snprintf(page_num, page_num_size, "1");
-        return true;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
     }
 
-    // Read entire file
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    // Sized from fstat, grown if the file got longer meanwhile
+    size_t capacity = (size_t)st.st_size + 1;
+    size_t len = 0;
+    char* buf = malloc(capacity);
+    while (buf) {
+        if (len == capacity) {
+            char* grown = realloc(buf, capacity * 2);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            capacity *= 2;
+        }
 
-    if (size <= 0 || size > 1024 * 1024) { // Sanity check: max 1MB
-        fclose(f);
-        snprintf(page_num, page_num_size, "1");
-        return true;
+        ssize_t n = read(fd, buf + len, capacity - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(buf);
+            buf = NULL;
+        } else if (n == 0) {
+            break;
+        } else {
+            len += n;
+        }
     }
+    close(fd);
 
-    char* buffer = malloc(size + 1);
-    if (!buffer) {
-        fclose(f);
-        return false;
+    if (buf && len == 0) {
+        free(buf);
+        buf = NULL;
     }
+    *size = len;
+    return buf;
+}
 
-    if (fread(buffer, 1, size, f) != (size_t)size) {
-        free(buffer);
-        fclose(f);
-        return false;
+/**
+ * page_deleted - Check whether a "deleted" member marks a page as removed
+ *
+ * @param s: Scanner positioned just after the member's value token
+ * @param value: The value token
+ * @return: true if deleted
+ *
+ * cPages stores CRDT values as {"timestamp": ..., "value": N}.
+ */
+static bool page_deleted(json_scanner_t* s, const json_token_t* value) {
+    if (value->type == JSON_TOK_TRUE) return true;
+    if (value->type == JSON_TOK_NUMBER) return value->len != 1 || value->start[0] != '0';
+    if (value->type != JSON_TOK_BEGIN_OBJECT) return false;
+
+    bool deleted = false;
+    json_token_t key, inner;
+    while (json_next(s, &key) == JSON_TOK_STRING) {
+        if (json_next(s, &inner) <= JSON_TOK_EOF) break;
+        if (json_token_equals(&key, "value")) {
+            deleted = page_deleted(s, &inner);
+        } else if (!json_skip(s, &inner)) {
+            break;
+        }
     }
-    buffer[size] = '\0';
-    fclose(f);
+    return deleted;
+}
 
-    // Find the "pages" array
-    const char* pages_start = strstr(buffer, "\"pages\"");
-    if (!pages_start) {
-        // No pages array - might be an old format or single page
-        free(buffer);
-        snprintf(page_num, page_num_size, "1");
-        return true;
-    }
+/**
+ * walk_page_array - Report every entry of a "pages" array
+ *
+ * @param s: Scanner positioned just after the array's '['
+ * @param fn: Callback
+ * @param ctx: Callback context
+ * @return: Number of entries seen
+ *
+ * Entries are either page objects with an "id" field (current format) or
+ * bare UUID strings (older firmware). Page objects marked deleted keep
+ * their slot in the file but do not count towards page numbers.
+ */
+static int walk_page_array(json_scanner_t* s, content_page_fn fn, void* ctx) {
+    int index = 0;
+    json_token_t tok;
+
+    while (json_next(s, &tok) != JSON_TOK_END_ARRAY) {
+        const char* id = NULL;
+        size_t id_len = 0;
+        bool deleted = false;
+
+        if (tok.type == JSON_TOK_STRING) {
+            id = tok.start;
+            id_len = tok.len;
+        } else if (tok.type == JSON_TOK_BEGIN_OBJECT) {
+            json_token_t key, value;
+            while (json_next(s, &key) == JSON_TOK_STRING) {
+                if (json_next(s, &value) <= JSON_TOK_EOF) return index;
+                if (!id && value.type == JSON_TOK_STRING && json_token_equals(&key, "id")) {
+                    id = value.start;
+                    id_len = value.len;
+                } else if (json_token_equals(&key, "deleted")) {
+                    deleted = page_deleted(s, &value);
+                } else if (!json_skip(s, &value)) {
+                    return index;
+                }
+            }
+            if (key.type != JSON_TOK_END_OBJECT) return index;
+        } else if (tok.type <= JSON_TOK_EOF || !json_skip(s, &tok)) {
+            return index;
+        }
 
-    // Find the opening bracket of the array
-    const char* array_start = strchr(pages_start, '[');
-    if (!array_start) {
-        free(buffer);
-        snprintf(page_num, page_num_size, "1");
-        return true;
+        if (deleted) continue;
+        if (id && !fn(id, id_len, index, ctx)) return index + 1;
+        index++;
     }
 
-    // Count pages and find our UUID
-    int page_index = 0;
-    bool found = false;
-    const char* p = array_start + 1;
+    return index;
+}
+
+/**
+ * for_each_content_page - Iterate the pages of a .content buffer in order
+ *
+ * @param buffer: File contents
+ * @param size: Length of buffer
+ * @param fn: Callback
+ * @param ctx: Callback context
+ * @return: Number of pages listed, or -1 if there is no pages array
+ *
+ * Current firmware lists pages under "cPages": {"pages": [...]}, older
+ * firmware under a top-level "pages" array. Some files carry both; the
+ * one that appears first wins.
+ */
+static int for_each_content_page(const char* buffer, size_t size,
+                                 content_page_fn fn, void* ctx) {
+    json_scanner_t s;
+    json_token_t tok, key, value;
 
-    while (*p && *p != ']') {
-        // Skip whitespace
-        while (*p && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    json_scanner_init(&s, buffer, size);
+    if (json_next(&s, &tok) != JSON_TOK_BEGIN_OBJECT) return -1;
 
-        if (*p == '{') {
-            // Found a page object
-            // Look for the id field within this object
-            const char* obj_start = p;
-            int brace_count = 1;
-            const char* obj_end = p + 1;
+    while (json_next(&s, &key) == JSON_TOK_STRING) {
+        if (json_next(&s, &value) <= JSON_TOK_EOF) break;
 
-            // Find the end of this object
-            while (*obj_end && brace_count > 0) {
-                if (*obj_end == '{') brace_count++;
-                else if (*obj_end == '}') brace_count--;
-                obj_end++;
-            }
+        if (value.type == JSON_TOK_BEGIN_ARRAY && json_token_equals(&key, "pages")) {
+            return walk_page_array(&s, fn, ctx);
+        }
 
-            // Now search for our UUID within this object
-            if (obj_end > obj_start) {
-                // Create a temporary string for this object
-                size_t obj_len = obj_end - obj_start;
-                char* obj_str = malloc(obj_len + 1);
-                if (obj_str) {
-                    memcpy(obj_str, obj_start, obj_len);
-                    obj_str[obj_len] = '\0';
-
-                    // Check if this object contains our UUID
-                    if (strstr(obj_str, page_uuid)) {
-                        // Found it! The page number is the current index + 1
-                        snprintf(page_num, page_num_size, "%d", page_index + 1);
-                        found = true;
-                        free(obj_str);
-                        break;
-                    }
-                    free(obj_str);
+        if (value.type == JSON_TOK_BEGIN_OBJECT && json_token_equals(&key, "cPages")) {
+            json_token_t inner_key, inner_value;
+            while (json_next(&s, &inner_key) == JSON_TOK_STRING) {
+                if (json_next(&s, &inner_value) <= JSON_TOK_EOF) return -1;
+                if (inner_value.type == JSON_TOK_BEGIN_ARRAY &&
+                    json_token_equals(&inner_key, "pages")) {
+                    return walk_page_array(&s, fn, ctx);
                 }
+                if (!json_skip(&s, &inner_value)) return -1;
             }
-
-            // Move to the end of this object
-            p = obj_end;
-            page_index++;
-
-            // Skip comma if present
-            while (*p && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
-            if (*p == ',') p++;
-        }
-        else {
-            // Unexpected character, move forward
-            p++;
+            continue;
         }
+
+        if (!json_skip(&s, &value)) break;
     }
 
-    free(buffer);
+    return -1;
+}
 
-    if (!found) {
-        // UUID not found in pages array - default to page 1
-        snprintf(page_num, page_num_size, "1");
+// Context for parse_content_file's lookup
+typedef struct {
+    const char* page_uuid;
+    size_t uuid_len;
+    int index;
+} page_lookup_t;
+
+static bool match_page(const char* id, size_t id_len, int index, void* ctx) {
+    page_lookup_t* lookup = ctx;
+    if (id_len == lookup->uuid_len && memcmp(id, lookup->page_uuid, id_len) == 0) {
+        lookup->index = index;
+        return false;
     }
-
     return true;
 }
 
 /**
- * scan_all_document_pages - Helper to get all pages with proper numbering
+ * parse_content_file - Parse .content file to get page numbers
  *
- * This function scans a document directory and assigns page numbers
- * based on the order in the .content file
+ * @param doc_id: Document UUID
+ * @param page_uuid: Page UUID to look for
+ * @param page_num: Output buffer for page number
+ * @param page_num_size: Size of output buffer
+ * @return: true on success (page 1 is assumed when the page isn't listed),
+ *          false if the .content file is missing or unreadable (page_num
+ *          is still set to 1)
+ *
+ * The page number is the page's 1-based position in the pages array.
+ *
+ * Example content structure:
+ * {
+ *   "cPages": {
+ *     "pages": [
+ *       {"id": "uuid1", ...},  // Page 1
+ *       {"id": "uuid2", ...}   // Page 2
+ *     ]
+ *   }
+ * }
  */
-int scan_all_document_pages(const char* doc_id, CacheHandle* cache) {
-    char content_path[PATH_MAX];
-    snprintf(content_path, sizeof(content_path), "%s/%s.content",
-        XOCHITL_PATH, doc_id);
+bool parse_content_file(const char* doc_id, const char* page_uuid,
+    char* page_num, size_t page_num_size) {
+    size_t size = 0;
+    char* data = read_content_file(doc_id, &size);
 
-    FILE* f = fopen(content_path, "r");
-    if (!f) {
-        // No content file - treat as single page document
-        return 0;
+    page_lookup_t lookup = { page_uuid, strlen(page_uuid), -1 };
+    if (data) {
+        for_each_content_page(data, size, match_page, &lookup);
+        free(data);
     }
 
-    // Read entire file
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    // No content file or page not listed - default to page 1
+    snprintf(page_num, page_num_size, "%d", lookup.index >= 0 ? lookup.index + 1 : 1);
+    return data != NULL;
+}
 
-    if (size <= 0 || size > 1024 * 1024) {
-        fclose(f);
-        return 0;
+/**
+ * page_index_t - A document's page numbers, sorted by page UUID
+ */
+typedef struct {
+    char uuid[UUID_LEN];
+    int number;                     // 1-based position in the pages array
+} page_index_entry_t;
+
+struct page_index {
+    page_index_entry_t* entries;
+    int count;
+    int capacity;
+};
+
+static bool index_page(const char* id, size_t id_len, int index, void* ctx) {
+    page_index_t* pi = ctx;
+    if (id_len != UUID_LEN) return true;
+
+    if (pi->count == pi->capacity) {
+        int capacity = pi->capacity ? pi->capacity * 2 : 64;
+        page_index_entry_t* grown = realloc(pi->entries, capacity * sizeof(*grown));
+        if (!grown) return false;
+        pi->entries = grown;
+        pi->capacity = capacity;
     }
+    memcpy(pi->entries[pi->count].uuid, id, UUID_LEN);
+    pi->entries[pi->count].number = index + 1;
+    pi->count++;
+    return true;
+}
 
-    char* buffer = malloc(size + 1);
-    if (!buffer) {
-        fclose(f);
-        return 0;
-    }
+static int compare_index_entries(const void* a, const void* b) {
+    const page_index_entry_t* x = a;
+    const page_index_entry_t* y = b;
+    int c = memcmp(x->uuid, y->uuid, UUID_LEN);
+    if (c != 0) return c;
+    return x->number - y->number;
+}
 
-    if (fread(buffer, 1, size, f) != (size_t)size) {
-        free(buffer);
-        fclose(f);
-        return 0;
-    }
-    buffer[size] = '\0';
-    fclose(f);
+page_index_t* page_index_load(const char* doc_id) {
+    page_index_t* pi = calloc(1, sizeof(*pi));
+    if (!pi) return NULL;
 
-    // Parse the pages array and extract UUIDs in order
-    const char* pages_start = strstr(buffer, "\"pages\"");
-    if (!pages_start) {
-        free(buffer);
-        return 0;
-    }
-
-    const char* array_start = strchr(pages_start, '[');
-    if (!array_start) {
-        free(buffer);
-        return 0;
-    }
-
-    int page_number = 1;
-    const char* p = array_start + 1;
-
-    while (*p && *p != ']') {
-        // Look for "id" field
-        const char* id_pos = strstr(p, "\"id\"");
-        if (!id_pos) break;
-
-        // Find the colon
-        const char* colon = strchr(id_pos, ':');
-        if (!colon) break;
-
-        // Find the opening quote of the UUID
-        const char* quote1 = strchr(colon, '"');
-        if (!quote1) break;
-        quote1++;
-
-        // Find the closing quote
-        const char* quote2 = strchr(quote1, '"');
-        if (!quote2) break;
-
-        // Extract the UUID
-        size_t uuid_len = quote2 - quote1;
-        if (uuid_len == UUID_LEN) {
-            char page_uuid[UUID_LEN + 1];
-            memcpy(page_uuid, quote1, UUID_LEN);
-            page_uuid[UUID_LEN] = '\0';
-
-            // Update the cache with the page number
-            DocumentEntry* doc = cache_find_document(cache, doc_id);
-            if (doc) {
-                PageEntry* page = cache_find_page(doc, page_uuid);
-                if (page) {
-                    // Update page number
-                    snprintf(page->page_num, sizeof(page->page_num),
-                        "%d", page_number);
-                    cache->dirty = true;
-                }
-            }
+    size_t size = 0;
+    char* data = read_content_file(doc_id, &size);
+    if (data) {
+        for_each_content_page(data, size, index_page, pi);
+        free(data);
+    }
 
-            page_number++;
+    // Sort for binary search; a UUID listed twice keeps its first position,
+    // as a front-to-back lookup would find it
+    qsort(pi->entries, pi->count, sizeof(*pi->entries), compare_index_entries);
+    int kept = 0;
+    for (int i = 0; i < pi->count; i++) {
+        if (kept > 0 && memcmp(pi->entries[kept - 1].uuid, pi->entries[i].uuid,
+                               UUID_LEN) == 0) {
+            continue;
         }
+        pi->entries[kept++] = pi->entries[i];
+    }
+    pi->count = kept;
+    return pi;
+}
 
-        // Move to next object
-        p = quote2 + 1;
+int page_index_lookup(const page_index_t* index, const char* page_uuid) {
+    if (!index || strlen(page_uuid) != UUID_LEN) return 0;
 
-        // Find the next opening brace or end of array
-        while (*p && *p != '{' && *p != ']') p++;
+    int lo = 0, hi = index->count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int c = memcmp(index->entries[mid].uuid, page_uuid, UUID_LEN);
+        if (c == 0) return index->entries[mid].number;
+        if (c < 0) lo = mid + 1;
+        else hi = mid - 1;
     }
+    return 0;
+}
 
-    free(buffer);
-    return page_number - 1;
-}
\ No newline at end of file
+void page_index_free(page_index_t* index) {
+    if (!index) return;
+    free(index->entries);
+    free(index);
+}
@@ -4,6 +4,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "path_filter.h"
 
 #define UUID_LEN 36
 #define PATH_MAX 4096
@@ -16,8 +17,18 @@ typedef struct {
     char visible_name[256];         // Display name
     char parent[UUID_LEN + 1];      // Parent folder UUID (empty if root)
     char type[32];                  // Document type (DocumentType, CollectionType)
+    long long last_modified;        // lastModified in ms since epoch (0 if absent)
+    bool deleted;                   // Marked deleted by xochitl
 } metadata_info_t;
 
+/**
+ * metadata_chain_link_t - One folder or document on the way to a document
+ */
+typedef struct {
+    char id[UUID_LEN + 1];          // Folder or document UUID
+    char name[256];                 // Visible name
+} metadata_chain_link_t;
+
 /**
  * path_info_t - Complete path information for a document/page
  */
@@ -47,18 +58,68 @@ int reconstruct_virtual_path(const char* doc_id, const char* page_num,
                             path_info_t* info);
 
 /**
- * is_under_shared_path - Check if a path matches the filter
+ * read_document_metadata - Read and parse a document's .metadata file
+ * 
+ * @param doc_id: Document or folder UUID
+ * @param info: Output metadata info
+ * @return: true on success, false if the file is missing or empty
+ * 
+ * A parent of "trash" is reported as empty (root), as for path building.
+ */
+bool read_document_metadata(const char* doc_id, metadata_info_t* info);
+
+/**
+ * metadata_path_chain - Folders and document leading to a document, root first
+ * 
+ * @param doc_id: Document or folder UUID
+ * @param links: Output array
+ * @param max: Capacity of links
+ * @return: Number of links (the last is doc_id itself), or -1 if unreadable
+ * 
+ * Joining the names with '/' gives the same path as reconstruct_virtual_path.
+ */
+int metadata_path_chain(const char* doc_id, metadata_chain_link_t* links, int max);
+
+/**
+ * metadata_tree_invalidate - Force a cached document or folder to be re-read
+ * 
+ * @param doc_id: UUID whose .metadata file changed
+ * 
+ * Cached entries re-validate themselves by mtime within a second anyway;
+ * callers that see the change as it happens (the watcher) use this to
+ * make it visible immediately. If the name or parent changed, the cached
+ * paths of all descendants are invalidated with it.
+ */
+void metadata_tree_invalidate(const char* doc_id);
+
+/**
+ * metadata_set_path_filter - Select the shared-path filter
+ * 
+ * @param filter: Compiled SHARED_PATH filter, or NULL to include everything.
+ *                The caller keeps ownership; it must stay valid while set.
+ */
+void metadata_set_path_filter(const path_filter_t* filter);
+
+/**
+ * metadata_filter_state - Shared-path filter state of a document or folder
+ * 
+ * @param doc_id: Document or folder UUID
+ * @param state: Output state (see path_filter_state_equal)
+ * @return: true on success, false if its metadata is unreadable
+ */
+bool metadata_filter_state(const char* doc_id, path_filter_state_t* state);
+
+/**
+ * metadata_path_included - Check a document against the shared-path filter
  * 
- * @param full_path: Full virtual path to check
- * @param filter: Filter path (or "*" for all)
- * @return: true if path should be synced, false otherwise
+ * @param doc_id: Document UUID
+ * @return: 1 if included, 0 if excluded, -1 if its metadata is unreadable
  * 
- * Examples:
- *   is_under_shared_path("Shared Vault/Math/Page1", "*") -> true
- *   is_under_shared_path("Shared Vault/Math/Page1", "Shared Vault") -> true
- *   is_under_shared_path("Personal/Notes", "Shared Vault") -> false
+ * Evaluated folder by folder on the cached metadata tree, with each
+ * folder's match state memoized. An excluded folder decides its whole
+ * subtree at once, so documents under it never build a path string.
  */
-bool is_under_shared_path(const char* full_path, const char* filter);
+int metadata_path_included(const char* doc_id);
 
 /**
  * parse_content_file - Parse .content file to get page numbers
@@ -67,12 +128,43 @@ bool is_under_shared_path(const char* full_path, const char* filter);
  * @param page_uuid: Page UUID to look for
  * @param page_num: Output buffer for page number
  * @param page_num_size: Size of output buffer
- * @return: true if found, false otherwise
+ * @return: true on success (page 1 is assumed when the page isn't listed),
+ *          false if the .content file is missing or unreadable (page_num
+ *          is still set to 1)
  * 
- * Extracts the "idx" field from the content file which corresponds
- * to the page number shown in the reMarkable UI
+ * The page number is the page's 1-based position in the pages array,
+ * which is the number shown in the reMarkable UI
  */
 bool parse_content_file(const char* doc_id, const char* page_uuid,
                        char* page_num, size_t page_num_size);
 
+/**
+ * page_index_t - Page numbers of one document, looked up by page UUID
+ */
+typedef struct page_index page_index_t;
+
+/**
+ * page_index_load - Read a document's .content file once into a page index
+ * 
+ * @param doc_id: Document UUID
+ * @return: Index (free with page_index_free), or NULL on allocation failure.
+ *          A missing .content file gives an empty index.
+ * 
+ * For numbering many pages of one document: parse_content_file walks the
+ * file for each page, this walks it once and then answers by binary search.
+ */
+page_index_t* page_index_load(const char* doc_id);
+
+/**
+ * page_index_lookup - Page number of a page
+ * 
+ * @return: 1-based position in the pages array, 0 if the page isn't listed
+ */
+int page_index_lookup(const page_index_t* index, const char* page_uuid);
+
+/**
+ * page_index_free - Release a page index
+ */
+void page_index_free(page_index_t* index);
+
 #endif // METADATA_PARSER_H
\ No newline at end of file
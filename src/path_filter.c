@@ -0,0 +1,306 @@
+// path_filter.c - Compiled include/exclude filter over virtual path components
+//
+// All patterns are merged into one trie of path components, so patterns
+// sharing a prefix ("Work/A", "Work/B") share nodes. Matching runs the
+// trie as an NFA: the state is the set of nodes reached so far, kept as a
+// bitset, and each folder name advances every live node at once. A node
+// where a pattern ends records that pattern's priority (its position in
+// the spec). As soon as no live node can lead to a higher-priority pattern
+// than the best one already matched, the verdict is final for the subtree.
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "path_filter.h"
+
+typedef struct {
+    char* name;             // Component pattern (NULL for the root)
+    bool glob;              // Needs fnmatch rather than strcmp
+    bool any_depth;         // "**": matches zero or more components
+    int first_child;
+    int next_sibling;
+    int16_t terminal;       // Priority of the last pattern ending here, -1 if none
+    int16_t below;          // Highest terminal strictly below this node, -1 if none
+} filter_node_t;
+
+struct path_filter {
+    filter_node_t nodes[PATH_FILTER_MAX_NODES];
+    int node_count;
+    bool include[PATH_FILTER_MAX_PATTERNS];     // Per priority: include or exclude
+    int pattern_count;
+    bool default_include;   // Verdict when no pattern matches
+};
+
+static inline void set_bit(uint64_t* set, int i) { set[i >> 6] |= 1ULL << (i & 63); }
+static inline bool test_bit(const uint64_t* set, int i) { return set[i >> 6] & (1ULL << (i & 63)); }
+
+/**
+ * unescape_component - Strip backslashes from a component with no glob characters
+ */
+static void unescape_component(char* s) {
+    char* out = s;
+    for (char* p = s; *p; p++) {
+        if (*p == '\\' && p[1]) p++;
+        *out++ = *p;
+    }
+    *out = '\0';
+}
+
+/**
+ * has_glob - Check for unescaped glob metacharacters
+ */
+static bool has_glob(const char* s) {
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) {
+            s++;
+            continue;
+        }
+        if (*s == '*' || *s == '?' || *s == '[') return true;
+    }
+    return false;
+}
+
+/**
+ * find_or_add_child - Get the child of parent for one pattern component
+ *
+ * @return: Node index, or -1 if the node table is full
+ */
+static int find_or_add_child(path_filter_t* f, int parent, const char* comp, size_t len) {
+    char buf[256];
+    if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+    memcpy(buf, comp, len);
+    buf[len] = '\0';
+
+    bool any_depth = strcmp(buf, "**") == 0;
+    bool glob = !any_depth && has_glob(buf);
+    if (!glob && !any_depth) unescape_component(buf);
+
+    for (int c = f->nodes[parent].first_child; c >= 0; c = f->nodes[c].next_sibling) {
+        if (f->nodes[c].any_depth == any_depth && f->nodes[c].glob == glob &&
+            strcmp(f->nodes[c].name, buf) == 0) {
+            return c;
+        }
+    }
+
+    if (f->node_count >= PATH_FILTER_MAX_NODES) return -1;
+
+    int i = f->node_count;
+    filter_node_t* node = &f->nodes[i];
+    node->name = strdup(buf);
+    if (!node->name) return -1;
+    f->node_count++;
+
+    node->glob = glob;
+    node->any_depth = any_depth;
+    node->first_child = -1;
+    node->terminal = -1;
+    node->below = -1;
+
+    // Append so siblings keep spec order
+    int* link = &f->nodes[parent].first_child;
+    while (*link >= 0) link = &f->nodes[*link].next_sibling;
+    node->next_sibling = -1;
+    *link = i;
+    return i;
+}
+
+/**
+ * add_pattern - Insert one pattern (already trimmed, no leading '!')
+ *
+ * @return: true on success
+ */
+static bool add_pattern(path_filter_t* f, const char* pat, size_t len, bool include) {
+    if (f->pattern_count >= PATH_FILTER_MAX_PATTERNS) return false;
+
+    int node = 0;
+    size_t i = 0;
+    while (i < len) {
+        // Next component, honouring escapes; empty components are ignored
+        size_t start = i;
+        while (i < len && pat[i] != '/') {
+            if (pat[i] == '\\' && i + 1 < len) i++;
+            i++;
+        }
+        if (i > start) {
+            node = find_or_add_child(f, node, pat + start, i - start);
+            if (node < 0) return false;
+        }
+        i++;
+    }
+
+    if (node == 0) return true;     // Nothing but slashes: ignore
+
+    int prio = f->pattern_count++;
+    f->include[prio] = include;
+    f->nodes[node].terminal = prio;
+    return true;
+}
+
+/**
+ * compute_below - Fill in the highest terminal below each node
+ *
+ * Children always have higher indices than their parent, so one reverse
+ * pass sees every child before its parent.
+ */
+static void compute_below(path_filter_t* f) {
+    for (int i = f->node_count - 1; i >= 0; i--) {
+        int16_t best = -1;
+        for (int c = f->nodes[i].first_child; c >= 0; c = f->nodes[c].next_sibling) {
+            if (f->nodes[c].terminal > best) best = f->nodes[c].terminal;
+            if (f->nodes[c].below > best) best = f->nodes[c].below;
+        }
+        // "**" loops on itself, so its own terminal is reachable again below
+        if (f->nodes[i].any_depth && f->nodes[i].terminal > best) {
+            best = f->nodes[i].terminal;
+        }
+        f->nodes[i].below = best;
+    }
+}
+
+path_filter_t* path_filter_compile(const char* spec) {
+    path_filter_t* f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+
+    f->nodes[0].first_child = -1;
+    f->nodes[0].next_sibling = -1;
+    f->nodes[0].terminal = -1;
+    f->node_count = 1;
+
+    bool any_include = false;
+    const char* p = spec ? spec : "";
+    while (*p) {
+        // Split on unescaped commas
+        const char* start = p;
+        while (*p && *p != ',') {
+            if (*p == '\\' && p[1]) p++;
+            p++;
+        }
+        const char* end = p;
+        if (*p == ',') p++;
+
+        while (start < end && (*start == ' ' || *start == '\t')) start++;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+        bool include = true;
+        if (start < end && *start == '!') {
+            include = false;
+            start++;
+            while (start < end && (*start == ' ' || *start == '\t')) start++;
+        }
+        if (start == end) continue;
+
+        if (!add_pattern(f, start, end - start, include)) {
+            path_filter_free(f);
+            return NULL;
+        }
+        if (include) any_include = true;
+    }
+
+    // An empty spec syncs everything, as does a list of excludes only
+    f->default_include = !any_include;
+    compute_below(f);
+    return f;
+}
+
+void path_filter_free(path_filter_t* filter) {
+    if (!filter) return;
+    for (int i = 0; i < filter->node_count; i++) {
+        free(filter->nodes[i].name);
+    }
+    free(filter);
+}
+
+/**
+ * settle - Close the state under "**" and update best/decided
+ */
+static void settle(const path_filter_t* f, path_filter_state_t* st) {
+    // A live node makes its "**" children live too (zero-length match)
+    for (int i = 0; i < f->node_count; i++) {
+        if (!test_bit(st->active, i)) continue;
+        for (int c = f->nodes[i].first_child; c >= 0; c = f->nodes[c].next_sibling) {
+            if (f->nodes[c].any_depth) set_bit(st->active, c);
+        }
+    }
+
+    bool live = false;
+    for (int i = 0; i < f->node_count; i++) {
+        if (test_bit(st->active, i) && f->nodes[i].terminal > st->best) {
+            st->best = f->nodes[i].terminal;
+        }
+    }
+    for (int i = 0; i < f->node_count && !live; i++) {
+        if (test_bit(st->active, i) && f->nodes[i].below > st->best) live = true;
+    }
+    st->decided = !live;
+}
+
+void path_filter_start(const path_filter_t* filter, path_filter_state_t* state) {
+    memset(state, 0, sizeof(*state));
+    state->best = -1;
+    set_bit(state->active, 0);
+    settle(filter, state);
+}
+
+void path_filter_step(const path_filter_t* filter, const path_filter_state_t* parent,
+                      const char* name, path_filter_state_t* out) {
+    if (parent->decided) {
+        if (out != parent) *out = *parent;
+        return;
+    }
+
+    path_filter_state_t next;
+    memset(&next, 0, sizeof(next));
+    next.best = parent->best;
+
+    for (int i = 0; i < filter->node_count; i++) {
+        if (!test_bit(parent->active, i)) continue;
+        const filter_node_t* node = &filter->nodes[i];
+
+        if (node->any_depth) set_bit(next.active, i);
+
+        for (int c = node->first_child; c >= 0; c = filter->nodes[c].next_sibling) {
+            const filter_node_t* child = &filter->nodes[c];
+            if (child->any_depth) continue;     // Already live via settle
+            bool match = child->glob ? fnmatch(child->name, name, 0) == 0
+                                     : strcmp(child->name, name) == 0;
+            if (match) set_bit(next.active, c);
+        }
+    }
+
+    settle(filter, &next);
+    *out = next;
+}
+
+bool path_filter_included(const path_filter_t* filter, const path_filter_state_t* state) {
+    return state->best >= 0 ? filter->include[state->best] : filter->default_include;
+}
+
+bool path_filter_state_equal(const path_filter_state_t* a, const path_filter_state_t* b) {
+    return a->best == b->best && a->decided == b->decided &&
+           memcmp(a->active, b->active, sizeof(a->active)) == 0;
+}
+
+bool path_filter_matches(const path_filter_t* filter, const char* path) {
+    path_filter_state_t st;
+    path_filter_start(filter, &st);
+
+    char comp[256];
+    const char* p = path;
+    while (*p && !st.decided) {
+        const char* slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        if (len > 0) {
+            if (len >= sizeof(comp)) len = sizeof(comp) - 1;
+            memcpy(comp, p, len);
+            comp[len] = '\0';
+            path_filter_step(filter, &st, comp, &st);
+        }
+        if (!slash) break;
+        p = slash + 1;
+    }
+
+    return path_filter_included(filter, &st);
+}
+
+int path_filter_pattern_count(const path_filter_t* filter) {
+    return filter->pattern_count;
+}
@@ -0,0 +1,87 @@
+// path_filter.h - Compiled include/exclude filter over virtual path components
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PATH_FILTER_MAX_NODES 128   // Trie nodes (pattern components) per filter
+#define PATH_FILTER_MAX_PATTERNS 32 // Patterns per filter
+
+typedef struct path_filter path_filter_t;
+
+/**
+ * path_filter_state_t - Match state after some leading path components
+ *
+ * Small enough to memoize per folder. Once decided is set, no deeper
+ * component can change the verdict and stepping is a copy.
+ */
+typedef struct {
+    uint64_t active[PATH_FILTER_MAX_NODES / 64];    // Live trie nodes
+    int16_t best;                   // Last (highest priority) pattern matched, -1 if none
+    bool decided;                   // Verdict is final for the whole subtree
+} path_filter_state_t;
+
+/**
+ * path_filter_compile - Compile a SHARED_PATH specification
+ *
+ * @param spec: Comma-separated patterns, e.g. "Work, !Work/Archive"
+ * @return: Compiled filter, or NULL if the spec is too large or invalid
+ *
+ * Each pattern is a '/'-separated list of components matched one folder
+ * level at a time with fnmatch globs ('*', '?', '[...]'); "**" matches
+ * any number of levels. A pattern covers the folder it names and
+ * everything below it. A leading '!' makes it an exclude. When several
+ * patterns match, the last one listed wins; when none match, the path is
+ * excluded if there is any include pattern and included otherwise.
+ * A backslash escapes the next character (e.g. "\," for a comma in a name).
+ */
+path_filter_t* path_filter_compile(const char* spec);
+
+/**
+ * path_filter_free - Release a compiled filter
+ */
+void path_filter_free(path_filter_t* filter);
+
+/**
+ * path_filter_start - Initial state, before any path component
+ */
+void path_filter_start(const path_filter_t* filter, path_filter_state_t* state);
+
+/**
+ * path_filter_step - Advance the state by one path component
+ *
+ * @param filter: Compiled filter
+ * @param parent: State of the enclosing folder
+ * @param name: Visible name of the next folder or document
+ * @param out: Resulting state (may alias parent)
+ */
+void path_filter_step(const path_filter_t* filter, const path_filter_state_t* parent,
+                      const char* name, path_filter_state_t* out);
+
+/**
+ * path_filter_included - Verdict for the path a state was stepped through
+ */
+bool path_filter_included(const path_filter_t* filter, const path_filter_state_t* state);
+
+/**
+ * path_filter_state_equal - Check whether two states behave identically below
+ *
+ * Equal states give equal verdicts for every path under them, so a folder
+ * whose state did not change cannot have changed any descendant's verdict.
+ */
+bool path_filter_state_equal(const path_filter_state_t* a, const path_filter_state_t* b);
+
+/**
+ * path_filter_matches - Evaluate a complete '/'-separated path
+ *
+ * @return: true if the path is included
+ */
+bool path_filter_matches(const path_filter_t* filter, const char* path);
+
+/**
+ * path_filter_pattern_count - Number of patterns compiled into the filter
+ */
+int path_filter_pattern_count(const path_filter_t* filter);
+
+#endif // PATH_FILTER_H
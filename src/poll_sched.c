@@ -0,0 +1,219 @@
+// poll_sched.c - Adaptive stat-polling scheduler
+//
+// Entries live in a binary min-heap ordered by due time, with a small
+// chained hash table on the document ID for membership checks. Each entry
+// carries its own interval, so a handful of busy documents can be polled
+// every few seconds while thousands of cold ones cost almost nothing.
+#include <stdlib.h>
+#include <string.h>
+#include "poll_sched.h"
+#include "cache_io.h"
+
+#define POLL_HASH_SIZE 1024
+
+typedef struct poll_entry {
+    char doc_id[UUID_LEN + 1];
+    uint64_t due_ms;                // Next poll time
+    uint32_t interval_ms;           // Current back-off interval
+    int heap_index;                 // Position in the heap
+    struct poll_entry* next;        // Hash chain
+} poll_entry_t;
+
+static poll_entry_t** heap = NULL;
+static int heap_len = 0;
+static int heap_cap = 0;
+static poll_entry_t* buckets[POLL_HASH_SIZE];
+static uint64_t max_lateness_ms = 0;
+
+/**
+ * hash_doc_id - djb2 over the document ID
+ */
+static unsigned int hash_doc_id(const char* doc_id) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *doc_id++)) {
+        hash = ((hash << 5) + hash) + c;
+    }
+    return hash % POLL_HASH_SIZE;
+}
+
+static poll_entry_t* find_entry(const char* doc_id) {
+    for (poll_entry_t* e = buckets[hash_doc_id(doc_id)]; e; e = e->next) {
+        if (strcmp(e->doc_id, doc_id) == 0) return e;
+    }
+    return NULL;
+}
+
+static void heap_swap(int a, int b) {
+    poll_entry_t* tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    heap[a]->heap_index = a;
+    heap[b]->heap_index = b;
+}
+
+static void sift_up(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap[parent]->due_ms <= heap[i]->due_ms) break;
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(int i) {
+    for (;;) {
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int smallest = i;
+
+        if (left < heap_len && heap[left]->due_ms < heap[smallest]->due_ms)
+            smallest = left;
+        if (right < heap_len && heap[right]->due_ms < heap[smallest]->due_ms)
+            smallest = right;
+        if (smallest == i) break;
+
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * remove_entry - Unlink an entry from heap and hash table and free it
+ */
+static void remove_entry(poll_entry_t* entry) {
+    int i = entry->heap_index;
+    heap_len--;
+    if (i != heap_len) {
+        heap[i] = heap[heap_len];
+        heap[i]->heap_index = i;
+        sift_down(i);
+        sift_up(i);
+    }
+
+    poll_entry_t** link = &buckets[hash_doc_id(entry->doc_id)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+
+    free(entry);
+}
+
+bool poll_sched_add(const char* doc_id, uint64_t now_ms) {
+    if (!doc_id || find_entry(doc_id)) return false;
+
+    if (heap_len == heap_cap) {
+        int cap = heap_cap ? heap_cap * 2 : 64;
+        poll_entry_t** grown = realloc(heap, cap * sizeof(*grown));
+        if (!grown) return false;
+        heap = grown;
+        heap_cap = cap;
+    }
+
+    poll_entry_t* entry = calloc(1, sizeof(*entry));
+    if (!entry) return false;
+
+    strncpy(entry->doc_id, doc_id, UUID_LEN);
+    entry->interval_ms = POLL_MIN_INTERVAL_MS;
+    entry->due_ms = now_ms + POLL_MIN_INTERVAL_MS;
+
+    unsigned int bucket = hash_doc_id(entry->doc_id);
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+
+    entry->heap_index = heap_len;
+    heap[heap_len++] = entry;
+    sift_up(entry->heap_index);
+    return true;
+}
+
+bool poll_sched_remove(const char* doc_id) {
+    poll_entry_t* entry = doc_id ? find_entry(doc_id) : NULL;
+    if (!entry) return false;
+
+    remove_entry(entry);
+    return true;
+}
+
+bool poll_sched_contains(const char* doc_id) {
+    return doc_id && find_entry(doc_id) != NULL;
+}
+
+int poll_sched_count(void) {
+    return heap_len;
+}
+
+int poll_sched_run(uint64_t now_ms, int budget, poll_fn check) {
+    int polled = 0;
+
+    while (polled < budget && heap_len > 0 && heap[0]->due_ms <= now_ms) {
+        poll_entry_t* entry = heap[0];
+        uint64_t lateness = now_ms - entry->due_ms;
+        if (lateness > max_lateness_ms) max_lateness_ms = lateness;
+
+        poll_result_t result = check(entry->doc_id);
+        polled++;
+
+        if (result == POLL_REMOVE) {
+            remove_entry(entry);
+            continue;
+        }
+
+        if (result == POLL_ACTIVE) {
+            entry->interval_ms = POLL_MIN_INTERVAL_MS;
+        } else if (entry->interval_ms < POLL_MAX_INTERVAL_MS) {
+            entry->interval_ms *= 2;
+            if (entry->interval_ms > POLL_MAX_INTERVAL_MS)
+                entry->interval_ms = POLL_MAX_INTERVAL_MS;
+        }
+
+        entry->due_ms = now_ms + entry->interval_ms;
+        sift_down(0);
+    }
+
+    return polled;
+}
+
+int64_t poll_sched_next_delay(uint64_t now_ms) {
+    if (heap_len == 0) return -1;
+    if (heap[0]->due_ms <= now_ms) return 0;
+    return (int64_t)(heap[0]->due_ms - now_ms);
+}
+
+int poll_sched_retry(int max, bool (*try_watch)(const char* doc_id)) {
+    if (max > heap_len) max = heap_len;
+    if (max <= 0) return 0;
+
+    // Snapshot the least urgent entries (heap tail) first, since removals
+    // reshuffle the heap
+    char (*ids)[UUID_LEN + 1] = malloc(max * sizeof(*ids));
+    if (!ids) return 0;
+    for (int i = 0; i < max; i++) {
+        memcpy(ids[i], heap[heap_len - 1 - i]->doc_id, UUID_LEN + 1);
+    }
+
+    int removed = 0;
+    for (int i = 0; i < max; i++) {
+        if (try_watch(ids[i]) && poll_sched_remove(ids[i])) {
+            removed++;
+        }
+    }
+
+    free(ids);
+    return removed;
+}
+
+uint64_t poll_sched_max_lateness(void) {
+    uint64_t worst = max_lateness_ms;
+    max_lateness_ms = 0;
+    return worst;
+}
+
+void poll_sched_clear(void) {
+    for (int i = 0; i < heap_len; i++) {
+        free(heap[i]);
+    }
+    free(heap);
+    heap = NULL;
+    heap_len = heap_cap = 0;
+    memset(buckets, 0, sizeof(buckets));
+}
@@ -0,0 +1,100 @@
+// poll_sched.h - Adaptive stat-polling for directories without an inotify watch
+#ifndef POLL_SCHED_H
+#define POLL_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define POLL_MIN_INTERVAL_MS 2000       // Interval right after activity
+#define POLL_MAX_INTERVAL_MS 300000     // Interval for long-idle directories
+#define POLL_TICK_BUDGET 32             // Directories polled per timer tick
+
+// Outcome reported by the poll callback
+typedef enum {
+    POLL_IDLE = 0,      // Nothing changed: back off
+    POLL_ACTIVE = 1,    // Something changed: poll at the minimum interval again
+    POLL_REMOVE = 2     // Stop polling this directory
+} poll_result_t;
+
+/**
+ * poll_fn - Check one directory
+ *
+ * @param doc_id: Document UUID being polled
+ * @return: What happened, which decides the next interval
+ */
+typedef poll_result_t (*poll_fn)(const char* doc_id);
+
+/**
+ * poll_sched_add - Start polling a document directory
+ *
+ * @param doc_id: Document UUID
+ * @param now_ms: Current CLOCK_MONOTONIC time in ms
+ * @return: true if added, false if already polled or on allocation failure
+ *
+ * New entries start at the minimum interval.
+ */
+bool poll_sched_add(const char* doc_id, uint64_t now_ms);
+
+/**
+ * poll_sched_remove - Stop polling a document directory
+ *
+ * @param doc_id: Document UUID
+ * @return: true if it was being polled
+ */
+bool poll_sched_remove(const char* doc_id);
+
+/**
+ * poll_sched_contains - Check whether a document directory is polled
+ */
+bool poll_sched_contains(const char* doc_id);
+
+/**
+ * poll_sched_count - Number of directories currently polled
+ */
+int poll_sched_count(void);
+
+/**
+ * poll_sched_run - Poll the most overdue directories
+ *
+ * @param now_ms: Current CLOCK_MONOTONIC time in ms
+ * @param budget: Maximum number of directories to poll
+ * @param check: Callback doing the actual stat work
+ * @return: Number of directories polled
+ *
+ * Directories are served strictly in order of their due time, so one that
+ * missed its slot because the budget ran out is first in line next tick.
+ * Active directories drop to the minimum interval; idle ones double their
+ * interval up to the maximum.
+ */
+int poll_sched_run(uint64_t now_ms, int budget, poll_fn check);
+
+/**
+ * poll_sched_next_delay - Time until the next directory is due
+ *
+ * @param now_ms: Current CLOCK_MONOTONIC time in ms
+ * @return: Delay in ms (0 if something is overdue), or -1 if nothing is polled
+ */
+int64_t poll_sched_next_delay(uint64_t now_ms);
+
+/**
+ * poll_sched_retry - Offer polled directories back to a watch-adding callback
+ *
+ * @param max: Maximum number of directories to try
+ * @param try_watch: Returns true if the directory is now watched
+ * @return: Number of directories removed from the poll set
+ */
+int poll_sched_retry(int max, bool (*try_watch)(const char* doc_id));
+
+/**
+ * poll_sched_max_lateness - Worst delay between due time and poll since the last call
+ *
+ * @return: Lateness in ms
+ */
+uint64_t poll_sched_max_lateness(void);
+
+/**
+ * poll_sched_clear - Drop every entry and free the scheduler's memory
+ */
+void poll_sched_clear(void);
+
+#endif // POLL_SCHED_H
@@ -0,0 +1,69 @@
+// sync_notify.c - Unix datagram wakeup channel implementation
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sync_notify.h"
+
+/**
+ * make_addr - Fill a sockaddr_un for a filesystem path
+ *
+ * @return: 0 on success, -1 if the path is too long
+ */
+static int make_addr(const char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (!path || strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int notify_listen(const char* path) {
+    struct sockaddr_un addr;
+    if (make_addr(path, &addr) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int notify_send(const char* path) {
+    struct sockaddr_un addr;
+    if (make_addr(path, &addr) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    const char msg = 'P';
+    ssize_t n = sendto(fd, &msg, sizeof(msg), MSG_DONTWAIT,
+                       (struct sockaddr*)&addr, sizeof(addr));
+    int saved = errno;
+    close(fd);
+
+    if (n == sizeof(msg)) return 0;
+    return (saved == EAGAIN || saved == EWOULDBLOCK) ? 0 : -1;
+}
+
+int notify_drain(int fd) {
+    char buf[16];
+    int count = 0;
+
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0) {
+        count++;
+    }
+    return count;
+}
+
+void notify_close(int fd, const char* path) {
+    if (fd >= 0) close(fd);
+    if (path) unlink(path);
+}
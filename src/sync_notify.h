@@ -0,0 +1,44 @@
+// sync_notify.h - Local wakeup channel from watcher to httpclient
+#ifndef SYNC_NOTIFY_H
+#define SYNC_NOTIFY_H
+
+#define DEFAULT_NOTIFY_SOCKET "/home/root/onenote-sync/cache/.sync_notify"
+
+/**
+ * notify_listen - Bind the receiving end of the wakeup channel
+ *
+ * @param path: Filesystem path of the Unix datagram socket
+ * @return: Non-blocking socket descriptor or -1 on error
+ *
+ * A stale socket file left by a previous run is replaced.
+ */
+int notify_listen(const char* path);
+
+/**
+ * notify_send - Tell the listener that new work is available
+ *
+ * @param path: Filesystem path of the listener's socket
+ * @return: 0 if delivered, -1 if nobody is listening or on error
+ *
+ * Never blocks. Notifications are idempotent, so a full receive queue
+ * (the listener already has a wakeup pending) counts as delivered.
+ */
+int notify_send(const char* path);
+
+/**
+ * notify_drain - Consume all queued notifications
+ *
+ * @param fd: Descriptor returned by notify_listen
+ * @return: Number of notifications consumed
+ */
+int notify_drain(int fd);
+
+/**
+ * notify_close - Close the listener and remove its socket file
+ *
+ * @param fd: Descriptor returned by notify_listen
+ * @param path: Path passed to notify_listen
+ */
+void notify_close(int fd, const char* path);
+
+#endif // SYNC_NOTIFY_H
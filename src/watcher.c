@@ -11,53 +11,104 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <time.h>
 #include <errno.h>
 #include <limits.h>
-#include <stdarg.h>
 #include "cache_io.h"
 #include "metadata_parser.h"
+#include "content_hash.h"
+#include "sync_notify.h"
+#include "event_queue.h"
+#include "poll_sched.h"
+#include "logger.h"
 
 // Configuration defaults
 #define DEFAULT_WATCH_PATH "/home/root/.local/share/remarkable/xochitl"
 #define DEFAULT_LOG_PATH "/home/root/onenote-sync/logs/watcher.log"
 #define DEFAULT_CACHE_PATH "/home/root/onenote-sync/cache/.sync_cache"
 #define DEFAULT_CONFIG_PATH "/home/root/onenote-sync/watcher.conf"
+#define DEFAULT_SHARED_CONFIG_PATH "/home/root/onenote-sync/httpclient.conf"
 
-#define BUF_LEN (10 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+#define FLUSH_DELAY_MS 500           // Batch cache writes for this long after a change
+#define MAINTENANCE_INTERVAL_SEC 300 // Periodic housekeeping
+#define MAX_EPOLL_EVENTS 8
+#define RACY_WINDOW_NS 20000000LL    // Directory mtimes this fresh are not trusted
+#define RENAME_PAIR_TIMEOUT_MS 200   // Unmatched IN_MOVED_FROM counts as a removal after this
+#define MAX_PENDING_MOVES 64
+#define PAGE_NUM_TEXT_LEN 12         // Any int as decimal text
+#define POLL_BACKLOG_DELAY_MS 50     // Next poll tick when the budget ran out
+
+#define ROOT_WATCH_MASK (IN_CREATE | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+#define DOC_WATCH_MASK (IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
 
 // Global configuration
 static char watch_path[PATH_MAX] = DEFAULT_WATCH_PATH;
 static char log_path[PATH_MAX] = DEFAULT_LOG_PATH;
 static char cache_path[PATH_MAX] = DEFAULT_CACHE_PATH;
+static char notify_path[PATH_MAX] = DEFAULT_NOTIFY_SOCKET;
+static log_level_t log_level = LOG_LEVEL_INFO;
+static size_t log_max_size = LOG_DEFAULT_MAX_SIZE;
+static char shared_config_path[PATH_MAX] = DEFAULT_SHARED_CONFIG_PATH;
+static char shared_path[256] = "*";
+static path_filter_t* shared_filter = NULL;  // NULL: every document is in scope
 static CacheHandle* cache = NULL;
 
-/**
- * log_msg - Write timestamped log message
- */
-void log_msg(const char* fmt, ...) {
-    FILE* f = fopen(log_path, "a");
-    if (!f) return;
+// Event loop state
+static int flush_timer_fd = -1;
+static bool flush_armed = false;
+static bool notify_pending = false;  // Pages went PENDING since the last flush
+static bool overflow_pending = false; // Kernel dropped events, recovery needed
+static int rename_timer_fd = -1;
+static int poll_timer_fd = -1;
+static bool watch_limit_reached = false;
 
-    time_t now = time(NULL);
-    struct tm tm;
-    localtime_r(&now, &tm);
-    char timestr[20];
-    strftime(timestr, sizeof(timestr), "[%Y-%m-%d %H:%M:%S]", &tm);
+// Last metadata seen per document, to tell content edits from bookkeeping
+#define META_TABLE_SIZE 1024
+#define META_CHANGE_CONTENT 0x1      // Pages may have changed: scan
+#define META_CHANGE_PATH 0x2         // Name or parent changed: path update only
 
-    fprintf(f, "%s ", timestr);
+typedef struct meta_snapshot {
+    char doc_id[UUID_LEN + 1];
+    long long last_modified;         // lastModified (ms)
+    uint64_t path_digest;            // Digest of visibleName and parent
+    bool is_folder;
+    bool deleted;
+    bool scope_known;
+    path_filter_state_t scope;       // Shared-path filter state when last seen
+    struct meta_snapshot* next;
+} meta_snapshot_t;
 
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(f, fmt, ap);
-    va_end(ap);
+static meta_snapshot_t* meta_table[META_TABLE_SIZE];
+static unsigned long metadata_scans = 0;
+static unsigned long metadata_skipped = 0;
+static unsigned long out_of_scope_pages = 0;  // Changes recorded as SKIPPED
+static unsigned long scope_sweeps = 0;
 
-    fprintf(f, "\n");
-    fclose(f);
-}
+// inotify watches: the library root plus one per document directory
+static int inotify_fd = -1;
+static int root_wd = -1;
+static char (*watch_docs)[UUID_LEN + 1] = NULL;  // Indexed by wd, "" if unused
+static int watch_docs_cap = 0;
+static int watch_count = 0;
+
+// IN_MOVED_FROM halves waiting for their IN_MOVED_TO
+typedef struct {
+    uint32_t cookie;
+    int32_t wd;
+    bool is_dir;
+    struct timespec queued;
+    char name[NAME_MAX + 1];
+} pending_move_t;
+
+static pending_move_t pending_moves[MAX_PENDING_MOVES];
+static int pending_move_count = 0;
 
 /**
  * load_config - Load configuration from file
@@ -88,6 +139,44 @@ void load_config() {
             strncpy(log_path, val, PATH_MAX - 1);
         } else if (strcmp(key, "CACHE_PATH") == 0) {
             strncpy(cache_path, val, PATH_MAX - 1);
+        } else if (strcmp(key, "NOTIFY_SOCKET") == 0) {
+            strncpy(notify_path, val, PATH_MAX - 1);
+        } else if (strcmp(key, "LOG_LEVEL") == 0) {
+            log_level = log_level_from_string(val, LOG_LEVEL_INFO);
+        } else if (strcmp(key, "LOG_MAX_SIZE") == 0) {
+            log_max_size = strtoul(val, NULL, 10);
+        } else if (strcmp(key, "SHARED_CONFIG") == 0) {
+            strncpy(shared_config_path, val, PATH_MAX - 1);
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * load_shared_path - Read SHARED_PATH from the upload client's config
+ *
+ * The filter is defined once, in httpclient.conf, so both daemons always
+ * agree on what is in scope.
+ */
+static void load_shared_path(void) {
+    FILE* f = fopen(shared_config_path, "r");
+    if (!f) return;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        char* eq = strchr(line, '=');
+        if (!eq) continue;
+
+        *eq = '\0';
+        char* val = eq + 1;
+        while (*val == ' ' || *val == '\t') val++;
+        val[strcspn(val, "\n\r")] = '\0';
+
+        if (strcmp(line, "SHARED_PATH") == 0) {
+            strncpy(shared_path, val, sizeof(shared_path) - 1);
         }
     }
     fclose(f);
@@ -122,6 +211,172 @@ const char* extract_document_id(const char* path) {
     return NULL;
 }
 
+/**
+ * intern_chain - Intern a folder or document and its ancestors in the cache
+ *
+ * @param uuid: Folder or document UUID
+ * @return: Path node ID, or 0 if its metadata is unreadable
+ *
+ * Names come from the shared metadata tree, so this usually costs no file
+ * reads. Nodes that are already interned are only updated if their name
+ * or parent changed.
+ */
+static uint32_t intern_chain(const char* uuid) {
+    metadata_chain_link_t chain[CACHE_PATH_MAX_DEPTH];
+    int depth = metadata_path_chain(uuid, chain, CACHE_PATH_MAX_DEPTH);
+
+    uint32_t id = 0;
+    for (int i = 0; i < depth; i++) {
+        id = cache_intern_path(cache, chain[i].id, id, chain[i].name);
+        if (id == 0) return 0;
+    }
+    return id;
+}
+
+/**
+ * record_document_path - Point a document at its interned virtual path
+ *
+ * httpclient builds upload paths from these IDs instead of re-reading
+ * xochitl metadata for every page.
+ */
+static void record_document_path(const char* doc_id) {
+    DocumentEntry* doc = cache_find_document(cache, doc_id);
+    if (!doc) return;
+
+    uint32_t id = intern_chain(doc_id);
+    if (id != 0 && doc->path_id != id) {
+        doc->path_id = id;
+        cache->dirty = true;
+    }
+}
+
+/**
+ * page_numbers_t - Page numbering of the document being scanned, loaded on first use
+ *
+ * A scan only needs numbers for pages that changed, so .content is not
+ * read at all when nothing changed and read once otherwise, however many
+ * pages the document has.
+ */
+typedef struct {
+    page_index_t* index;
+    bool loaded;
+} page_numbers_t;
+
+/**
+ * lookup_page_num - Page number shown in the UI for one page
+ *
+ * @param numbers: Numbering shared by a scan, or NULL for a single page
+ */
+static void lookup_page_num(page_numbers_t* numbers, const char* doc_id,
+                            const char* page_uuid, char* out, size_t out_size) {
+    if (!numbers) {
+        parse_content_file(doc_id, page_uuid, out, out_size);
+        return;
+    }
+    if (!numbers->loaded) {
+        numbers->index = page_index_load(doc_id);
+        numbers->loaded = true;
+    }
+    int number = page_index_lookup(numbers->index, page_uuid);
+    snprintf(out, out_size, "%d", number > 0 ? number : 1);
+}
+
+/**
+ * update_page - Check one page file and mark it pending if its content changed
+ *
+ * @param doc_id: Document UUID
+ * @param page_uuid: Page UUID
+ * @param file_path: Path to the page's .rm file
+ * @param written: The caller saw the file being written, skip the mtime shortcut
+ * @param numbers: Page numbering shared across a document scan, or NULL
+ * @return: 1 if the page was marked pending, 0 otherwise
+ *
+ * A newer mtime alone is not enough: xochitl rewrites pages with identical
+ * bytes on open and sync. The page is hashed and only goes back to PENDING
+ * when the digest differs from the one stored in the cache. Cached mtimes
+ * have one-second resolution, so a page rewritten twice within a second
+ * is only caught when the caller knows it was written.
+ */
+static int update_page(const char* doc_id, const char* page_uuid,
+                       const char* file_path, bool written, page_numbers_t* numbers) {
+    struct stat st;
+    if (stat(file_path, &st) != 0) return 0;
+
+    DocumentEntry* doc = cache_find_document(cache, doc_id);
+    PageEntry* page = doc ? cache_find_page(doc, page_uuid) : NULL;
+
+    if (page && !written && page->mtime == st.st_mtime) {
+        return 0;
+    }
+
+    uint64_t hash = 0;
+    if (content_hash_file(file_path, &hash) != 0) {
+        log_warn("Cannot hash %s: %s", file_path, strerror(errno));
+    }
+
+    if (page && hash != 0 && page->content_hash == hash) {
+        // Rewritten with identical bytes - remember the new mtime only
+        if (page->mtime != st.st_mtime) {
+            page->mtime = st.st_mtime;
+            cache->dirty = true;
+        }
+        log_debug("Page %s/%s rewritten without changes", doc_id, page_uuid);
+        return 0;
+    }
+
+    // Try to get page number from content file
+    char page_num[PAGE_NUM_TEXT_LEN] = "";
+    lookup_page_num(numbers, doc_id, page_uuid, page_num, sizeof(page_num));
+
+    // Out-of-scope documents are still recorded, so moving them under the
+    // shared path later can queue them, but never enter the pending queue.
+    // Unreadable metadata (a document still being created) counts as in
+    // scope; httpclient checks again before uploading.
+    if (metadata_path_included(doc_id) == 0) {
+        cache_add_or_update_page(cache, doc_id, page_uuid, page_num,
+                                 st.st_mtime, hash, SYNC_SKIPPED);
+        log_debug("Page %s/%s changed outside the shared path", doc_id, page_uuid);
+        out_of_scope_pages++;
+        return 0;
+    }
+
+    // New or modified page - mark as pending
+    cache_add_or_update_page(cache, doc_id, page_uuid, page_num,
+                             st.st_mtime, hash, SYNC_PENDING);
+    record_document_path(doc_id);
+    log_debug("Page %s/%s marked for sync (mtime=%ld, hash=%016llx)",
+              doc_id, page_uuid, st.st_mtime, (unsigned long long)hash);
+    notify_pending = true;
+    return 1;
+}
+
+/**
+ * timespec_ns - Collapse a timestamp to nanoseconds
+ */
+static inline int64_t timespec_ns(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/**
+ * monotonic_ms - CLOCK_MONOTONIC in milliseconds
+ */
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * document_dir - Path of a document's directory under the watch path
+ *
+ * @param out: Output buffer (PATH_MAX bytes)
+ * @return: true on success, false if the path does not fit
+ */
+static bool document_dir(char* out, const char* doc_id) {
+    int n = snprintf(out, PATH_MAX, "%s/%s", watch_path, doc_id);
+    return n >= 0 && n < PATH_MAX;
+}
+
 /**
  * scan_document_pages - Scan all .rm files in a document directory
  *
@@ -130,18 +385,34 @@ const char* extract_document_id(const char* path) {
  */
 int scan_document_pages(const char* doc_id) {
     char dir_path[PATH_MAX];
-    snprintf(dir_path, sizeof(dir_path), "%s/%s", watch_path, doc_id);
+    if (!document_dir(dir_path, doc_id)) return 0;
+
+    // Fingerprint is taken before reading so a change during the scan
+    // shows up as a mismatch at the next rescan
+    struct stat dir_st;
+    if (stat(dir_path, &dir_st) != 0) {
+        log_warn("Cannot stat directory %s: %s", dir_path, strerror(errno));
+        return 0;
+    }
+    struct timespec scan_start;
+    clock_gettime(CLOCK_REALTIME, &scan_start);
 
     DIR* dir = opendir(dir_path);
     if (!dir) {
-        log_msg("Cannot open directory %s: %s", dir_path, strerror(errno));
+        log_warn("Cannot open directory %s: %s", dir_path, strerror(errno));
         return 0;
     }
 
     int pages_updated = 0;
+    uint32_t entries = 0;
     struct dirent* entry;
+    page_numbers_t numbers = { NULL, false };
 
     while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        entries++;
+
         // Look for .rm files
         char* ext = strrchr(entry->d_name, '.');
         if (!ext || strcmp(ext, ".rm") != 0) continue;
@@ -154,167 +425,1226 @@ int scan_document_pages(const char* doc_id) {
         strncpy(page_uuid, entry->d_name, UUID_LEN);
         page_uuid[UUID_LEN] = '\0';
 
-        // Get file modification time
         char file_path[PATH_MAX];
-        snprintf(file_path, sizeof(file_path), "%s/%s", dir_path, entry->d_name);
+        if (snprintf(file_path, sizeof(file_path), "%s/%s", dir_path,
+                     entry->d_name) >= (int)sizeof(file_path)) {
+            continue;
+        }
 
-        struct stat st;
-        if (stat(file_path, &st) != 0) continue;
+        pages_updated += update_page(doc_id, page_uuid, file_path, false, &numbers);
+    }
+
+    closedir(dir);
+    page_index_free(numbers.index);
 
-        // Try to get page number from content file
-        char page_num[8] = "";
-        parse_content_file(doc_id, page_uuid, page_num, sizeof(page_num));
+    // Record the directory fingerprint for rescans. If the directory
+    // changed while we were reading it, or its mtime is so recent that a
+    // later change could land in the same timestamp tick, the fingerprint
+    // is stored as unverified so the next rescan descends regardless.
+    struct stat end_st;
+    int64_t mtime_ns = timespec_ns(&dir_st.st_mtim);
+    if (stat(dir_path, &end_st) != 0 || end_st.st_ino != dir_st.st_ino ||
+        timespec_ns(&end_st.st_mtim) != mtime_ns ||
+        mtime_ns + RACY_WINDOW_NS >= timespec_ns(&scan_start)) {
+        mtime_ns = 0;
+    }
 
-        // Check if this page needs updating
-        DocumentEntry* doc = cache_find_document(cache, doc_id);
-        PageEntry* page = doc ? cache_find_page(doc, page_uuid) : NULL;
-
-        if (!page || page->mtime < st.st_mtime) {
-            // New or modified page - mark as pending
-            cache_add_or_update_page(cache, doc_id, page_uuid,
-                                   page_num, st.st_mtime, SYNC_PENDING);
-            pages_updated++;
-            log_msg("Page %s/%s marked for sync (mtime=%ld)",
-                   doc_id, page_uuid, st.st_mtime);
-        }
-        else if(page && page->sync_status == SYNC_UPLOADED && page->mtime < st.st_mtime)
-        {
-            cache_update_page_status(cache, doc_id, page_uuid, SYNC_PENDING, 0);
-            page->mtime = st.st_mtime;
-            pages_updated++;
-            log_msg("Previously uploaded page %s/%s modified, marking for re-sync",
-                doc_id, page_uuid);
-        }
+    DocumentEntry* doc = cache_add_document(cache, doc_id);
+    if (doc && (doc->dir_mtime_ns != mtime_ns || doc->dir_ino != dir_st.st_ino ||
+                doc->dir_entries != entries)) {
+        doc->dir_mtime_ns = mtime_ns;
+        doc->dir_ino = dir_st.st_ino;
+        doc->dir_entries = entries;
+        cache->dirty = true;
     }
 
-    closedir(dir);
     return pages_updated;
 }
 
 /**
- * process_metadata_change - Process a change to a .metadata file
+ * count_dir_entries - Count directory entries without stat'ing them
  *
- * @param filename: Name of the metadata file
+ * @param dir_path: Directory to count
+ * @return: Number of entries (excluding . and ..), or -1 on error
  */
-void process_metadata_change(const char* filename) {
-    // Extract document ID from filename
-    char doc_id[UUID_LEN + 1];
-    if (strlen(filename) < UUID_LEN + 9) return; // UUID + ".metadata"
+static int count_dir_entries(const char* dir_path) {
+    DIR* dir = opendir(dir_path);
+    if (!dir) return -1;
 
-    strncpy(doc_id, filename, UUID_LEN);
-    doc_id[UUID_LEN] = '\0';
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            count++;
+    }
 
-    log_msg("Processing metadata change for document %s", doc_id);
+    closedir(dir);
+    return count;
+}
 
-    // Scan all pages in this document
-    int pages_updated = scan_document_pages(doc_id);
+/**
+ * dir_unchanged - Check a document directory against its stored fingerprint
+ *
+ * @param doc: Cache entry for the document (may be NULL)
+ * @param st: Fresh stat of the document directory
+ * @param dir_path: Directory path, only read on coarse-timestamp filesystems
+ * @return: true if the directory has not changed since its last scan
+ *
+ * Inode and nanosecond mtime decide on their own: every create, unlink or
+ * rename inside the directory bumps its mtime, and xochitl replaces page
+ * files by rename. Only when the filesystem has no sub-second timestamps
+ * is the entry count read as a tie-breaker.
+ */
+static bool dir_unchanged(const DocumentEntry* doc, const struct stat* st,
+                          const char* dir_path) {
+    if (!doc || doc->dir_ino == 0 || doc->dir_mtime_ns == 0) return false;
+    if (doc->dir_ino != (uint64_t)st->st_ino) return false;
+    if (doc->dir_mtime_ns != timespec_ns(&st->st_mtim)) return false;
 
-    if (pages_updated > 0) {
-        log_msg("Updated %d pages for document %s", pages_updated, doc_id);
-        cache_save(cache);
+    if (st->st_mtim.tv_nsec == 0) {
+        return (int)doc->dir_entries == count_dir_entries(dir_path);
     }
+    return true;
 }
 
 /**
- * main - Main entry point
+ * rescan_library - Rescan document directories changed since their last scan
+ *
+ * @param reason: Label for the summary log line
+ * @param include_unknown: Also scan documents the cache has never seen
+ * @return: Number of documents rescanned
+ *
+ * Costs one stat per document; only directories whose fingerprint differs
+ * are opened. After an inotify overflow every document must be considered,
+ * including ones created during the lost events. At startup only documents
+ * already tracked are caught up, so a fresh install does not queue the
+ * whole library for upload.
  */
-int main(int argc, char** argv) {
-    // Load configuration
-    load_config();
+static int rescan_library(const char* reason, bool include_unknown) {
+    DIR* root = opendir(watch_path);
+    if (!root) {
+        log_error("%s: cannot open %s: %s", reason, watch_path, strerror(errno));
+        return 0;
+    }
 
-    // Override watch path if provided as argument
-    if (argc > 1) {
-        strncpy(watch_path, argv[1], PATH_MAX - 1);
-        watch_path[PATH_MAX - 1] = '\0';
+    int checked = 0;
+    int rescanned = 0;
+    int pages_updated = 0;
+    struct dirent* entry;
+
+    while ((entry = readdir(root)) != NULL) {
+        // Document directories are named by bare UUID
+        if (strlen(entry->d_name) != UUID_LEN || !extract_document_id(entry->d_name))
+            continue;
+        if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+            continue;
+
+        DocumentEntry* doc = cache_find_document(cache, entry->d_name);
+        if (!doc && !include_unknown) continue;
+
+        char dir_path[PATH_MAX];
+        if (!document_dir(dir_path, entry->d_name)) continue;
+
+        struct stat st;
+        if (stat(dir_path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        checked++;
+
+        if (dir_unchanged(doc, &st, dir_path)) continue;
+
+        rescanned++;
+        pages_updated += scan_document_pages(entry->d_name);
     }
 
-    log_msg("=== Watcher started ===");
-    log_msg("Watch path: %s", watch_path);
-    log_msg("Cache path: %s", cache_path);
-    log_msg("Log path: %s", log_path);
+    closedir(root);
 
-    // Open cache
-    cache = cache_open(cache_path);
-    if (!cache) {
-        log_msg("ERROR: Failed to open cache");
-        return 1;
+    log_msg("%s: checked %d documents, rescanned %d, %d pages updated",
+            reason, checked, rescanned, pages_updated);
+    return rescanned;
+}
+
+/**
+ * arm_timer - Arm a timerfd
+ *
+ * @param tfd: Timer file descriptor
+ * @param delay_ms: Delay before first expiry (0 disarms the timer)
+ * @param interval_ms: Period after the first expiry (0 for one-shot)
+ * @return: 0 on success, -1 on error
+ */
+static int arm_timer(int tfd, long delay_ms, long interval_ms) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = delay_ms / 1000;
+    its.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    return timerfd_settime(tfd, 0, &its, NULL);
+}
+
+/**
+ * flush_cache - Save pending cache changes to disk
+ *
+ * Once new pending pages are on disk, httpclient is woken immediately
+ * instead of waiting for its next cycle.
+ */
+static void flush_cache(void) {
+    flush_armed = false;
+    if (!cache->dirty) return;
+
+    if (cache_save(cache) != 0) {
+        log_error("Failed to save cache to %s", cache_path);
+        return;
     }
+    log_debug("Cache flushed");
 
-    // Report cache status
-    int pending = cache_count_by_status(cache, SYNC_PENDING);
-    int uploaded = cache_count_by_status(cache, SYNC_UPLOADED);
-    int failed = cache_count_by_status(cache, SYNC_FAILED);
-    log_msg("Cache loaded: %d pending, %d uploaded, %d failed",
-           pending, uploaded, failed);
+    if (notify_pending) {
+        notify_pending = false;
+        if (notify_send(notify_path) != 0) {
+            log_debug("httpclient not listening on %s", notify_path);
+        }
+    }
+}
 
-    // Initialize inotify
-    int fd = inotify_init();
-    if (fd < 0) {
-        log_msg("ERROR: Failed to initialize inotify: %s", strerror(errno));
-        cache_close(cache, true);
-        return 1;
+/**
+ * schedule_flush - Request a deferred cache save
+ *
+ * The first change arms a one-shot timer; further changes before it fires
+ * are folded into the same save, so a burst of events costs one write.
+ */
+static void schedule_flush(void) {
+    if (flush_armed) return;
+
+    if (arm_timer(flush_timer_fd, FLUSH_DELAY_MS, 0) == 0) {
+        flush_armed = true;
+    } else {
+        // No timer - fall back to saving immediately
+        flush_cache();
     }
+}
 
-    // Add watch
-    int wd = inotify_add_watch(fd, watch_path,
-                              IN_CREATE | IN_MODIFY | IN_DELETE | IN_MOVED_TO);
-    if (wd < 0) {
-        log_msg("ERROR: Failed to add watch on %s: %s",
-               watch_path, strerror(errno));
-        close(fd);
-        cache_close(cache, true);
-        return 1;
+/**
+ * run_maintenance - Periodic housekeeping from the maintenance timer
+ */
+static void run_maintenance(void) {
+    log_debug("Maintenance: %d pending, %d uploaded, %d failed",
+              cache_count_by_status(cache, SYNC_PENDING),
+              cache_count_by_status(cache, SYNC_UPLOADED),
+              cache_count_by_status(cache, SYNC_FAILED));
+
+    log_debug("Watches: %d document directories, %d renames awaiting pairing",
+              watch_count, pending_move_count);
+
+    log_debug("Metadata changes: %lu scanned, %lu skipped without a scan",
+              metadata_scans, metadata_skipped);
+
+    if (shared_filter) {
+        log_debug("Shared path: %lu changed pages outside it, %lu scope sweeps",
+                  out_of_scope_pages, scope_sweeps);
     }
 
-    log_msg("Watching for changes...");
+    if (poll_sched_count() > 0) {
+        log_debug("Polling: %d document directories without a watch, worst lateness %llums",
+                  poll_sched_count(), (unsigned long long)poll_sched_max_lateness());
+    }
 
-    // Event loop
-    char buf[BUF_LEN];
-    while (1) {
-        int len = read(fd, buf, BUF_LEN);
-        if (len < 0) {
-            if (errno == EINTR) continue;
-            log_msg("ERROR: Read failed: %s", strerror(errno));
-            break;
+    event_queue_stats_t qs;
+    event_queue_stats(&qs);
+    log_debug("Event ring: %u/%u queued, peak %u, oldest %llums, max latency %llums, "
+              "%llu events, %llu ingestion stalls",
+              qs.occupancy, EVENT_QUEUE_SLOTS, qs.high_water,
+              (unsigned long long)qs.oldest_age_ms, (unsigned long long)qs.max_latency_ms,
+              (unsigned long long)qs.total, (unsigned long long)qs.stalls);
+
+    // Safety net in case a change slipped past schedule_flush
+    if (cache->dirty && !flush_armed) {
+        flush_cache();
+    }
+}
+
+/**
+ * find_meta_snapshot - Look up (optionally creating) a document's metadata snapshot
+ *
+ * @param doc_id: Document UUID
+ * @param create: Allocate an empty snapshot if none exists
+ * @param created: Set to true when a new snapshot was allocated
+ * @return: Snapshot or NULL
+ */
+static meta_snapshot_t* find_meta_snapshot(const char* doc_id, bool create,
+                                           bool* created) {
+    unsigned int bucket = (unsigned int)(content_hash(doc_id, UUID_LEN, 0) %
+                                         META_TABLE_SIZE);
+    for (meta_snapshot_t* snap = meta_table[bucket]; snap; snap = snap->next) {
+        if (strcmp(snap->doc_id, doc_id) == 0) return snap;
+    }
+    if (!create) return NULL;
+
+    meta_snapshot_t* snap = calloc(1, sizeof(*snap));
+    if (!snap) return NULL;
+    strncpy(snap->doc_id, doc_id, UUID_LEN);
+    snap->next = meta_table[bucket];
+    meta_table[bucket] = snap;
+    *created = true;
+    return snap;
+}
+
+/**
+ * free_meta_snapshots - Release the metadata snapshot table
+ */
+static void free_meta_snapshots(void) {
+    for (int i = 0; i < META_TABLE_SIZE; i++) {
+        meta_snapshot_t* snap = meta_table[i];
+        while (snap) {
+            meta_snapshot_t* next = snap->next;
+            free(snap);
+            snap = next;
         }
+        meta_table[i] = NULL;
+    }
+}
+
+/**
+ * classify_metadata_change - Diff new metadata against the last snapshot
+ *
+ * @param doc_id: Document UUID
+ * @param info: Freshly parsed metadata
+ * @return: Mask of META_CHANGE_* bits (0 = bookkeeping only)
+ *
+ * lastModified is bumped by xochitl when content changes; lastOpened,
+ * pinned and similar fields are not tracked, so writes that only touch
+ * them classify as bookkeeping. A document seen for the first time
+ * counts as a content change since there is nothing to compare with.
+ */
+static int classify_metadata_change(const char* doc_id, const metadata_info_t* info) {
+    char path_key[sizeof(info->visible_name) + sizeof(info->parent)];
+    size_t name_len = strlen(info->visible_name);
+    memcpy(path_key, info->visible_name, name_len + 1);
+    size_t parent_len = strlen(info->parent);
+    memcpy(path_key + name_len + 1, info->parent, parent_len);
+    uint64_t path_digest = content_hash(path_key, name_len + 1 + parent_len, 0);
+    bool is_folder = strcmp(info->type, "CollectionType") == 0;
 
-        // Process events
-        int i = 0;
-        while (i < len) {
-            struct inotify_event* event = (struct inotify_event*)&buf[i];
+    bool created = false;
+    meta_snapshot_t* snap = find_meta_snapshot(doc_id, true, &created);
+    if (!snap) return META_CHANGE_CONTENT;
 
-            if (event->len > 0) {
-                // Check if it's a metadata file
-                if (strstr(event->name, ".metadata")) {
-                    if (event->mask & (IN_CREATE | IN_MODIFY | IN_MOVED_TO)) {
-                        process_metadata_change(event->name);
-                    }
-                }
+    int changes = 0;
+    if (created || snap->last_modified != info->last_modified ||
+        snap->is_folder != is_folder || (snap->deleted && !info->deleted)) {
+        changes |= META_CHANGE_CONTENT;
+    }
+    if (!created && snap->path_digest != path_digest) {
+        changes |= META_CHANGE_PATH;
+    }
 
-                // Also check for direct .rm file changes in subdirectories
-                if (strstr(event->name, ".rm")) {
-                    // Extract document ID from the path
-                    const char* doc_id_start = extract_document_id(event->name);
-                    if (doc_id_start) {
-                        char doc_id[UUID_LEN + 1];
-                        strncpy(doc_id, doc_id_start, UUID_LEN);
-                        doc_id[UUID_LEN] = '\0';
-                        log_msg("Direct .rm change detected in %s", doc_id);
-                        scan_document_pages(doc_id);
-                        cache_save(cache);
-                    }
-                }
-            }
+    snap->last_modified = info->last_modified;
+    snap->path_digest = path_digest;
+    snap->is_folder = is_folder;
+    snap->deleted = info->deleted;
+
+    // Folders and deleted documents have no pages to scan
+    if (is_folder || info->deleted) changes &= ~META_CHANGE_CONTENT;
+    return changes;
+}
+
+/**
+ * apply_scope - Bring a document's page statuses in line with the filter
+ *
+ * @param doc: Cached document
+ * @return: Number of pages whose status changed
+ *
+ * Entering the shared path queues pages that were recorded as SKIPPED;
+ * leaving it takes not-yet-uploaded pages out of the queue. Uploaded and
+ * failed pages are left alone.
+ */
+static int apply_scope(DocumentEntry* doc) {
+    int included = metadata_path_included(doc->doc_id);
+    if (included < 0) return 0;
 
-            i += sizeof(struct inotify_event) + event->len;
+    uint8_t from = included ? SYNC_SKIPPED : SYNC_PENDING;
+    uint8_t to = included ? SYNC_PENDING : SYNC_SKIPPED;
+
+    int changed = 0;
+    for (PageEntry* page = doc->pages; page; page = page->next) {
+        if (page->sync_status == from) {
+            page->sync_status = to;
+            page->retry_count = 0;
+            page->changed = true;   // Ours, not httpclient's, on the next save
+            changed++;
         }
     }
 
-    // Cleanup
-    inotify_rm_watch(fd, wd);
-    close(fd);
-    cache_close(cache, true);
-    log_msg("=== Watcher stopped ===");
-    
-    return 0;
-}
\ No newline at end of file
+    if (changed > 0) {
+        cache->dirty = true;
+        if (included) {
+            record_document_path(doc->doc_id);
+            notify_pending = true;
+        }
+        log_msg("Document %s %s the shared path: %d pages %s", doc->doc_id,
+                included ? "entered" : "left", changed,
+                included ? "queued" : "dequeued");
+    }
+    return changed;
+}
+
+/**
+ * sweep_scope - Re-apply the filter to every cached document
+ *
+ * @param reason: What triggered the sweep, for the log
+ *
+ * Filter states are memoized per folder in the metadata tree, so this
+ * costs one lookup per document. Snapshot states are refreshed as well,
+ * keeping them valid as the "before" side of later comparisons.
+ */
+static void sweep_scope(const char* reason) {
+    int changed = 0;
+    for (size_t i = 0; i < cache->table_size; i++) {
+        for (DocumentEntry* doc = cache->table[i]; doc; doc = doc->next) {
+            changed += apply_scope(doc);
+        }
+    }
+
+    for (int i = 0; i < META_TABLE_SIZE; i++) {
+        for (meta_snapshot_t* snap = meta_table[i]; snap; snap = snap->next) {
+            snap->scope_known = metadata_filter_state(snap->doc_id, &snap->scope);
+        }
+    }
+
+    scope_sweeps++;
+    log_debug("%s: shared-path scope re-evaluated, %d pages changed status", reason, changed);
+}
+
+/**
+ * refresh_paths - Re-intern the virtual path of every cached document
+ *
+ * Interned names are otherwise only updated from live .metadata events,
+ * so folders renamed or moved while the watcher was down would keep
+ * their old path. Names come from the metadata tree, which reads each
+ * folder once; unchanged nodes are left as they are.
+ */
+static void refresh_paths(void) {
+    for (size_t i = 0; i < cache->table_size; i++) {
+        for (DocumentEntry* doc = cache->table[i]; doc; doc = doc->next) {
+            if (doc->path_id != 0) record_document_path(doc->doc_id);
+        }
+    }
+}
+
+/**
+ * update_scope - React to a document or folder possibly crossing the filter boundary
+ *
+ * @param doc_id: UUID whose metadata changed
+ * @param is_folder: It is a folder
+ *
+ * The filter state after a node depends only on its parent's state and
+ * its own name, so if the node's state is unchanged nothing below it can
+ * have changed either. Only a state change costs a sweep (folders) or a
+ * status update (documents).
+ */
+static void update_scope(const char* doc_id, bool is_folder) {
+    meta_snapshot_t* snap = find_meta_snapshot(doc_id, false, NULL);
+    path_filter_state_t state;
+    if (!snap || !metadata_filter_state(doc_id, &state)) return;
+
+    if (snap->scope_known && path_filter_state_equal(&snap->scope, &state)) return;
+    snap->scope = state;
+    snap->scope_known = true;
+
+    if (is_folder) {
+        sweep_scope("Folder moved");
+    } else {
+        DocumentEntry* doc = cache_find_document(cache, doc_id);
+        if (doc) apply_scope(doc);
+    }
+}
+
+/**
+ * process_metadata_change - Process a change to a .metadata file
+ *
+ * @param filename: Name of the metadata file
+ */
+void process_metadata_change(const char* filename) {
+    // Extract document ID from filename
+    char doc_id[UUID_LEN + 1];
+    if (strlen(filename) < UUID_LEN + 9) return; // UUID + ".metadata"
+
+    strncpy(doc_id, filename, UUID_LEN);
+    doc_id[UUID_LEN] = '\0';
+
+    log_debug("Processing metadata change for document %s", doc_id);
+
+    // Keep the shared metadata tree in step with what we just saw
+    metadata_tree_invalidate(doc_id);
+
+    // Unreadable metadata (e.g. caught mid-write) falls back to a scan
+    metadata_info_t info;
+    int changes = read_document_metadata(doc_id, &info)
+                  ? classify_metadata_change(doc_id, &info) : META_CHANGE_CONTENT;
+
+    if (changes & META_CHANGE_PATH) {
+        // Only the path changed; nothing to rescan
+        log_msg("%s %s is now \"%s\" (parent %s)",
+                strcmp(info.type, "CollectionType") == 0 ? "Folder" : "Document",
+                doc_id, info.visible_name, info.parent[0] ? info.parent : "root");
+    }
+
+    // Interned names are updated in place; paths below follow by ID
+    if (cache_find_path(cache, doc_id)) {
+        intern_chain(doc_id);
+    }
+
+    // A move or rename may carry the node across the shared-path boundary
+    if (shared_filter) {
+        update_scope(doc_id, strcmp(info.type, "CollectionType") == 0);
+    }
+
+    if (!(changes & META_CHANGE_CONTENT)) {
+        metadata_skipped++;
+        if (!changes) log_debug("Metadata of %s changed bookkeeping only", doc_id);
+        if (cache->dirty) schedule_flush();
+        return;
+    }
+
+    // Scan all pages in this document
+    metadata_scans++;
+    int pages_updated = scan_document_pages(doc_id);
+
+    if (pages_updated > 0) {
+        log_msg("Updated %d pages for document %s", pages_updated, doc_id);
+    }
+    if (cache->dirty) {
+        schedule_flush();
+    }
+}
+
+/**
+ * is_document_dir_name - Check for a bare document UUID (directory name)
+ */
+static bool is_document_dir_name(const char* name) {
+    return strlen(name) == UUID_LEN && extract_document_id(name) != NULL;
+}
+
+/**
+ * page_uuid_from_name - Extract the page UUID from "<uuid>.rm"
+ *
+ * @return: true if name is a page file
+ */
+static bool page_uuid_from_name(const char* name, char* page_uuid) {
+    if (strlen(name) != UUID_LEN + 3 || strcmp(name + UUID_LEN, ".rm") != 0)
+        return false;
+    if (!extract_document_id(name)) return false;
+
+    memcpy(page_uuid, name, UUID_LEN);
+    page_uuid[UUID_LEN] = '\0';
+    return true;
+}
+
+/**
+ * watched_document - Document ID behind a per-document watch
+ *
+ * @return: Document UUID or NULL if wd is not a document watch
+ */
+static const char* watched_document(int wd) {
+    if (wd < 0 || wd >= watch_docs_cap || watch_docs[wd][0] == '\0') return NULL;
+    return watch_docs[wd];
+}
+
+/**
+ * find_document_watch - Reverse lookup of a document's watch descriptor
+ *
+ * @return: Watch descriptor or -1
+ */
+static int find_document_watch(const char* doc_id) {
+    for (int wd = 0; wd < watch_docs_cap; wd++) {
+        if (strcmp(watch_docs[wd], doc_id) == 0) return wd;
+    }
+    return -1;
+}
+
+/**
+ * set_watch_document - Record (or clear, with NULL) the document behind a watch
+ */
+static int set_watch_document(int wd, const char* doc_id) {
+    if (wd >= watch_docs_cap) {
+        int cap = watch_docs_cap ? watch_docs_cap : 256;
+        while (cap <= wd) cap *= 2;
+        char (*grown)[UUID_LEN + 1] = realloc(watch_docs, cap * sizeof(*grown));
+        if (!grown) return -1;
+        memset(grown + watch_docs_cap, 0, (cap - watch_docs_cap) * sizeof(*grown));
+        watch_docs = grown;
+        watch_docs_cap = cap;
+    }
+
+    bool was_set = watch_docs[wd][0] != '\0';
+    if (doc_id) {
+        strncpy(watch_docs[wd], doc_id, UUID_LEN);
+        watch_docs[wd][UUID_LEN] = '\0';
+        if (!was_set) watch_count++;
+    } else {
+        watch_docs[wd][0] = '\0';
+        if (was_set) watch_count--;
+    }
+    return 0;
+}
+
+/**
+ * arm_poll_timer - Point the poll timer at the next due directory
+ */
+static void arm_poll_timer(void) {
+    int64_t delay = poll_sched_next_delay(monotonic_ms());
+    if (delay < 0) {
+        arm_timer(poll_timer_fd, 0, 0);
+    } else {
+        arm_timer(poll_timer_fd, delay > 0 ? delay : POLL_BACKLOG_DELAY_MS, 0);
+    }
+}
+
+/**
+ * poll_document_dir - Fall back to stat-polling for a directory we cannot watch
+ *
+ * @param doc_id: Document UUID
+ *
+ * A document the cache has never seen gets a baseline fingerprint first,
+ * so the first poll does not mistake existing pages for new ones.
+ */
+static void poll_document_dir(const char* doc_id) {
+    if (!watch_limit_reached) {
+        log_warn("inotify watch limit reached (fs.inotify.max_user_watches), "
+                 "polling further document directories");
+        watch_limit_reached = true;
+    }
+
+    if (!poll_sched_add(doc_id, monotonic_ms())) return;
+
+    DocumentEntry* doc = cache_find_document(cache, doc_id);
+    if (!doc || doc->dir_ino == 0) {
+        char dir_path[PATH_MAX];
+        struct stat st;
+        if (document_dir(dir_path, doc_id) && stat(dir_path, &st) == 0 &&
+            (doc = cache_add_document(cache, doc_id))) {
+            doc->dir_mtime_ns = timespec_ns(&st.st_mtim);
+            doc->dir_ino = st.st_ino;
+            int entries = count_dir_entries(dir_path);
+            doc->dir_entries = entries > 0 ? entries : 0;
+            cache->dirty = true;
+        }
+    }
+
+    arm_poll_timer();
+}
+
+/**
+ * poll_document - Poll callback: detect changes in an unwatched directory
+ *
+ * @param doc_id: Document UUID
+ * @return: POLL_ACTIVE if pages were rescanned, POLL_IDLE if unchanged,
+ *          POLL_REMOVE if the directory is gone
+ *
+ * A stat of the directory catches pages created, replaced or removed; a
+ * stat of each cached page catches pages rewritten in place.
+ */
+static poll_result_t poll_document(const char* doc_id) {
+    char dir_path[PATH_MAX];
+    struct stat st;
+    if (!document_dir(dir_path, doc_id) || stat(dir_path, &st) != 0 ||
+        !S_ISDIR(st.st_mode)) {
+        log_debug("Polled directory %s is gone", doc_id);
+        return POLL_REMOVE;
+    }
+
+    DocumentEntry* doc = cache_find_document(cache, doc_id);
+    bool changed = !dir_unchanged(doc, &st, dir_path);
+
+    for (PageEntry* page = doc ? doc->pages : NULL; page && !changed; page = page->next) {
+        char file_path[PATH_MAX];
+        struct stat page_st;
+        if (snprintf(file_path, sizeof(file_path), "%s/%s.rm", dir_path,
+                     page->uuid) >= (int)sizeof(file_path)) {
+            continue;
+        }
+        if (stat(file_path, &page_st) == 0 && page_st.st_mtime != page->mtime) {
+            changed = true;
+        }
+    }
+
+    if (!changed) return POLL_IDLE;
+
+    int pages_updated = scan_document_pages(doc_id);
+    if (pages_updated > 0) {
+        log_msg("Updated %d pages for polled document %s", pages_updated, doc_id);
+    }
+    return POLL_ACTIVE;
+}
+
+/**
+ * run_poll_tick - Poll the most overdue directories within the tick budget
+ */
+static void run_poll_tick(void) {
+    poll_sched_run(monotonic_ms(), POLL_TICK_BUDGET, poll_document);
+    if (cache->dirty) {
+        schedule_flush();
+    }
+    arm_poll_timer();
+}
+
+/**
+ * retry_watch - Try to move a polled directory back to inotify
+ */
+static bool retry_watch(const char* doc_id) {
+    char dir_path[PATH_MAX];
+    if (!document_dir(dir_path, doc_id)) return false;
+
+    int wd = inotify_add_watch(inotify_fd, dir_path, DOC_WATCH_MASK);
+    if (wd < 0) return false;
+    set_watch_document(wd, doc_id);
+    return true;
+}
+
+/**
+ * promote_polled_documents - Re-watch polled directories once watches free up
+ */
+static void promote_polled_documents(void) {
+    if (poll_sched_count() == 0) return;
+
+    int promoted = poll_sched_retry(POLL_TICK_BUDGET, retry_watch);
+    if (promoted > 0) {
+        log_msg("Moved %d polled document directories back to inotify, %d still polled",
+                promoted, poll_sched_count());
+        arm_poll_timer();
+    }
+}
+
+/**
+ * watch_document - Watch a document directory for page changes
+ *
+ * @param doc_id: Document UUID
+ * @return: Watch descriptor or -1 on error
+ *
+ * Adding a watch that already exists returns the same descriptor, so this
+ * is safe to call again after an overflow.
+ */
+static int watch_document(const char* doc_id) {
+    char dir_path[PATH_MAX];
+    if (!document_dir(dir_path, doc_id)) {
+        log_warn("Path of document %s is too long to watch", doc_id);
+        return -1;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, dir_path, DOC_WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            poll_document_dir(doc_id);
+        } else {
+            log_warn("Cannot watch %s: %s", dir_path, strerror(errno));
+        }
+        return -1;
+    }
+    set_watch_document(wd, doc_id);
+    return wd;
+}
+
+/**
+ * watch_library - Add watches for every document directory
+ *
+ * @return: Number of document directories watched
+ */
+static int watch_library(void) {
+    DIR* root = opendir(watch_path);
+    if (!root) return 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(root)) != NULL) {
+        if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) continue;
+        if (!is_document_dir_name(entry->d_name)) continue;
+        watch_document(entry->d_name);
+    }
+
+    closedir(root);
+    return watch_count;
+}
+
+/**
+ * handle_new_document_dir - A document directory appeared (created or moved in)
+ */
+static void handle_new_document_dir(const char* doc_id) {
+    log_debug("New document directory %s", doc_id);
+
+    // Watch first so pages written during the scan are not missed
+    watch_document(doc_id);
+    int pages_updated = scan_document_pages(doc_id);
+    if (pages_updated > 0) {
+        log_msg("Updated %d pages for document %s", pages_updated, doc_id);
+    }
+}
+
+/**
+ * handle_page_file - A page file was written or moved into a document
+ */
+static void handle_page_file(const char* doc_id, const char* name) {
+    char page_uuid[UUID_LEN + 1];
+    if (!page_uuid_from_name(name, page_uuid)) return;
+
+    char file_path[PATH_MAX];
+    if (snprintf(file_path, sizeof(file_path), "%s/%s/%s", watch_path, doc_id,
+                 name) >= (int)sizeof(file_path)) {
+        return;
+    }
+
+    if (update_page(doc_id, page_uuid, file_path, true, NULL) > 0) {
+        log_msg("Updated page %s of document %s", page_uuid, doc_id);
+    }
+}
+
+/**
+ * complete_move - Apply a rename whose two halves were paired by cookie
+ *
+ * @param from: The IN_MOVED_FROM half
+ * @param to: The IN_MOVED_TO half
+ *
+ * Renames only re-key cache entries; nothing is marked for upload unless
+ * the destination's content actually differs from what was synced.
+ */
+static void complete_move(const pending_move_t* from, const watch_event_t* to) {
+    // Document directory renamed within the library root
+    if (from->wd == root_wd && to->wd == root_wd && (to->mask & IN_ISDIR)) {
+        if (!is_document_dir_name(to->name)) return;
+
+        if (is_document_dir_name(from->name) &&
+            cache_rename_document(cache, from->name, to->name) == 0) {
+            // The kernel watch follows the inode, only its label changes
+            int wd = find_document_watch(from->name);
+            if (wd >= 0) set_watch_document(wd, to->name);
+            if (poll_sched_remove(from->name)) poll_document_dir(to->name);
+            log_msg("Document %s renamed to %s", from->name, to->name);
+            return;
+        }
+        handle_new_document_dir(to->name);
+        return;
+    }
+
+    // Metadata replaced by rename (write-to-temp, then rename over)
+    if (to->wd == root_wd) {
+        if (strstr(to->name, ".metadata")) {
+            process_metadata_change(to->name);
+        }
+        return;
+    }
+
+    const char* to_doc = watched_document(to->wd);
+    if (!to_doc) return;
+
+    char to_uuid[UUID_LEN + 1];
+    if (!page_uuid_from_name(to->name, to_uuid)) return;
+
+    // A page renamed or moved between documents keeps its sync state
+    const char* from_doc = watched_document(from->wd);
+    char from_uuid[UUID_LEN + 1];
+    if (from_doc && page_uuid_from_name(from->name, from_uuid) &&
+        cache_move_page(cache, from_doc, from_uuid, to_doc, to_uuid) == 0) {
+        log_debug("Page %s/%s renamed to %s/%s", from_doc, from_uuid, to_doc, to_uuid);
+    }
+
+    // Atomic replace from a temp file, or a move of an uncached page:
+    // re-check just this page (mtime/hash decide whether it is pending)
+    handle_page_file(to_doc, to->name);
+}
+
+/**
+ * expire_pending_moves - Treat unmatched IN_MOVED_FROM events as removals
+ *
+ * @param force: Expire all entries regardless of age
+ */
+static void expire_pending_moves(bool force) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int kept = 0;
+    for (int i = 0; i < pending_move_count; i++) {
+        pending_move_t* move = &pending_moves[i];
+        int64_t age_ms = (int64_t)(now.tv_sec - move->queued.tv_sec) * 1000 +
+                         (now.tv_nsec - move->queued.tv_nsec) / 1000000;
+
+        if (!force && age_ms < RENAME_PAIR_TIMEOUT_MS) {
+            pending_moves[kept++] = *move;
+            continue;
+        }
+
+        // Moved out of the library: stop following the directory
+        if (move->wd == root_wd && move->is_dir && is_document_dir_name(move->name)) {
+            int wd = find_document_watch(move->name);
+            if (wd >= 0) {
+                inotify_rm_watch(inotify_fd, wd);
+                set_watch_document(wd, NULL);
+            }
+            poll_sched_remove(move->name);
+            log_msg("Document %s moved out of the library", move->name);
+        } else {
+            log_debug("%s moved out of the library", move->name);
+        }
+    }
+    pending_move_count = kept;
+
+    if (pending_move_count > 0) {
+        arm_timer(rename_timer_fd, RENAME_PAIR_TIMEOUT_MS, 0);
+    }
+}
+
+/**
+ * remember_move - Hold an IN_MOVED_FROM until its IN_MOVED_TO arrives
+ */
+static void remember_move(const watch_event_t* event) {
+    if (pending_move_count == MAX_PENDING_MOVES) {
+        expire_pending_moves(true);
+    }
+
+    pending_move_t* move = &pending_moves[pending_move_count++];
+    move->cookie = event->cookie;
+    move->wd = event->wd;
+    move->is_dir = (event->mask & IN_ISDIR) != 0;
+    move->queued = event->queued;
+    memcpy(move->name, event->name, event->name_len + 1);
+
+    if (pending_move_count == 1) {
+        arm_timer(rename_timer_fd, RENAME_PAIR_TIMEOUT_MS, 0);
+    }
+}
+
+/**
+ * take_move - Remove and return the IN_MOVED_FROM matching a cookie
+ *
+ * @return: true if a match was found (copied to out)
+ */
+static bool take_move(uint32_t cookie, pending_move_t* out) {
+    for (int i = 0; i < pending_move_count; i++) {
+        if (pending_moves[i].cookie == cookie) {
+            *out = pending_moves[i];
+            pending_moves[i] = pending_moves[--pending_move_count];
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * handle_inotify_event - Dispatch a single inotify event
+ *
+ * @param event: Event taken from the ingestion ring
+ */
+static void handle_inotify_event(const watch_event_t* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        log_warn("inotify queue overflowed, events were lost");
+        overflow_pending = true;
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        // Watch removed by the kernel (directory deleted) or by us
+        set_watch_document(event->wd, NULL);
+        return;
+    }
+
+    if (event->name_len == 0) return;
+
+    // Pair renames by cookie
+    if (event->mask & IN_MOVED_FROM) {
+        remember_move(event);
+        return;
+    }
+    if (event->mask & IN_MOVED_TO) {
+        pending_move_t from;
+        if (take_move(event->cookie, &from)) {
+            complete_move(&from, event);
+            return;
+        }
+        // No FROM half: moved in from outside the library
+    }
+
+    if (event->wd == root_wd) {
+        if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+            if (is_document_dir_name(event->name)) {
+                handle_new_document_dir(event->name);
+            }
+        } else if (strstr(event->name, ".metadata") &&
+                   (event->mask & (IN_CREATE | IN_MODIFY | IN_MOVED_TO))) {
+            process_metadata_change(event->name);
+        }
+        return;
+    }
+
+    // Page written in place or moved in from outside the library
+    const char* doc_id = watched_document(event->wd);
+    if (doc_id && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+        handle_page_file(doc_id, event->name);
+    }
+}
+
+/**
+ * drain_events - Process every event queued by the ingestion thread
+ */
+static void drain_events(void) {
+    event_queue_ack();
+
+    // Pick up status changes saved by httpclient (cache_save merges them
+    // in as well, this just keeps our view of them current)
+    if (cache_refresh(cache) > 0) {
+        log_debug("Cache reloaded after external update");
+    }
+
+    const watch_event_t* event;
+    while ((event = event_queue_peek()) != NULL) {
+        handle_inotify_event(event);
+        event_queue_release();
+    }
+
+    // Recover once the queue has been drained past the overflow marker.
+    // Directories created during the lost events have no watch yet.
+    if (overflow_pending) {
+        overflow_pending = false;
+        watch_library();
+        rescan_library("Overflow recovery", true);
+    }
+
+    if (cache->dirty) {
+        schedule_flush();
+    }
+}
+
+/**
+ * setup_signalfd - Route SIGINT/SIGTERM/SIGHUP through a signalfd
+ *
+ * @return: Signal file descriptor or -1 on error
+ */
+static int setup_signalfd(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/**
+ * epoll_watch - Register a descriptor for input events
+ */
+static int epoll_watch(int epfd, int fd) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * main - Main entry point
+ */
+int main(int argc, char** argv) {
+    // Load configuration
+    load_config();
+    load_shared_path();
+
+    // Override watch path if provided as argument
+    if (argc > 1) {
+        strncpy(watch_path, argv[1], PATH_MAX - 1);
+        watch_path[PATH_MAX - 1] = '\0';
+    }
+
+    // Block shutdown signals before any thread starts so they reach the signalfd
+    int sig_fd = setup_signalfd();
+
+    if (log_init(log_path, log_level, log_max_size, LOG_DEFAULT_MAX_FILES) != 0) {
+        fprintf(stderr, "Cannot open log file %s: %s\n", log_path, strerror(errno));
+    }
+
+    log_msg("=== Watcher started ===");
+    log_msg("Watch path: %s", watch_path);
+    log_msg("Cache path: %s", cache_path);
+    log_msg("Log path: %s", log_path);
+    log_msg("Shared path: %s (from %s)", shared_path, shared_config_path);
+
+    if (sig_fd < 0) {
+        log_error("Failed to set up signalfd: %s", strerror(errno));
+        log_shutdown();
+        return 1;
+    }
+
+    // Out-of-scope documents are filtered here rather than queued for
+    // httpclient to skip. "*" needs no filter at all.
+    if (strcmp(shared_path, "*") != 0) {
+        shared_filter = path_filter_compile(shared_path);
+        if (shared_filter) {
+            metadata_set_path_filter(shared_filter);
+        } else {
+            log_warn("Invalid SHARED_PATH, leaving filtering to httpclient");
+        }
+    }
+
+    // Open cache
+    cache = cache_open(cache_path);
+    if (!cache) {
+        log_error("Failed to open cache");
+        path_filter_free(shared_filter);
+        close(sig_fd);
+        log_shutdown();
+        return 1;
+    }
+
+    // Report cache status
+    int pending = cache_count_by_status(cache, SYNC_PENDING);
+    int uploaded = cache_count_by_status(cache, SYNC_UPLOADED);
+    int failed = cache_count_by_status(cache, SYNC_FAILED);
+    log_msg("Cache loaded: %d pending, %d uploaded, %d failed",
+           pending, uploaded, failed);
+
+    // Initialize inotify
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        log_error("Failed to initialize inotify: %s", strerror(errno));
+        close(sig_fd);
+        cache_close(cache, true);
+        log_shutdown();
+        return 1;
+    }
+
+    // Watch the library root for documents and metadata
+    root_wd = inotify_add_watch(inotify_fd, watch_path, ROOT_WATCH_MASK);
+    if (root_wd < 0) {
+        log_error("Failed to add watch on %s: %s",
+                  watch_path, strerror(errno));
+        close(inotify_fd);
+        close(sig_fd);
+        cache_close(cache, true);
+        log_shutdown();
+        return 1;
+    }
+
+    // Ingestion thread keeps the kernel queue drained from here on
+    int queue_fd = event_queue_start(inotify_fd);
+    if (queue_fd < 0) {
+        log_error("Failed to start event ingestion: %s", strerror(errno));
+        close(inotify_fd);
+        close(sig_fd);
+        cache_close(cache, true);
+        log_shutdown();
+        return 1;
+    }
+
+    // Timers and epoll set
+    flush_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    rename_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    poll_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int maint_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (flush_timer_fd < 0 || rename_timer_fd < 0 || poll_timer_fd < 0 ||
+        maint_timer_fd < 0 || epfd < 0 ||
+        epoll_watch(epfd, queue_fd) != 0 || epoll_watch(epfd, sig_fd) != 0 ||
+        epoll_watch(epfd, flush_timer_fd) != 0 ||
+        epoll_watch(epfd, rename_timer_fd) != 0 ||
+        epoll_watch(epfd, poll_timer_fd) != 0 ||
+        epoll_watch(epfd, maint_timer_fd) != 0) {
+        log_error("Failed to set up event loop: %s", strerror(errno));
+        event_queue_stop();
+        if (epfd >= 0) close(epfd);
+        if (rename_timer_fd >= 0) close(rename_timer_fd);
+        if (poll_timer_fd >= 0) close(poll_timer_fd);
+        if (maint_timer_fd >= 0) close(maint_timer_fd);
+        if (flush_timer_fd >= 0) close(flush_timer_fd);
+        close(inotify_fd);
+        close(sig_fd);
+        cache_close(cache, true);
+        log_shutdown();
+        return 1;
+    }
+
+    arm_timer(maint_timer_fd, MAINTENANCE_INTERVAL_SEC * 1000L,
+              MAINTENANCE_INTERVAL_SEC * 1000L);
+
+    log_msg("Watching %d document directories", watch_library());
+    if (poll_sched_count() > 0) {
+        log_warn("%d document directories exceed the inotify watch limit and are polled",
+                 poll_sched_count());
+    }
+
+    // Catch up on changes made while the watcher was not running. The
+    // watches are already in place, so nothing can slip between the two.
+    rescan_library("Startup rescan", false);
+    refresh_paths();
+
+    // SHARED_PATH may have changed since the last run
+    if (shared_filter) {
+        sweep_scope("Startup");
+    }
+    if (cache->dirty) {
+        schedule_flush();
+    }
+
+    log_msg("Watching for changes...");
+
+    // Event loop
+    bool running = true;
+    while (running) {
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int efd = events[i].data.fd;
+            uint64_t expirations;
+
+            if (efd == queue_fd) {
+                drain_events();
+            } else if (efd == flush_timer_fd) {
+                if (read(efd, &expirations, sizeof(expirations)) > 0) {
+                    flush_cache();
+                }
+            } else if (efd == rename_timer_fd) {
+                if (read(efd, &expirations, sizeof(expirations)) > 0) {
+                    expire_pending_moves(false);
+                    if (cache->dirty) {
+                        schedule_flush();
+                    }
+                }
+            } else if (efd == poll_timer_fd) {
+                if (read(efd, &expirations, sizeof(expirations)) > 0) {
+                    run_poll_tick();
+                }
+            } else if (efd == maint_timer_fd) {
+                if (read(efd, &expirations, sizeof(expirations)) > 0) {
+                    run_maintenance();
+                    promote_polled_documents();
+                }
+            } else if (efd == sig_fd) {
+                struct signalfd_siginfo si;
+                while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                    log_msg("Received signal %u, shutting down", si.ssi_signo);
+                    running = false;
+                }
+            }
+        }
+    }
+
+    // Cleanup - final flush so pending state survives the restart
+    flush_cache();
+    event_queue_stop();
+    close(epfd);
+    close(maint_timer_fd);
+    close(rename_timer_fd);
+    close(poll_timer_fd);
+    close(flush_timer_fd);
+    close(inotify_fd);
+    close(sig_fd);
+    free(watch_docs);
+    free_meta_snapshots();
+    poll_sched_clear();
+    cache_close(cache, true);
+    metadata_set_path_filter(NULL);
+    path_filter_free(shared_filter);
+    log_msg("=== Watcher stopped ===");
+    log_shutdown();
+
+    return 0;
+}
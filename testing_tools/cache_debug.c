@@ -1,4 +1,4 @@
-// cache_debug_v2.c - Cache debug tool supporting both version 1 and 2
+// cache_debug_v2.c - Cache debug tool supporting cache versions 1 to 3
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -11,6 +11,8 @@
 #define CACHE_MAGIC 0x524D4348  // "RMCH" in hex
 #define CACHE_VERSION_1 1
 #define CACHE_VERSION_2 2
+#define CACHE_VERSION_3 3
+#define MAX_PATH_DEPTH 32
 
 // Sync status values (version 2 only)
 typedef enum {
@@ -67,6 +69,67 @@ const char* status_to_string(uint8_t status) {
     }
 }
 
+/**
+ * print_path_table - Print the interned path nodes that follow the documents
+ */
+static void print_path_table(FILE* f) {
+    uint32_t num_nodes;
+    if (fread(&num_nodes, sizeof(num_nodes), 1, f) != 1) return;
+
+    typedef struct {
+        uint32_t id;
+        uint32_t parent;
+        char uuid[UUID_LEN + 1];
+        char name[256];
+    } path_node_t;
+
+    path_node_t* nodes = calloc(num_nodes ? num_nodes : 1, sizeof(path_node_t));
+    if (!nodes) return;
+
+    uint32_t count = 0;
+    for (; count < num_nodes; count++) {
+        path_node_t* node = &nodes[count];
+        uint16_t name_len;
+        if (fread(&node->id, sizeof(node->id), 1, f) != 1 ||
+            fread(&node->parent, sizeof(node->parent), 1, f) != 1 ||
+            fread(node->uuid, UUID_LEN, 1, f) != 1 ||
+            fread(&name_len, sizeof(name_len), 1, f) != 1) break;
+
+        char name[65536];
+        if (name_len > 0 && fread(name, name_len, 1, f) != 1) break;
+        size_t keep = name_len < sizeof(node->name) ? name_len : sizeof(node->name) - 1;
+        memcpy(node->name, name, keep);
+        node->name[keep] = '\0';
+        node->uuid[UUID_LEN] = '\0';
+    }
+
+    printf("=== Path Table: %u nodes ===\n", count);
+    for (uint32_t i = 0; i < count; i++) {
+        // Walk up to the root to show the full path
+        const path_node_t* chain[MAX_PATH_DEPTH];
+        int depth = 0;
+        const path_node_t* node = &nodes[i];
+        while (node && depth < MAX_PATH_DEPTH) {
+            chain[depth++] = node;
+            const path_node_t* parent = NULL;
+            for (uint32_t j = 0; node->parent && j < count; j++) {
+                if (nodes[j].id == node->parent) parent = &nodes[j];
+            }
+            node = parent;
+        }
+
+        printf("  #%-5u %s  ", nodes[i].id, nodes[i].uuid);
+        for (int d = depth - 1; d >= 0; d--) {
+            printf("%s%s", d == depth - 1 ? "" : "/", chain[d]->name);
+        }
+        if (chain[depth - 1]->parent) printf("  (parent #%u missing)", chain[depth - 1]->parent);
+        printf("\n");
+    }
+    printf("\n");
+
+    free(nodes);
+}
+
 /**
  * parse_cache_file - Main parsing function
  */
@@ -101,7 +164,7 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
         return 1;
     }
 
-    if (version != CACHE_VERSION_1 && version != CACHE_VERSION_2) {
+    if (version < CACHE_VERSION_1 || version > CACHE_VERSION_3) {
         fprintf(stderr, "Error: Unsupported version (%d)\n", version);
         fclose(f);
         return 1;
@@ -118,6 +181,7 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
     printf("File: %s\n", filename);
     printf("Magic: 0x%08X (RMCH)\n", magic);
     printf("Version: %d%s\n", version, 
+           version == CACHE_VERSION_3 ? " (with sync status, content hash, directory fingerprint and path table)" :
            version == CACHE_VERSION_2 ? " (with sync status)" : " (legacy)");
     printf("Documents: %d\n", num_docs);
     printf("\n");
@@ -146,6 +210,17 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
         if (fread(doc_id, doc_id_len, 1, f) != 1) break;
         doc_id[doc_id_len] = '\0';
 
+        int64_t dir_mtime_ns = 0;
+        uint64_t dir_ino = 0;
+        uint32_t dir_entries = 0;
+        uint32_t path_id = 0;
+        if (version >= CACHE_VERSION_3) {
+            if (fread(&dir_mtime_ns, sizeof(dir_mtime_ns), 1, f) != 1) break;
+            if (fread(&dir_ino, sizeof(dir_ino), 1, f) != 1) break;
+            if (fread(&dir_entries, sizeof(dir_entries), 1, f) != 1) break;
+            if (fread(&path_id, sizeof(path_id), 1, f) != 1) break;
+        }
+
         uint16_t num_pages;
         if (fread(&num_pages, sizeof(num_pages), 1, f) != 1) break;
 
@@ -154,10 +229,30 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
 
         if (show_document && !summary_only && !filter_status) {
             printf("=== Document: %s ===\n", doc_id);
-            printf("Total Pages: %d\n\n", num_pages);
+            printf("Total Pages: %d\n", num_pages);
+            if (version >= CACHE_VERSION_3) {
+                if (dir_mtime_ns) {
+                    char dir_time[32];
+                    format_timestamp((time_t)(dir_mtime_ns / 1000000000LL),
+                                     dir_time, sizeof(dir_time));
+                    printf("Directory: %s.%09lld, inode %llu, %u entries\n", dir_time,
+                           (long long)(dir_mtime_ns % 1000000000LL),
+                           (unsigned long long)dir_ino, dir_entries);
+                } else {
+                    printf("Directory: (not scanned)\n");
+                }
+            }
+            if (version >= CACHE_VERSION_3) {
+                if (path_id) {
+                    printf("Path node: #%u\n", path_id);
+                } else {
+                    printf("Path node: (none)\n");
+                }
+            }
+            printf("\n");
             
             if (!verbose) {
-                if (version == CACHE_VERSION_2) {
+                if (version >= CACHE_VERSION_2) {
                     printf("  %-4s  %-19s  %-10s  %-36s\n", 
                            "Page", "Modified", "Status", "UUID");
                     printf("  %-4s  %-19s  %-10s  %-36s\n", 
@@ -195,7 +290,7 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
             uint8_t retry_count = 0;
 
             // Read sync status if version 2
-            if (version == CACHE_VERSION_2) {
+            if (version >= CACHE_VERSION_2) {
                 if (fread(&sync_status, sizeof(sync_status), 1, f) != 1) goto cleanup;
                 if (fread(&retry_count, sizeof(retry_count), 1, f) != 1) goto cleanup;
                 
@@ -208,6 +303,11 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
                 }
             }
 
+            uint64_t content_hash = 0;
+            if (version >= CACHE_VERSION_3) {
+                if (fread(&content_hash, sizeof(content_hash), 1, f) != 1) goto cleanup;
+            }
+
             // Check if we should show this page
             int show_page = show_document && !summary_only;
             if (filter_status && sync_status != status_value) {
@@ -223,15 +323,23 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
                     printf("  Page Number: %s\n", 
                            strlen(page_num) > 0 ? page_num : "(unknown)");
                     printf("  Modified: %s (%ld)\n", time_str, mtime);
-                    if (version == CACHE_VERSION_2) {
+                    if (version >= CACHE_VERSION_2) {
                         printf("  Sync Status: %s\n", status_to_string(sync_status));
                         if (retry_count > 0) {
                             printf("  Retry Count: %d\n", retry_count);
                         }
                     }
+                    if (version >= CACHE_VERSION_3) {
+                        if (content_hash) {
+                            printf("  Content Hash: %016llx\n",
+                                   (unsigned long long)content_hash);
+                        } else {
+                            printf("  Content Hash: (unknown)\n");
+                        }
+                    }
                     printf("  ---\n");
                 } else {
-                    if (version == CACHE_VERSION_2) {
+                    if (version >= CACHE_VERSION_2) {
                         printf("  %-4s  %s  %-10s  %s\n",
                             strlen(page_num) > 0 ? page_num : "?",
                             time_str,
@@ -254,6 +362,10 @@ int parse_cache_file(const char* filename, int verbose, int summary_only,
         }
     }
 
+    if (version >= CACHE_VERSION_3 && !summary_only && !filter_status && !filter_doc) {
+        print_path_table(f);
+    }
+
 cleanup:
     fclose(f);
 
@@ -261,7 +373,7 @@ cleanup:
     if (!filter_doc || summary_only) {
         printf("=== Summary ===\n");
         printf("Total Pages: %d\n", total_pages);
-        if (version == CACHE_VERSION_2) {
+        if (version >= CACHE_VERSION_2) {
             printf("Status Breakdown:\n");
             printf("  Pending:  %d\n", pending_count);
             printf("  Uploaded: %d\n", uploaded_count);
@@ -14,6 +14,9 @@ import json
 import os
 import sys
 import re
+import struct
+import gzip
+import zlib
 from datetime import datetime
 from urllib.parse import urlparse, parse_qs
 
@@ -42,9 +45,72 @@ def sanitize_filename(filename):
     
     return filename
 
+def read_chunked(rfile):
+    """
+    Read a Transfer-Encoding: chunked body, returning the decoded bytes
+    """
+    body = bytearray()
+    while True:
+        line = rfile.readline(1024)
+        if not line:
+            raise ValueError("connection closed inside chunked body")
+        size = int(line.split(b';', 1)[0].strip(), 16)
+        if size == 0:
+            break
+        data = rfile.read(size)
+        if len(data) != size or rfile.read(2) != b'\r\n':
+            raise ValueError("truncated chunk")
+        body += data
+    
+    # Skip any trailer headers up to the blank line
+    while True:
+        line = rfile.readline(1024)
+        if line in (b'\r\n', b'\n', b''):
+            break
+    return bytes(body)
+
+def parse_batch(body, count):
+    """
+    Split a batch upload body into (path, filename, data) items
+
+    Each item is framed with big-endian lengths:
+    u16 path length, path, u16 filename length, filename, u32 size, data
+    """
+    items = []
+    pos = 0
+    while pos < len(body):
+        if pos + 2 > len(body):
+            raise ValueError("truncated item header")
+        path_len = struct.unpack_from('>H', body, pos)[0]
+        pos += 2
+        path = body[pos:pos + path_len].decode('utf-8')
+        pos += path_len
+        name_len = struct.unpack_from('>H', body, pos)[0]
+        pos += 2
+        name = body[pos:pos + name_len].decode('utf-8')
+        pos += name_len
+        size = struct.unpack_from('>I', body, pos)[0]
+        pos += 4
+        data = body[pos:pos + size]
+        if len(data) != size:
+            raise ValueError(f"truncated data for {name}")
+        pos += size
+        items.append((path, name, data))
+    
+    if count is not None and len(items) != count:
+        raise ValueError(f"expected {count} items, got {len(items)}")
+    return items
+
 class SyncServerHandler(http.server.BaseHTTPRequestHandler):
     """Handler for sync requests"""
     
+    # HTTP/1.1 keeps the connection open between requests (every response
+    # must then carry a Content-Length)
+    protocol_version = "HTTP/1.1"
+    # Headers and body are written separately; without TCP_NODELAY the body
+    # waits for the client's delayed ACK on every kept-alive response
+    disable_nagle_algorithm = True
+    
     def do_GET(self):
         """Handle GET requests"""
         parsed = urlparse(self.path)
@@ -66,26 +132,125 @@ class SyncServerHandler(http.server.BaseHTTPRequestHandler):
                 "timestamp": datetime.now().isoformat()
             }
             
+            config_bytes = json.dumps(config, indent=2, ensure_ascii=False).encode('utf-8')
             self.send_response(200)
             self.send_header('Content-Type', 'application/json; charset=utf-8')
+            self.send_header('Content-Length', str(len(config_bytes)))
             self.end_headers()
-            self.wfile.write(json.dumps(config, indent=2, ensure_ascii=False).encode('utf-8'))
+            self.wfile.write(config_bytes)
             
             print(f"[CONFIG] Sent config to device {device_id}")
             
         else:
             self.send_error(404, "Not Found")
     
+    def send_json(self, code, obj):
+        """Send a JSON response with a Content-Length"""
+        response_bytes = json.dumps(obj, ensure_ascii=False).encode('utf-8')
+        self.send_response(code)
+        self.send_header('Content-Type', 'application/json; charset=utf-8')
+        self.send_header('Content-Length', str(len(response_bytes)))
+        self.end_headers()
+        self.wfile.write(response_bytes)
+    
+    def read_body(self):
+        """
+        Read the request body, undoing Transfer-Encoding: chunked and
+        Content-Encoding: gzip
+
+        Returns (data, bytes received), or None after answering 415 or 400
+        if the body cannot be decoded. The body is always read in full
+        first, so the connection stays usable.
+        """
+        if 'chunked' in self.headers.get('Transfer-Encoding', '').lower():
+            body = read_chunked(self.rfile)
+        else:
+            body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        
+        encoding = self.headers.get('Content-Encoding', 'identity').strip().lower()
+        if encoding in ('', 'identity'):
+            return body, len(body)
+        if encoding not in ('gzip', 'x-gzip'):
+            self.send_error(415, f"Unsupported Content-Encoding: {encoding}")
+            print(f"[UPLOAD] Rejected - unsupported Content-Encoding: {encoding}")
+            return None
+        try:
+            return gzip.decompress(body), len(body)
+        except (OSError, EOFError, zlib.error) as e:
+            self.send_error(400, f"Bad gzip body: {e}")
+            print(f"[UPLOAD] Rejected - bad gzip body: {e}")
+            return None
+    
+    def handle_batch(self):
+        """Handle POST /upload/batch: several files in one framed body"""
+        decoded = self.read_body()
+        if decoded is None:
+            return
+        body, wire_size = decoded
+        
+        if self.headers.get('X-API-Key', '') != "test-api-key":
+            self.send_error(401, "Invalid API Key")
+            print(f"[BATCH] Rejected - invalid API key")
+            return
+        
+        try:
+            count = self.headers.get('X-Batch-Count')
+            items = parse_batch(body, int(count) if count else None)
+        except (ValueError, struct.error, UnicodeDecodeError) as e:
+            self.send_error(400, f"Malformed batch: {e}")
+            print(f"[BATCH] Rejected - malformed: {e}")
+            return
+        
+        timestamp = datetime.now().strftime("%Y%m%d_%H%M%S")
+        results = []
+        if wire_size != len(body):
+            print(f"[BATCH] {len(items)} files, {len(body)} bytes ({wire_size} gzip):")
+        else:
+            print(f"[BATCH] {len(items)} files, {len(body)} bytes:")
+        for index, (doc_path, filename, file_data) in enumerate(items):
+            safe_path = sanitize_filename(doc_path.replace('/', '_'))
+            output_filename = f"{timestamp}_{safe_path}_{sanitize_filename(filename)}"
+            try:
+                with open(os.path.join(UPLOAD_DIR, output_filename), 'wb') as f:
+                    f.write(file_data)
+                results.append({"index": index, "status": 200, "path": doc_path,
+                                "filename": filename, "size": len(file_data),
+                                "saved_as": output_filename})
+                print(f"  {doc_path} ({len(file_data)} bytes) -> {output_filename}")
+            except OSError as e:
+                results.append({"index": index, "status": 500, "path": doc_path,
+                                "filename": filename, "message": str(e)})
+                print(f"  {doc_path}: FAILED {e}")
+        
+        self.send_json(200, {
+            "status": "success",
+            "count": len(results),
+            "results": results,
+            "timestamp": datetime.now().isoformat()
+        })
+    
     def do_POST(self):
         """Handle POST requests"""
-        if self.path == "/upload":
+        if self.path == "/upload/batch":
+            self.handle_batch()
+        elif self.path == "/upload":
             try:
                 # Extract headers (handle UTF-8)
                 api_key = self.headers.get('X-API-Key', '')
                 doc_path = self.headers.get('X-Document-Path', 'Unknown')
                 filename = self.headers.get('X-Filename', 'unknown.rm')
+                chunked = 'chunked' in self.headers.get('Transfer-Encoding', '').lower()
                 content_length = int(self.headers.get('Content-Length', 0))
                 
+                # Read file data (streamed uploads arrive chunked, and
+                # either may be gzip-compressed)
+                decoded = self.read_body()
+                if decoded is None:
+                    return
+                file_data, wire_size = decoded
+                if chunked:
+                    content_length = wire_size
+                
                 # Validate API key
                 if api_key != "test-api-key":
                     self.send_error(401, "Invalid API Key")
@@ -98,13 +263,10 @@ class SyncServerHandler(http.server.BaseHTTPRequestHandler):
                     print(f"[UPLOAD] Rejected - no content")
                     return
                 
-                # Read file data
-                file_data = self.rfile.read(content_length)
-                
                 # Verify we got all the data
-                if len(file_data) != content_length:
-                    self.send_error(400, f"Incomplete upload: got {len(file_data)} bytes, expected {content_length}")
-                    print(f"[UPLOAD] Rejected - incomplete: {len(file_data)}/{content_length} bytes")
+                if wire_size != content_length:
+                    self.send_error(400, f"Incomplete upload: got {wire_size} bytes, expected {content_length}")
+                    print(f"[UPLOAD] Rejected - incomplete: {wire_size}/{content_length} bytes")
                     return
                 
                 # Create safe filename
@@ -129,6 +291,11 @@ class SyncServerHandler(http.server.BaseHTTPRequestHandler):
                 print(f"[UPLOAD] Success:")
                 print(f"  Path: {doc_path}")
                 print(f"  Filename: {filename}")
+                if chunked:
+                    print(f"  Transfer: chunked")
+                if wire_size != len(file_data):
+                    print(f"  Encoding: gzip ({wire_size} bytes received, "
+                          f"{len(file_data) - wire_size} saved)")
                 print(f"  Expected size: {content_length} bytes")
                 print(f"  Received size: {len(file_data)} bytes")
                 print(f"  Saved size: {actual_size} bytes")
@@ -172,9 +339,10 @@ class SyncServerHandler(http.server.BaseHTTPRequestHandler):
         if args[1][0] != '2':  # Not a 2xx status code
             super().log_message(format, *args)
 
-class ReuseAddrTCPServer(socketserver.TCPServer):
-    """TCP server that allows address reuse"""
+class ReuseAddrTCPServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    """TCP server that allows address reuse (one thread per kept-alive connection)"""
     allow_reuse_address = True
+    daemon_threads = True
 
 if __name__ == "__main__":
     print(f"=== reMarkable Sync Test Server (Fixed) ===")
@@ -184,11 +352,15 @@ if __name__ == "__main__":
     print(f"Endpoints:")
     print(f"  GET  http://localhost:{PORT}/config?device_id=XXX")
     print(f"  POST http://localhost:{PORT}/upload")
+    print(f"  POST http://localhost:{PORT}/upload/batch")
     print(f"")
     print(f"Features:")
     print(f"  - Handles binary uploads correctly")
     print(f"  - Supports UTF-8 paths (Hebrew, etc.)")
     print(f"  - Windows-safe filenames")
+    print(f"  - HTTP/1.1 keep-alive connections")
+    print(f"  - Streamed (chunked) uploads of any size")
+    print(f"  - gzip-compressed uploads (Content-Encoding: gzip)")
     print(f"  - Detailed logging")
     print(f"")
     print(f"Press Ctrl+C to stop")